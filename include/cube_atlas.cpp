@@ -250,6 +250,8 @@ Atlas::Atlas(uint16_t textureSize, uint16_t maxRegionsCount )
 	m_regions = new AtlasRegion[maxRegionsCount];
 	m_textureBuffer = new uint8_t[ textureSize * textureSize * 6 * 4 ];
 	memset(m_textureBuffer, 0,  textureSize * textureSize * 6 * 4);
+	m_batchDepth = 0;
+	memset(m_dirtyRects, 0, sizeof(m_dirtyRects));
 	//BGFX_TEXTURE_MIN_POINT|BGFX_TEXTURE_MAG_POINT|BGFX_TEXTURE_MIP_POINT;
 	//BGFX_TEXTURE_MIN_ANISOTROPIC|BGFX_TEXTURE_MAG_ANISOTROPIC|BGFX_TEXTURE_MIP_POINT
 	//BGFX_TEXTURE_U_CLAMP|BGFX_TEXTURE_V_CLAMP
@@ -281,6 +283,8 @@ Atlas::Atlas(uint16_t textureSize, const uint8_t* textureBuffer , uint16_t regio
 	m_maxRegionCount = regionCount;
 	m_regions = new AtlasRegion[regionCount];
 	m_textureBuffer = new uint8_t[getTextureBufferSize()];
+	m_batchDepth = 0;
+	memset(m_dirtyRects, 0, sizeof(m_dirtyRects));
 	
 	//BGFX_TEXTURE_MIN_POINT|BGFX_TEXTURE_MAG_POINT|BGFX_TEXTURE_MIP_POINT;
 	//BGFX_TEXTURE_MIN_ANISOTROPIC|BGFX_TEXTURE_MAG_ANISOTROPIC|BGFX_TEXTURE_MIP_POINT
@@ -361,14 +365,11 @@ uint16_t Atlas::addRegion(uint16_t width, uint16_t height, const uint8_t* bitmap
 
 void Atlas::updateRegion(const AtlasRegion& region, const uint8_t* bitmapBuffer)
 {	
-	const bgfx::Memory* mem = bgfx::alloc(region.width * region.height * 4);
-	//BAD!
-	memset(mem->data,0, mem->size);
+	uint32_t face = region.getFaceIndex();
+	uint8_t* outLineBuffer = m_textureBuffer + face * (m_textureSize*m_textureSize*4) + (((region.y *m_textureSize)+region.x)*4);
+	const uint8_t* inLineBuffer = bitmapBuffer;
 	if(region.getType() == AtlasRegion::TYPE_BGRA8)
 	{	
-		const uint8_t* inLineBuffer = bitmapBuffer;
-		uint8_t* outLineBuffer = m_textureBuffer + region.getFaceIndex() * (m_textureSize*m_textureSize*4) + (((region.y *m_textureSize)+region.x)*4);
-
 		//update the cpu buffer
 		for(int y = 0; y < region.height; ++y)
 		{
@@ -376,14 +377,9 @@ void Atlas::updateRegion(const AtlasRegion& region, const uint8_t* bitmapBuffer)
 			inLineBuffer += region.width*4;
 			outLineBuffer += m_textureSize*4;
 		}
-		//update the GPU buffer
-		memcpy(mem->data, bitmapBuffer, mem->size);
 	}else
 	{
 		uint32_t layer = region.getComponentIndex();
-		uint32_t face = region.getFaceIndex();
-		const uint8_t* inLineBuffer = bitmapBuffer;
-		uint8_t* outLineBuffer = (m_textureBuffer + region.getFaceIndex() * (m_textureSize*m_textureSize*4) + (((region.y *m_textureSize)+region.x)*4));
 		
 		//update the cpu buffer
 		for(int y = 0; y<region.height; ++y)
@@ -392,13 +388,69 @@ void Atlas::updateRegion(const AtlasRegion& region, const uint8_t* bitmapBuffer)
 			{
 				outLineBuffer[(x*4) + layer] = inLineBuffer[x];
 			}
-			//update the GPU buffer
-			memcpy(mem->data + y*region.width*4, outLineBuffer, region.width*4);
 			inLineBuffer += region.width;
 			outLineBuffer +=  m_textureSize*4;
 		}
 	}
-	bgfx::updateTextureCube(m_textureHandle, (uint8_t)region.getFaceIndex(), 0, region.x, region.y, region.width, region.height, mem);		
+
+	if(m_batchDepth > 0)
+	{
+		//defer the GPU update to endBatch, growing the dirty rectangle of the face
+		DirtyRect& dirty = m_dirtyRects[face];
+		if(dirty.x0 >= dirty.x1)
+		{
+			dirty.x0 = region.x;
+			dirty.y0 = region.y;
+			dirty.x1 = region.x + region.width;
+			dirty.y1 = region.y + region.height;
+		}else
+		{
+			if(region.x < dirty.x0) dirty.x0 = region.x;
+			if(region.y < dirty.y0) dirty.y0 = region.y;
+			if(region.x + region.width > dirty.x1) dirty.x1 = region.x + region.width;
+			if(region.y + region.height > dirty.y1) dirty.y1 = region.y + region.height;
+		}
+		return;
+	}
+
+	uploadRect(face, region.x, region.y, region.width, region.height);
+}
+
+void Atlas::beginBatch()
+{
+	++m_batchDepth;
+}
+
+void Atlas::endBatch()
+{
+	assert(m_batchDepth > 0 && "endBatch without beginBatch");
+	if(--m_batchDepth > 0)
+	{
+		return;
+	}
+
+	for(uint32_t face = 0; face < 6; ++face)
+	{
+		DirtyRect& dirty = m_dirtyRects[face];
+		if(dirty.x0 < dirty.x1)
+		{
+			uploadRect(face, dirty.x0, dirty.y0, dirty.x1 - dirty.x0, dirty.y1 - dirty.y0);
+		}
+		dirty.x0 = dirty.y0 = dirty.x1 = dirty.y1 = 0;
+	}
+}
+
+void Atlas::uploadRect(uint32_t face, uint16_t x, uint16_t y, uint16_t width, uint16_t height)
+{
+	//update the GPU buffer from the cpu mirror
+	const bgfx::Memory* mem = bgfx::alloc(width * height * 4);
+	const uint8_t* inLineBuffer = m_textureBuffer + face * (m_textureSize*m_textureSize*4) + (((y *m_textureSize)+x)*4);
+	for(int yy = 0; yy < height; ++yy)
+	{
+		memcpy(mem->data + yy*width*4, inLineBuffer, width*4);
+		inLineBuffer += m_textureSize*4;
+	}
+	bgfx::updateTextureCube(m_textureHandle, (uint8_t)face, 0, x, y, width, height, mem);		
 }
 
 void Atlas::packFaceLayerUV(uint32_t idx, uint8_t* vertexBuffer, uint32_t offset, uint32_t stride )
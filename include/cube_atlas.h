@@ -58,6 +58,13 @@ public:
 	/// update a preallocated region
 	void updateRegion(const AtlasRegion& region, const uint8_t* bitmapBuffer);
 
+	/// defer the texture uploads of addRegion/updateRegion until the matching endBatch
+	/// @remark calls can be nested, only the outermost endBatch uploads
+	void beginBatch();
+
+	/// upload the bounding rectangle of every face touched since beginBatch, once per face
+	void endBatch();
+
 	/// Pack the UV coordinates of the four corners of a region to a vertex buffer using the supplied vertex format.
 	/// v0 -- v3
 	/// |     |     encoded in that order:  v0,v1,v2,v3
@@ -111,6 +118,8 @@ public:
 
 private:
 
+	void uploadRect(uint32_t face, uint16_t x, uint16_t y, uint16_t width, uint16_t height);
+
 	void writeUV( uint8_t* vertexBuffer, int16_t x, int16_t y, int16_t z, int16_t w) 
 	{
 		((uint16_t*) vertexBuffer)[0] = x;
@@ -133,4 +142,11 @@ private:
 	AtlasRegion* m_regions;	
 	uint8_t* m_textureBuffer;
 
+	struct DirtyRect
+	{
+		uint16_t x0, y0, x1, y1;
+	};
+	uint32_t m_batchDepth;
+	DirtyRect m_dirtyRects[6];
+
 };}
\ No newline at end of file
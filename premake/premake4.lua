@@ -112,6 +112,7 @@ end
 --"CB4B9765-24BE-418B-A36B-817482B7AE32"
 exampleProject("01_basics", "EF6FD5B3-B52A-41C2-A257-9DFE709AF9E1")
 exampleProject("02_distance_field_text", "F4E6F96F-3DAA-4C68-8DF8-BF2A3ECD9092")
+exampleProject("03_benchmark", "F7684ADB-7C27-41BF-B3F4-78285972AC98")
 --exampleProject("03_show_texture_atlas", "EF6FD5B3-B52A-41C2-A257-9DFE709AF9E1")
 --exampleProject("04_buffer_type", "EF6FD5B3-B52A-41C2-A257-9DFE709AF9E1")
 
@@ -0,0 +1,375 @@
+#include <bgfx.h>
+#include <bx/bx.h>
+#include <bx/timer.h>
+#include <common/entry.h>
+#include <common/dbg.h>
+#include <common/math.h>
+#include <common/processevents.h>
+
+#include "../src/font_manager.h"
+#include "../src/text_buffer_manager.h"
+#include "../src/text_shaper.h"
+#include "../src/utf8.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+
+static const char* s_shaderPath = NULL;
+
+//the results are printed on the console once and shown with the debug text every frame
+static const uint32_t MAX_RESULTS = 48;
+static char s_results[MAX_RESULTS][96];
+static uint32_t s_resultCount = 0;
+
+static void addResult(const char* format, ...)
+{
+	if(s_resultCount == MAX_RESULTS) return;
+	va_list args;
+	va_start(args, format);
+	vsnprintf(s_results[s_resultCount], sizeof(s_results[0]), format, args);
+	va_end(args);
+	printf("%s\n", s_results[s_resultCount]);
+	++s_resultCount;
+}
+
+static double toMs(int64_t counter)
+{
+	return double(counter) * 1000.0 / double(bx::getHPFrequency() );
+}
+
+//text with many kerned pairs (AV, To, Wa, ...)
+static const char* s_paragraph =
+	"AVAST! To Wally, Tom and Vera: WAVY LAYOUT of Yoyo's Tavern. "
+	"The quick brown fox jumps over the lazy dog. Pack my box with five dozen liquor jugs.\n";
+
+static const uint32_t LAYOUT_ITERATIONS = 2000;
+
+/// lay a string out iterations times in a buffer emptied before each layout
+/// @return the time taken in ms
+static double timeLayout(bgfx_font::TextBufferManager* textBufferManager, bgfx_font::TextBufferHandle buffer, bgfx_font::FontHandle font, const char* text, uint32_t iterations)
+{
+	int64_t start = bx::getHPCounter();
+	for(uint32_t i = 0; i < iterations; ++i)
+	{
+		textBufferManager->clearTextBuffer(buffer);
+		textBufferManager->appendText(buffer, font, text);
+	}
+	return toMs(bx::getHPCounter() - start);
+}
+
+/// layout throughput of a kerned paragraph, and cost of the pair lookups alone
+static void benchKerning(bgfx_font::FontManager* fontManager, bgfx_font::TextBufferManager* textBufferManager, bgfx_font::FontHandle font)
+{
+	uint32_t length = (uint32_t) strlen(s_paragraph);
+	bgfx_font::TextBufferHandle buffer = textBufferManager->createTextBuffer(bgfx_font::FONT_TYPE_ALPHA, bgfx_font::TRANSIENT);
+	//bake the glyphs before timing
+	textBufferManager->appendText(buffer, font, s_paragraph);
+	double layoutMs = timeLayout(textBufferManager, buffer, font, s_paragraph, LAYOUT_ITERATIONS);
+	textBufferManager->destroyTextBuffer(buffer);
+	addResult("kerning: layout %.0f glyphs/ms", double(LAYOUT_ITERATIONS) * length / layoutMs);
+
+	int32_t glyphIndices[256];
+	for(uint32_t i = 0; i < length; ++i)
+	{
+		glyphIndices[i] = fontManager->getGlyphIndex(font, (bgfx_font::CodePoint_t) s_paragraph[i]);
+	}
+	uint32_t kernedPairs = 0;
+	float totalKerning = 0.0f;
+	int64_t start = bx::getHPCounter();
+	for(uint32_t i = 0; i < LAYOUT_ITERATIONS; ++i)
+	{
+		for(uint32_t j = 1; j < length; ++j)
+		{
+			float kerning = fontManager->getKerning(font, glyphIndices[j-1], glyphIndices[j]);
+			totalKerning += kerning;
+			kernedPairs += (kerning != 0.0f);
+		}
+	}
+	double lookupMs = toMs(bx::getHPCounter() - start);
+	addResult("kerning: %.0f pair lookups/ms, %u of %u pairs kerned (%.1f px)", double(LAYOUT_ITERATIONS) * (length-1) / lookupMs
+		, kernedPairs / LAYOUT_ITERATIONS, length-1, totalKerning / LAYOUT_ITERATIONS);
+}
+
+/// layout throughput with every shaped run found in the cache, and with the cache emptied before each layout
+static void benchShapedRunCache(bgfx_font::FontManager* fontManager, bgfx_font::TextBufferManager* textBufferManager, bgfx_font::FontHandle font)
+{
+	bgfx_font::ShapedRunCache* cache = fontManager->getShapedRunCache();
+	bgfx_font::TextBufferHandle buffer = textBufferManager->createTextBuffer(bgfx_font::FONT_TYPE_ALPHA, bgfx_font::TRANSIENT);
+	textBufferManager->appendText(buffer, font, s_paragraph);
+
+	cache->resetCounters();
+	double cachedMs = timeLayout(textBufferManager, buffer, font, s_paragraph, LAYOUT_ITERATIONS);
+	uint32_t hitCount = cache->getHitCount();
+	uint32_t missCount = cache->getMissCount();
+
+	int64_t start = bx::getHPCounter();
+	for(uint32_t i = 0; i < LAYOUT_ITERATIONS; ++i)
+	{
+		cache->clear();
+		textBufferManager->clearTextBuffer(buffer);
+		textBufferManager->appendText(buffer, font, s_paragraph);
+	}
+	double uncachedMs = toMs(bx::getHPCounter() - start);
+	textBufferManager->destroyTextBuffer(buffer);
+
+	addResult("shaped runs: cached %.3f ms, uncached %.3f ms per layout, hit rate %.0f%%", cachedMs / LAYOUT_ITERATIONS, uncachedMs / LAYOUT_ITERATIONS
+		, 100.0 * hitCount / (hitCount + missCount > 0 ? hitCount + missCount : 1) );
+}
+
+/// CPU submit time of the same text as vertices and as instance records, and the bytes uploaded per glyph quad
+static void benchInstancing(bgfx_font::TextBufferManager* textBufferManager, bgfx_font::FontHandle font)
+{
+	const bgfx_font::BufferType types[2] = { bgfx_font::TRANSIENT, bgfx_font::INSTANCED };
+	const char* names[2] = { "vertices", "instances" };
+	//4 vertices of 20 bytes per quad (the index buffer is shared), or a record of 32 bytes
+	const uint32_t quadSizes[2] = { 80, 32 };
+	for(uint32_t t = 0; t < 2; ++t)
+	{
+		bgfx_font::TextBufferHandle buffer = textBufferManager->createTextBuffer(bgfx_font::FONT_TYPE_ALPHA, types[t]);
+		for(uint32_t i = 0; i < 20; ++i)
+		{
+			textBufferManager->appendText(buffer, font, s_paragraph);
+		}
+		int64_t start = bx::getHPCounter();
+		for(uint32_t i = 0; i < LAYOUT_ITERATIONS; ++i)
+		{
+			textBufferManager->submitTextBuffer(buffer, 0);
+		}
+		double submitMs = toMs(bx::getHPCounter() - start);
+		textBufferManager->destroyTextBuffer(buffer);
+		addResult("instancing: %s submit %.3f ms for 20 paragraphs, %u bytes per glyph", names[t], submitMs / LAYOUT_ITERATIONS, quadSizes[t]);
+	}
+}
+
+/// layout of long lines whose words alternate between font sizes, each line is laid out once its tallest font is known
+static void benchMixedSizeLines(bgfx_font::TextBufferManager* textBufferManager, const bgfx_font::FontHandle* fonts, uint32_t fontCount)
+{
+	const uint32_t WORD_COUNT = 2000;
+	const uint32_t ITERATIONS = 20;
+	bgfx_font::TextBufferHandle buffer = textBufferManager->createTextBuffer(bgfx_font::FONT_TYPE_ALPHA, bgfx_font::TRANSIENT);
+	int64_t start = 0;
+	for(uint32_t i = 0; i <= ITERATIONS; ++i)
+	{
+		//the first pass bakes the glyphs
+		if(i == 1)
+		{
+			start = bx::getHPCounter();
+		}
+		textBufferManager->clearTextBuffer(buffer);
+		for(uint32_t word = 0; word < WORD_COUNT; ++word)
+		{
+			textBufferManager->appendText(buffer, fonts[word % fontCount], (word % 100 == 99) ? "word\n" : "word ");
+		}
+	}
+	double layoutMs = toMs(bx::getHPCounter() - start);
+	textBufferManager->destroyTextBuffer(buffer);
+	addResult("mixed sizes: %u words on lines of 100 in %u sizes, %.2f ms", WORD_COUNT, fontCount, layoutMs / ITERATIONS);
+}
+
+/// wrap a 100 KB document, then wrap it again at other widths: its break opportunities are cached and only the lines are reassigned
+static void benchWrapping(bgfx_font::TextBufferManager* textBufferManager, bgfx_font::FontHandle font)
+{
+	uint32_t paragraphLength = (uint32_t) strlen(s_paragraph);
+	uint32_t paragraphCount = 100 * 1024 / paragraphLength;
+	char* document = new char[paragraphCount * paragraphLength + 1];
+	for(uint32_t i = 0; i < paragraphCount; ++i)
+	{
+		memcpy(document + i * paragraphLength, s_paragraph, paragraphLength);
+	}
+	document[paragraphCount * paragraphLength] = 0;
+
+	bgfx_font::TextBufferHandle buffer = textBufferManager->createTextBuffer(bgfx_font::FONT_TYPE_ALPHA, bgfx_font::TRANSIENT);
+	const float widths[5] = { 300.0f, 200.0f, 400.0f, 800.0f, 1600.0f };
+	for(uint32_t i = 0; i < 5; ++i)
+	{
+		textBufferManager->setWrapping(buffer, bgfx_font::WRAP_WORD, widths[i]);
+		double wrapMs = timeLayout(textBufferManager, buffer, font, document, 1);
+		addResult("wrapping: %u KB %s at %.0f px, %.2f ms", paragraphCount * paragraphLength / 1024, (i == 0) ? "first wrap" : "rewrap", widths[i], wrapMs);
+	}
+	textBufferManager->destroyTextBuffer(buffer);
+	delete [] document;
+}
+
+/// time of the labels of an UI appended to a TRANSIENT buffer each frame, with and without layout caching
+static void benchLayoutCache(bgfx_font::TextBufferManager* textBufferManager, bgfx_font::FontHandle font)
+{
+	const char* labels[8] = { "HP", "MP", "Inventory", "Long sword of the north", "Health potion", "Quest log", "Options", "Quit" };
+	const uint32_t LABEL_COUNT = 200;
+	const uint32_t FRAME_COUNT = 200;
+	double frameMs[2];
+	for(uint32_t caching = 0; caching < 2; ++caching)
+	{
+		bgfx_font::TextBufferHandle buffer = textBufferManager->createTextBuffer(bgfx_font::FONT_TYPE_ALPHA, bgfx_font::TRANSIENT);
+		textBufferManager->setLayoutCaching(buffer, caching != 0);
+		textBufferManager->resetLayoutCacheCounters();
+		int64_t start = bx::getHPCounter();
+		for(uint32_t frame = 0; frame < FRAME_COUNT; ++frame)
+		{
+			textBufferManager->clearTextBuffer(buffer);
+			for(uint32_t i = 0; i < LABEL_COUNT; ++i)
+			{
+				textBufferManager->setPenPosition(buffer, (float)(i % 4) * 200.0f, (float)(i / 4) * 20.0f);
+				textBufferManager->appendText(buffer, font, labels[i % 8]);
+			}
+		}
+		frameMs[caching] = toMs(bx::getHPCounter() - start) / FRAME_COUNT;
+		textBufferManager->destroyTextBuffer(buffer);
+	}
+	uint32_t hitCount = textBufferManager->getLayoutCacheHitCount();
+	uint32_t missCount = textBufferManager->getLayoutCacheMissCount();
+	addResult("layout cache: %u labels per frame, %.3f ms uncached, %.3f ms cached, saves %.3f ms", LABEL_COUNT, frameMs[0], frameMs[1], frameMs[0] - frameMs[1]);
+	addResult("layout cache: hit rate %.1f%%", 100.0 * hitCount / (hitCount + missCount > 0 ? hitCount + missCount : 1) );
+}
+
+/// utf-8 decoding throughput of mostly ASCII text and of CJK text (3 bytes per code point)
+static void benchDecoding()
+{
+	const uint32_t SIZE = 1024 * 1024;
+	const uint32_t ITERATIONS = 50;
+	uint8_t* text = new uint8_t[SIZE];
+	uint32_t* codePoints = new uint32_t[SIZE];
+	const char* names[2] = { "ASCII", "CJK" };
+	for(uint32_t pass = 0; pass < 2; ++pass)
+	{
+		uint32_t paragraphLength = (uint32_t) strlen(s_paragraph);
+		for(uint32_t i = 0; i < SIZE; ++i)
+		{
+			//U+4E00 + i%3, encoded E4 B8 80..82
+			const uint8_t cjk[3] = { 0xE4, 0xB8, (uint8_t)(0x80 + (i / 3) % 3) };
+			text[i] = (pass == 0) ? (uint8_t)s_paragraph[i % paragraphLength] : cjk[i % 3];
+		}
+		uint32_t count = 0;
+		int64_t start = bx::getHPCounter();
+		for(uint32_t i = 0; i < ITERATIONS; ++i)
+		{
+			count = bgfx_font::utf8_decode_string(text, SIZE - SIZE % 3, codePoints);
+		}
+		double decodeMs = toMs(bx::getHPCounter() - start);
+		addResult("utf-8 decoding: %s %.2f GB/s (%u code points)", names[pass], double(SIZE) * ITERATIONS / (decodeMs * 1000000.0), count);
+	}
+	delete [] codePoints;
+	delete [] text;
+}
+
+/// layout throughput of each decoration combination, each one has its own glyph emitter
+static void benchDecorations(bgfx_font::TextBufferManager* textBufferManager, bgfx_font::FontHandle font)
+{
+	const uint32_t styles[4] = { bgfx_font::STYLE_NORMAL, bgfx_font::STYLE_UNDERLINE, bgfx_font::STYLE_BACKGROUND|bgfx_font::STYLE_UNDERLINE
+		, bgfx_font::STYLE_BACKGROUND|bgfx_font::STYLE_UNDERLINE|bgfx_font::STYLE_OVERLINE|bgfx_font::STYLE_STRIKE_THROUGH };
+	const char* names[4] = { "plain", "underline", "background+underline", "all" };
+	uint32_t length = (uint32_t) strlen(s_paragraph);
+	for(uint32_t i = 0; i < 4; ++i)
+	{
+		bgfx_font::TextBufferHandle buffer = textBufferManager->createTextBuffer(bgfx_font::FONT_TYPE_ALPHA, bgfx_font::TRANSIENT);
+		textBufferManager->setStyle(buffer, styles[i]);
+		textBufferManager->appendText(buffer, font, s_paragraph);
+		double layoutMs = timeLayout(textBufferManager, buffer, font, s_paragraph, LAYOUT_ITERATIONS);
+		textBufferManager->destroyTextBuffer(buffer);
+		addResult("decorations: %s %.0f glyphs/ms", names[i], double(LAYOUT_ITERATIONS) * length / layoutMs);
+	}
+}
+
+int _main_(int _argc, char** _argv)
+{
+    uint32_t width = 1280;
+	uint32_t height = 720;
+	uint32_t debug = BGFX_DEBUG_TEXT;
+	uint32_t reset = 0;
+
+	bgfx::init();
+
+	bgfx::reset(width, height);
+
+	// Enable debug text.
+	bgfx::setDebug(debug);
+
+	// Set view 0 clear state.
+	bgfx::setViewClear(0
+		, BGFX_CLEAR_COLOR_BIT|BGFX_CLEAR_DEPTH_BIT
+		, 0x303030ff
+		, 1.0f
+		, 0
+		);
+
+    // Setup root path for binary shaders. Shader binaries are different
+	// for each renderer.
+	switch (bgfx::getRendererType() )
+	{
+	default:
+	case bgfx::RendererType::Direct3D9:
+		s_shaderPath = "shaders/dx9/";
+		break;
+
+	case bgfx::RendererType::Direct3D11:
+		s_shaderPath = "shaders/dx11/";
+		break;
+
+	case bgfx::RendererType::OpenGL:
+		s_shaderPath = "shaders/glsl/";
+		break;
+
+	case bgfx::RendererType::OpenGLES2:
+	case bgfx::RendererType::OpenGLES3:
+		s_shaderPath = "shaders/gles/";
+		break;
+	}
+
+	//init the text rendering system
+	bgfx_font::FontManager* fontManager = new bgfx_font::FontManager(512);
+	bgfx_font::TextBufferManager* textBufferManager = new bgfx_font::TextBufferManager(fontManager);
+	textBufferManager->init(s_shaderPath);
+
+	bgfx_font::TrueTypeHandle times_tt = fontManager->loadTrueTypeFromFile("c:/windows/fonts/times.ttf");
+	bgfx_font::FontHandle times_24 = fontManager->createFontByPixelSize(times_tt, 0, 24);
+	bgfx_font::FontHandle mixedFonts[3] = 
+	{
+		fontManager->createFontByPixelSize(times_tt, 0, 12),
+		times_24,
+		fontManager->createFontByPixelSize(times_tt, 0, 48),
+	};
+
+	//the measurements are run once, before the first frame
+	benchKerning(fontManager, textBufferManager, times_24);
+	benchShapedRunCache(fontManager, textBufferManager, times_24);
+	benchInstancing(textBufferManager, times_24);
+	benchMixedSizeLines(textBufferManager, mixedFonts, 3);
+	benchWrapping(textBufferManager, times_24);
+	benchLayoutCache(textBufferManager, times_24);
+	benchDecoding();
+	benchDecorations(textBufferManager, times_24);
+
+    while (!processEvents(width, height, debug, reset) )
+	{
+		// Set view 0 default viewport.
+		bgfx::setViewRect(0, 0, 0, width, height);
+
+		// This dummy draw call is here to make sure that view 0 is cleared
+		// if no other draw calls are submitted to view 0.
+		bgfx::submit(0);
+
+		bgfx::dbgTextClear();
+		bgfx::dbgTextPrintf(0, 1, 0x4f, "bgfx_font/samples/03_benchmark");
+		for(uint32_t i = 0; i < s_resultCount; ++i)
+		{
+			bgfx::dbgTextPrintf(0, 3 + i, 0x0f, "%s", s_results[i]);
+		}
+
+        // Advance to next frame. Rendering thread will be kicked to
+		// process submitted rendering primitives.
+		bgfx::frame();
+	}
+
+	fontManager->destroyFont(mixedFonts[0]);
+	fontManager->destroyFont(mixedFonts[2]);
+	fontManager->destroyFont(times_24);
+	fontManager->unloadTrueType(times_tt);
+
+	delete textBufferManager;
+	delete fontManager;
+
+	// Shutdown bgfx.
+    bgfx::shutdown();
+
+	return 0;
+}
@@ -1,6 +1,8 @@
 vec2 a_position  : POSITION;
 vec4 a_color0    : COLOR0;
 vec4 a_texcoord0 : TEXCOORD0;
+vec4 i_data0     : TEXCOORD3;
+vec4 i_data1     : TEXCOORD4;
 
 vec4 v_color0      : COLOR0    = vec4(1.0, 0.0, 0.0, 1.0);
 vec4 v_texcoord0   : TEXCOORD0 = vec4(0.0, 0.0, 0.0, 0.0);
@@ -0,0 +1,35 @@
+$input a_position, i_data0, i_data1
+$output v_color0, v_texcoord0
+
+#include "common.sh"
+
+uniform float u_inverse_atlas_size;
+
+void main()
+{
+	// i_data0: quad rectangle (x0, y0, x1, y1)
+	// i_data1: atlas region x + y*4096, width + height*4096, color red + green*256, blue + alpha*256 + (face*4 + component)*65536
+	vec2 position = mix(i_data0.xy, i_data0.zw, a_position);
+	gl_Position = mul(u_modelViewProj, vec4(position, 0.0, 1.0) );
+
+	vec2 regionPosition = vec2(mod(i_data1.x, 4096.0), floor(i_data1.x / 4096.0));
+	vec2 regionSize = vec2(mod(i_data1.y, 4096.0), floor(i_data1.y / 4096.0));
+	vec2 uv = (regionPosition + regionSize * a_position) * (2.0 * u_inverse_atlas_size) - 1.0;
+
+	float mask = floor(i_data1.w / 65536.0);
+	float face = floor(mask / 4.0);
+	float component = mask - face * 4.0;
+
+	// same layout as Atlas::packUV
+	vec3 direction;
+	if(face < 0.5)      direction = vec3( 1.0, -uv.y, -uv.x);
+	else if(face < 1.5) direction = vec3(-1.0, -uv.y,  uv.x);
+	else if(face < 2.5) direction = vec3( uv.x,  1.0,  uv.y);
+	else if(face < 3.5) direction = vec3( uv.x, -1.0, -uv.y);
+	else if(face < 4.5) direction = vec3( uv.x, -uv.y,  1.0);
+	else                direction = vec3(-uv.x, -uv.y, -1.0);
+	v_texcoord0 = vec4(direction, component * 0.25);
+
+	float blueAlpha = i_data1.w - mask * 65536.0;
+	v_color0 = vec4(mod(i_data1.z, 256.0), floor(i_data1.z / 256.0), mod(blueAlpha, 256.0), floor(blueAlpha / 256.0)) / 255.0;
+}
@@ -0,0 +1,343 @@
+/* Copyright 2013 Jeremie Roy. All rights reserved.
+ * License: http://www.opensource.org/licenses/BSD-2-Clause
+*/
+#include "code_point_set.h"
+#include "utf8.h"
+
+#include <assert.h>
+#include <string.h>
+
+namespace bgfx_font
+{
+
+/// index of the lowest bit set, value must not be 0
+static inline uint32_t lowestBitIndex(uint32_t value)
+{
+	static const uint32_t debruijn[32] =
+	{
+		0, 1, 28, 2, 29, 14, 24, 3, 30, 22, 20, 15, 25, 17, 4, 8,
+		31, 27, 13, 23, 21, 19, 16, 7, 26, 12, 18, 6, 11, 5, 10, 9
+	};
+	return debruijn[((value & (0u - value)) * 0x077CB531u) >> 27];
+}
+
+static inline uint32_t bitCount(uint32_t value)
+{
+	value = value - ((value >> 1) & 0x55555555);
+	value = (value & 0x33333333) + ((value >> 2) & 0x33333333);
+	return (((value + (value >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24;
+}
+
+CodePointSet::CodePointSet()
+{
+	memset(m_planes, 0, sizeof(m_planes));
+}
+
+CodePointSet::CodePointSet(const CodePointSet& other)
+{
+	memset(m_planes, 0, sizeof(m_planes));
+	add(other);
+}
+
+CodePointSet::~CodePointSet()
+{
+	clear();
+}
+
+CodePointSet& CodePointSet::operator=(const CodePointSet& other)
+{
+	if(this != &other)
+	{
+		clear();
+		add(other);
+	}
+	return *this;
+}
+
+uint32_t* CodePointSet::getBlock(uint32_t plane, uint32_t block) const
+{
+	if(plane >= PLANE_COUNT || m_planes[plane] == NULL)
+	{
+		return NULL;
+	}
+	return m_planes[plane]->blocks[block];
+}
+
+uint32_t* CodePointSet::allocBlock(uint32_t plane, uint32_t block)
+{
+	assert(plane < PLANE_COUNT && "Code point out of unicode range");
+	if(m_planes[plane] == NULL)
+	{
+		m_planes[plane] = new Plane;
+		memset(m_planes[plane], 0, sizeof(Plane));
+	}
+	Plane& p = *m_planes[plane];
+	if(p.blocks[block] == NULL)
+	{
+		p.blocks[block] = new uint32_t[BLOCK_WORDS];
+		memset(p.blocks[block], 0, BLOCK_WORDS * sizeof(uint32_t));
+		p.blockMask[block >> 5] |= 1u << (block & 0x1f);
+	}
+	return p.blocks[block];
+}
+
+void CodePointSet::add(CodePoint_t codePoint)
+{
+	//the planes past the unicode range don't exist
+	if(codePoint < 0 || codePoint > MAX_CODE_POINT)
+	{
+		return;
+	}
+	uint32_t* words = allocBlock((uint32_t)codePoint >> 16, ((uint32_t)codePoint >> 8) & 0xff);
+	words[(codePoint >> 5) & 0x7] |= 1u << (codePoint & 0x1f);
+}
+
+void CodePointSet::addRange(CodePoint_t first, CodePoint_t last)
+{
+	//the range is clamped to the unicode range
+	if(first < 0)
+	{
+		first = 0;
+	}
+	if(last > MAX_CODE_POINT)
+	{
+		last = MAX_CODE_POINT;
+	}
+	CodePoint_t codePoint = first;
+	while(codePoint <= last)
+	{
+		uint32_t* words = allocBlock((uint32_t)codePoint >> 16, ((uint32_t)codePoint >> 8) & 0xff);
+		//fill whole words when the range covers them
+		if((codePoint & 0x1f) == 0 && last - codePoint >= 31)
+		{
+			words[(codePoint >> 5) & 0x7] = 0xffffffff;
+			codePoint += 32;
+		}else
+		{
+			words[(codePoint >> 5) & 0x7] |= 1u << (codePoint & 0x1f);
+			++codePoint;
+		}
+	}
+}
+
+bool CodePointSet::addUtf8(const char* _string)
+{
+	uint32_t codepoint;
+	uint32_t state = 0;
+	for (; *_string; ++_string)
+	{
+		if (!utf8_decode(&state, &codepoint, (uint8_t)*_string))
+		{
+			add((CodePoint_t)codepoint);
+		}
+	}
+	return state == UTF8_ACCEPT;
+}
+
+bool CodePointSet::addUtf16(const uint16_t* _string)
+{
+	bool wellFormed = true;
+	for (; *_string; ++_string)
+	{
+		uint32_t unit = *_string;
+		if(unit >= 0xD800 && unit <= 0xDBFF && _string[1] >= 0xDC00 && _string[1] <= 0xDFFF)
+		{
+			++_string;
+			add((CodePoint_t)(0x10000 + ((unit - 0xD800) << 10) + (*_string - 0xDC00)));
+		}else if(unit >= 0xD800 && unit <= 0xDFFF)
+		{
+			wellFormed = false;
+		}else
+		{
+			add((CodePoint_t)unit);
+		}
+	}
+	return wellFormed;
+}
+
+bool CodePointSet::addUtf32(const CodePoint_t* _string)
+{
+	bool wellFormed = true;
+	for (; *_string; ++_string)
+	{
+		CodePoint_t codePoint = *_string;
+		if(codePoint < 0 || codePoint > MAX_CODE_POINT || (codePoint >= 0xD800 && codePoint <= 0xDFFF))
+		{
+			wellFormed = false;
+		}else
+		{
+			add(codePoint);
+		}
+	}
+	return wellFormed;
+}
+
+bool CodePointSet::addWideString(const wchar_t* _string)
+{
+	if(sizeof(wchar_t) == sizeof(uint16_t))
+	{
+		return addUtf16((const uint16_t*)_string);
+	}
+	return addUtf32((const CodePoint_t*)_string);
+}
+
+void CodePointSet::remove(CodePoint_t codePoint)
+{
+	uint32_t* words = getBlock((uint32_t)codePoint >> 16, ((uint32_t)codePoint >> 8) & 0xff);
+	if(words != NULL)
+	{
+		words[(codePoint >> 5) & 0x7] &= ~(1u << (codePoint & 0x1f));
+	}
+}
+
+void CodePointSet::add(const CodePointSet& other)
+{
+	for(uint32_t plane = 0; plane < PLANE_COUNT; ++plane)
+	{
+		if(other.m_planes[plane] == NULL) continue;
+		for(uint32_t block = 0; block < BLOCK_COUNT; ++block)
+		{
+			const uint32_t* otherWords = other.m_planes[plane]->blocks[block];
+			if(otherWords == NULL) continue;
+			uint32_t* words = allocBlock(plane, block);
+			for(uint32_t i = 0; i < BLOCK_WORDS; ++i)
+			{
+				words[i] |= otherWords[i];
+			}
+		}
+	}
+}
+
+void CodePointSet::intersect(const CodePointSet& other)
+{
+	for(uint32_t plane = 0; plane < PLANE_COUNT; ++plane)
+	{
+		if(m_planes[plane] == NULL) continue;
+		for(uint32_t block = 0; block < BLOCK_COUNT; ++block)
+		{
+			uint32_t* words = m_planes[plane]->blocks[block];
+			if(words == NULL) continue;
+			const uint32_t* otherWords = other.getBlock(plane, block);
+			if(otherWords == NULL)
+			{
+				delete [] words;
+				m_planes[plane]->blocks[block] = NULL;
+				m_planes[plane]->blockMask[block >> 5] &= ~(1u << (block & 0x1f));
+				continue;
+			}
+			for(uint32_t i = 0; i < BLOCK_WORDS; ++i)
+			{
+				words[i] &= otherWords[i];
+			}
+		}
+	}
+}
+
+void CodePointSet::remove(const CodePointSet& other)
+{
+	for(uint32_t plane = 0; plane < PLANE_COUNT; ++plane)
+	{
+		if(m_planes[plane] == NULL || other.m_planes[plane] == NULL) continue;
+		for(uint32_t block = 0; block < BLOCK_COUNT; ++block)
+		{
+			uint32_t* words = m_planes[plane]->blocks[block];
+			const uint32_t* otherWords = other.m_planes[plane]->blocks[block];
+			if(words == NULL || otherWords == NULL) continue;
+			for(uint32_t i = 0; i < BLOCK_WORDS; ++i)
+			{
+				words[i] &= ~otherWords[i];
+			}
+		}
+	}
+}
+
+bool CodePointSet::contains(CodePoint_t codePoint) const
+{
+	if(codePoint < 0)
+	{
+		return false;
+	}
+	const uint32_t* words = getBlock((uint32_t)codePoint >> 16, ((uint32_t)codePoint >> 8) & 0xff);
+	return words != NULL && (words[(codePoint >> 5) & 0x7] & (1u << (codePoint & 0x1f))) != 0;
+}
+
+CodePoint_t CodePointSet::next(CodePoint_t codePoint) const
+{
+	uint32_t start = (uint32_t)(codePoint + 1);
+	for(uint32_t plane = start >> 16; plane < PLANE_COUNT; ++plane)
+	{
+		const Plane* p = m_planes[plane];
+		if(p == NULL) continue;
+
+		uint32_t firstBlock = (plane == (start >> 16)) ? ((start >> 8) & 0xff) : 0;
+		for(uint32_t block = firstBlock; block < BLOCK_COUNT; ++block)
+		{
+			//skip the unallocated blocks 32 at a time
+			uint32_t blockMask = p->blockMask[block >> 5] >> (block & 0x1f);
+			if(blockMask == 0)
+			{
+				block |= 0x1f;
+				continue;
+			}
+			block += lowestBitIndex(blockMask);
+
+			const uint32_t* words = p->blocks[block];
+			uint32_t blockStart = (plane << 16) | (block << 8);
+			uint32_t firstWord = 0;
+			uint32_t firstBit = 0;
+			if(blockStart < start)
+			{
+				firstWord = (start >> 5) & 0x7;
+				firstBit = start & 0x1f;
+			}
+			for(uint32_t i = firstWord; i < BLOCK_WORDS; ++i)
+			{
+				uint32_t bits = words[i];
+				if(i == firstWord)
+				{
+					bits &= 0xffffffff << firstBit;
+				}
+				if(bits != 0)
+				{
+					return (CodePoint_t)(blockStart + (i << 5) + lowestBitIndex(bits));
+				}
+			}
+		}
+	}
+	return END;
+}
+
+uint32_t CodePointSet::count() const
+{
+	uint32_t total = 0;
+	for(uint32_t plane = 0; plane < PLANE_COUNT; ++plane)
+	{
+		if(m_planes[plane] == NULL) continue;
+		for(uint32_t block = 0; block < BLOCK_COUNT; ++block)
+		{
+			const uint32_t* words = m_planes[plane]->blocks[block];
+			if(words == NULL) continue;
+			for(uint32_t i = 0; i < BLOCK_WORDS; ++i)
+			{
+				total += bitCount(words[i]);
+			}
+		}
+	}
+	return total;
+}
+
+void CodePointSet::clear()
+{
+	for(uint32_t plane = 0; plane < PLANE_COUNT; ++plane)
+	{
+		if(m_planes[plane] == NULL) continue;
+		for(uint32_t block = 0; block < BLOCK_COUNT; ++block)
+		{
+			delete [] m_planes[plane]->blocks[block];
+		}
+		delete m_planes[plane];
+		m_planes[plane] = NULL;
+	}
+}
+
+}
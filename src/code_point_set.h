@@ -0,0 +1,90 @@
+/* Copyright 2013 Jeremie Roy. All rights reserved.
+ * License: http://www.opensource.org/licenses/BSD-2-Clause
+*/
+#pragma once
+#include "font_manager.h"
+
+namespace bgfx_font
+{
+
+/// A set of unicode code points.
+/// Hierarchical bitset: 17 planes of 256 blocks of 256 code points. Planes and blocks
+/// are allocated on demand and a mask of the allocated blocks is kept per plane, so a
+/// sparse set stays small and iteration skips the empty ranges.
+/// Iteration is done in increasing code point order, e.g:
+///		for(CodePoint_t cp = set.first(); cp != CodePointSet::END; cp = set.next(cp)) {}
+class CodePointSet
+{
+public:
+	/// value returned by first/next when there are no more code points
+	static const CodePoint_t END = -1;
+	/// largest unicode code point, the larger ones and the negative ones are ignored
+	static const CodePoint_t MAX_CODE_POINT = 0x10FFFF;
+
+	CodePointSet();
+	CodePointSet(const CodePointSet& other);
+	~CodePointSet();
+	CodePointSet& operator=(const CodePointSet& other);
+
+	/// add a single code point
+	void add(CodePoint_t codePoint);
+	/// add every code point from first to last (inclusive), clamped to [0, MAX_CODE_POINT]
+	void addRange(CodePoint_t first, CodePoint_t last);
+	/// add the code points of a null terminated utf-8 string
+	/// @return false if the string is not well-formed
+	bool addUtf8(const char* _string);
+	/// add the code points of a null terminated utf-16 string
+	/// @return false if the string contains an unpaired surrogate
+	bool addUtf16(const uint16_t* _string);
+	/// add the code points of a null terminated utf-32 string
+	/// @return false if the string contains a surrogate or a value out of the unicode range, they are skipped
+	bool addUtf32(const CodePoint_t* _string);
+	/// add the code points of a null terminated wide string (utf-16 or utf-32 depending on the platform)
+	/// @return false if the string is not well-formed
+	bool addWideString(const wchar_t* _string);
+
+	/// remove a single code point
+	void remove(CodePoint_t codePoint);
+
+	/// union: add every code point of other
+	void add(const CodePointSet& other);
+	/// intersection: keep only the code points also in other
+	void intersect(const CodePointSet& other);
+	/// difference: remove every code point of other
+	void remove(const CodePointSet& other);
+
+	/// return true if the code point is in the set
+	bool contains(CodePoint_t codePoint) const;
+
+	/// return the smallest code point of the set, or END if the set is empty
+	CodePoint_t first() const { return next(-1); }
+	/// return the smallest code point of the set greater than codePoint, or END if there is none
+	CodePoint_t next(CodePoint_t codePoint) const;
+
+	/// return the number of code points in the set
+	uint32_t count() const;
+	/// return true if the set is empty
+	bool empty() const { return first() == END; }
+	/// remove every code point and free the memory
+	void clear();
+
+private:
+	static const uint32_t PLANE_COUNT = 17;
+	static const uint32_t BLOCK_COUNT = 256;
+	/// number of 32 bits words per block of 256 code points
+	static const uint32_t BLOCK_WORDS = 8;
+
+	struct Plane
+	{
+		uint32_t* blocks[BLOCK_COUNT];
+		/// bit set for each allocated block
+		uint32_t blockMask[BLOCK_COUNT / 32];
+	};
+
+	uint32_t* getBlock(uint32_t plane, uint32_t block) const;
+	uint32_t* allocBlock(uint32_t plane, uint32_t block);
+
+	Plane* m_planes[PLANE_COUNT];
+};
+
+}
@@ -2,6 +2,8 @@
  * License: http://www.opensource.org/licenses/BSD-2-Clause
 */
 #include "font_manager.h"
+#include "code_point_set.h"
+#include "text_shaper.h"
 #include "cube_atlas.h"
 
 #pragma warning( push )
@@ -26,10 +28,12 @@ namespace tinystl
 } // namespace tinystl
 //#	define TINYSTL_ALLOCATOR tinystl::bgfx_allocator
 #	include <TINYSTL/unordered_map.h>
+#	include <TINYSTL/vector.h>
 //#	include <TINYSTL/unordered_set.h>
 namespace stl = tinystl;
 #else
 #	include <unordered_map>
+#	include <vector>
 namespace std { namespace tr1 {} }
 namespace stl {
 	using namespace std;
@@ -43,6 +47,15 @@ namespace stl {
 namespace bgfx_font
 {
 
+/// A kerning adjustment between two glyphs
+struct KerningPair
+{
+	/// left glyph index in the high 16 bits, right glyph index in the low 16 bits
+	uint32_t glyphPair;
+	/// horizontal adjustment in pixels
+	float advance;
+};
+
 class FontManager::TrueTypeFont
 {
 public:	
@@ -57,20 +70,36 @@ public:
 	/// return the font descriptor of the current font
 	FontInfo getFontInfo();
 	
+	/// return the index of the glyph mapped to the code point, 0 if there is none
+	int32_t getGlyphIndex(CodePoint_t codePoint);
+
 	/// raster a glyph as 8bit alpha to a memory buffer
 	/// update the GlyphInfo according to the raster strategy
+	/// @param subpixelPhase shift the glyph to the right by subpixelPhase / fontInfo.subpixelPhaseCount pixel
 	/// @ remark buffer min size: glyphInfo.width * glyphInfo * height * sizeof(char)
-    bool bakeGlyphAlpha(const FontInfo& fontInfo, CodePoint_t codePoint, GlyphInfo& outGlyphInfo, uint8_t* outBuffer);
+    bool bakeGlyphAlpha(const FontInfo& fontInfo, int32_t glyphIndex, GlyphInfo& outGlyphInfo, uint8_t* outBuffer, uint32_t subpixelPhase = 0);
 
 	/// raster a glyph as 32bit subpixel rgba to a memory buffer
 	/// update the GlyphInfo according to the raster strategy
+	/// @param subpixelPhase shift the glyph to the right by subpixelPhase / fontInfo.subpixelPhaseCount pixel
 	/// @ remark buffer min size: glyphInfo.width * glyphInfo * height * sizeof(uint32_t)
-    bool bakeGlyphSubpixel(const FontInfo& fontInfo, CodePoint_t codePoint, GlyphInfo& outGlyphInfo, uint8_t* outBuffer);
+    bool bakeGlyphSubpixel(const FontInfo& fontInfo, int32_t glyphIndex, GlyphInfo& outGlyphInfo, uint8_t* outBuffer, uint32_t subpixelPhase = 0);
 
 	/// raster a glyph as 8bit signed distance to a memory buffer
 	/// update the GlyphInfo according to the raster strategy
 	/// @ remark buffer min size: glyphInfo.width * glyphInfo * height * sizeof(char)
-	bool bakeGlyphDistance(const FontInfo& fontInfo, CodePoint_t codePoint, GlyphInfo& outGlyphInfo, uint8_t* outBuffer);
+	bool bakeGlyphDistance(const FontInfo& fontInfo, int32_t glyphIndex, GlyphInfo& outGlyphInfo, uint8_t* outBuffer);
+
+	/// load the metrics of a glyph without rasterizing it, the advance matches the one of the bake functions
+	/// @remark the bounds are those of the outline, the baked bitmap may differ by a pixel (or by its padding for distance fonts)
+	bool getGlyphMetrics(const FontInfo& fontInfo, int32_t glyphIndex, GlyphInfo& outGlyphInfo);
+
+	/// add every code point mapped by the unicode charmap to the coverage set
+	void getCoverage(CodePointSet& outCoverage);
+
+	/// extract the kerning pairs of the font (GPOS pair adjustments, or the kern table if there is none)
+	/// @return an array of pairs sorted by KerningPair::glyphPair (to delete[] by the caller), NULL if the font has no kerning
+	KerningPair* getKerningPairs(uint32_t& outPairCount);
 private:
 	void* m_font;
 };
@@ -165,6 +194,7 @@ FontInfo FontManager::TrueTypeFont::getFontInfo()
 	//todo manage unscalable font
 	FontInfo outFontInfo;
 	outFontInfo.scale = 1.0f;
+	outFontInfo.subpixelPhaseCount = 1;
 	outFontInfo.ascender = metrics.ascender /64.0f;
 	outFontInfo.descender = metrics.descender /64.0f;
 	outFontInfo.lineGap = (metrics.height - metrics.ascender + metrics.descender) /64.0f;
@@ -174,12 +204,397 @@ FontInfo FontManager::TrueTypeFont::getFontInfo()
 	return outFontInfo;
 }
 
-bool FontManager::TrueTypeFont::bakeGlyphAlpha(const FontInfo& fontInfo,CodePoint_t codePoint, GlyphInfo& glyphInfo, uint8_t* outBuffer)
+void FontManager::TrueTypeFont::getCoverage(CodePointSet& outCoverage)
+{
+	assert(m_font != NULL && "TrueTypeFont not initialized" );
+	FTHolder* holder = (FTHolder*) m_font;
+
+	FT_UInt glyphIndex;
+	FT_ULong codePoint = FT_Get_First_Char( holder->face, &glyphIndex );
+	while( glyphIndex != 0 )
+	{
+		if(codePoint < 0x110000)
+		{
+			outCoverage.add((CodePoint_t)codePoint);
+		}
+		codePoint = FT_Get_Next_Char( holder->face, codePoint, &glyphIndex );
+	}
+}
+
+// big endian readers for the sfnt tables
+static inline uint16_t readU16(const uint8_t* data) { return (uint16_t)((data[0] << 8) | data[1]); }
+static inline int16_t readS16(const uint8_t* data) { return (int16_t)readU16(data); }
+static inline uint32_t readU32(const uint8_t* data) { return ((uint32_t)readU16(data) << 16) | readU16(data+2); }
+
+typedef stl::vector<KerningPair> KerningPairs_t;
+
+static void addKerningPair(KerningPairs_t& pairs, uint16_t left, uint16_t right, int16_t value, FT_Fixed xScale)
+{
+	if(value == 0) return;
+	KerningPair pair;
+	pair.glyphPair = ((uint32_t)left << 16) | right;
+	pair.advance = FT_MulFix(value, xScale) / 64.0f;
+	pairs.push_back(pair);
+}
+
+/// parse the format 0 subtables of a kern table (microsoft and apple headers)
+static void parseKernTable(const uint8_t* table, uint32_t length, FT_Fixed xScale, KerningPairs_t& outPairs)
+{
+	if(length < 4) return;
+	bool apple = readU16(table) == 1;
+	uint32_t tableCount = apple ? (length >= 8 ? readU32(table+4) : 0) : readU16(table+2);
+	uint32_t offset = apple ? 8 : 4;
+	uint32_t headerSize = apple ? 8 : 6;
+
+	for(uint32_t t = 0; t < tableCount && offset + headerSize <= length; ++t)
+	{
+		const uint8_t* subtable = table + offset;
+		uint32_t subtableLength = apple ? readU32(subtable) : readU16(subtable+2);
+		uint16_t coverage = apple ? readU16(subtable+4) : readU16(subtable+4);
+		uint32_t format = apple ? (coverage & 0xff) : (coverage >> 8);
+		// horizontal kerning values only (no minimum, cross stream or variation tables)
+		bool horizontal = apple ? ((coverage & 0xe000) == 0) : ((coverage & 0x7) == 0x1);
+
+		if(format == 0 && horizontal && offset + headerSize + 8 <= length)
+		{
+			const uint8_t* data = subtable + headerSize;
+			uint32_t pairCount = readU16(data);
+			data += 8;
+			for(uint32_t i = 0; i < pairCount && (uint32_t)(data + 6 - table) <= length; ++i, data += 6)
+			{
+				addKerningPair(outPairs, readU16(data), readU16(data+2), readS16(data+4), xScale);
+			}
+		}
+		if(subtableLength == 0) break;
+		offset += subtableLength;
+	}
+}
+
+static int compareU32(const void* a, const void* b)
+{
+	uint32_t valueA = *(const uint32_t*)a;
+	uint32_t valueB = *(const uint32_t*)b;
+	return valueA < valueB ? -1 : (valueA > valueB ? 1 : 0);
+}
+
+static int compareU64(const void* a, const void* b)
+{
+	uint64_t valueA = *(const uint64_t*)a;
+	uint64_t valueB = *(const uint64_t*)b;
+	return valueA < valueB ? -1 : (valueA > valueB ? 1 : 0);
+}
+
+/// read the glyphs of an OpenType coverage table, in coverage index order
+static bool readCoverage(const uint8_t* table, uint32_t length, uint32_t coverageOffset, stl::vector<uint16_t>& outGlyphs)
+{
+	if(coverageOffset + 4 > length) return false;
+	const uint8_t* coverage = table + coverageOffset;
+	uint16_t coverageFormat = readU16(coverage);
+	uint32_t coverageCount = readU16(coverage+2);
+	for(uint32_t c = 0; c < coverageCount; ++c)
+	{
+		uint32_t firstGlyph, lastGlyph;
+		if(coverageFormat == 1)
+		{
+			if(coverageOffset + 4 + c*2 + 2 > length) return false;
+			firstGlyph = lastGlyph = readU16(coverage + 4 + c*2);
+		}else if(coverageFormat == 2)
+		{
+			if(coverageOffset + 4 + c*6 + 6 > length) return false;
+			firstGlyph = readU16(coverage + 4 + c*6);
+			lastGlyph = readU16(coverage + 4 + c*6 + 2);
+			// ranges are in coverage index order, the start index is implied
+		}else
+		{
+			return false;
+		}
+		for(uint32_t glyph = firstGlyph; glyph <= lastGlyph; ++glyph)
+		{
+			outGlyphs.push_back((uint16_t)glyph);
+		}
+	}
+	return true;
+}
+
+/// read the (class << 16 | glyph) entries of an OpenType class definition table, sorted by class then glyph
+/// @remark glyphs of class 0 are implicit and not returned
+static bool readClassDef(const uint8_t* table, uint32_t length, uint32_t classDefOffset, stl::vector<uint32_t>& outEntries)
+{
+	if(classDefOffset + 4 > length) return false;
+	const uint8_t* classDef = table + classDefOffset;
+	uint16_t classDefFormat = readU16(classDef);
+	if(classDefFormat == 1)
+	{
+		if(classDefOffset + 6 > length) return false;
+		uint32_t startGlyph = readU16(classDef+2);
+		uint32_t glyphCount = readU16(classDef+4);
+		if(classDefOffset + 6 + glyphCount*2 > length) return false;
+		for(uint32_t i = 0; i < glyphCount; ++i)
+		{
+			uint32_t glyphClass = readU16(classDef + 6 + i*2);
+			if(glyphClass != 0) outEntries.push_back((glyphClass << 16) | ((startGlyph + i) & 0xffff));
+		}
+	}else if(classDefFormat == 2)
+	{
+		uint32_t rangeCount = readU16(classDef+2);
+		if(classDefOffset + 4 + rangeCount*6 > length) return false;
+		for(uint32_t r = 0; r < rangeCount; ++r)
+		{
+			const uint8_t* range = classDef + 4 + r*6;
+			uint32_t glyphClass = readU16(range+4);
+			if(glyphClass == 0) continue;
+			for(uint32_t glyph = readU16(range), last = readU16(range+2); glyph <= last; ++glyph)
+			{
+				outEntries.push_back((glyphClass << 16) | glyph);
+			}
+		}
+	}else
+	{
+		return false;
+	}
+	if(!outEntries.empty())
+	{
+		qsort(&outEntries[0], outEntries.size(), sizeof(uint32_t), compareU32);
+	}
+	return true;
+}
+
+/// @return the class of a glyph in an OpenType class definition table, 0 if it is not listed
+static uint32_t getGlyphClass(const uint8_t* table, uint32_t length, uint32_t classDefOffset, uint16_t glyph)
+{
+	if(classDefOffset + 4 > length) return 0;
+	const uint8_t* classDef = table + classDefOffset;
+	uint16_t classDefFormat = readU16(classDef);
+	if(classDefFormat == 1)
+	{
+		if(classDefOffset + 6 > length) return 0;
+		uint32_t index = (uint32_t)glyph - readU16(classDef+2);
+		if(glyph < readU16(classDef+2) || index >= readU16(classDef+4) || classDefOffset + 6 + index*2 + 2 > length) return 0;
+		return readU16(classDef + 6 + index*2);
+	}
+	if(classDefFormat == 2)
+	{
+		// the ranges are sorted by start glyph
+		uint32_t rangeCount = readU16(classDef+2);
+		if(classDefOffset + 4 + rangeCount*6 > length) return 0;
+		uint32_t low = 0;
+		uint32_t high = rangeCount;
+		while(low < high)
+		{
+			uint32_t middle = (low + high) / 2;
+			const uint8_t* range = classDef + 4 + middle*6;
+			if(glyph < readU16(range))
+			{
+				high = middle;
+			}else if(glyph > readU16(range+2))
+			{
+				low = middle + 1;
+			}else
+			{
+				return readU16(range+4);
+			}
+		}
+	}
+	return 0;
+}
+
+/// parse a GPOS pair adjustment subtable (format 1: explicit pairs, format 2: class pairs expanded to glyph pairs)
+static void parsePairPos(const uint8_t* table, uint32_t length, uint32_t offset, FT_Fixed xScale, KerningPairs_t& outPairs)
+{
+	if(offset + 10 > length) return;
+	const uint8_t* pairPos = table + offset;
+	uint16_t format = readU16(pairPos);
+	uint32_t coverageOffset = offset + readU16(pairPos+2);
+	uint16_t valueFormat1 = readU16(pairPos+4);
+	uint16_t valueFormat2 = readU16(pairPos+6);
+	if(format != 1 && format != 2) return;
+	// only the x advance of the first glyph is used
+	if((valueFormat1 & 0x0004) == 0) return;
+
+	uint32_t advanceOffset = 2 * (((valueFormat1 >> 0) & 1) + ((valueFormat1 >> 1) & 1));
+	uint32_t valueSize = 0;
+	for(uint32_t bit = 0; bit < 16; ++bit)
+	{
+		valueSize += 2 * (((valueFormat1 >> bit) & 1) + ((valueFormat2 >> bit) & 1));
+	}
+
+	// coverage gives the first glyph of each pair, in pair set order for format 1
+	stl::vector<uint16_t> firstGlyphs;
+	if(!readCoverage(table, length, coverageOffset, firstGlyphs)) return;
+
+	if(format == 1)
+	{
+		uint32_t pairSetCount = readU16(pairPos+8);
+		if(offset + 10 + pairSetCount * 2 > length) return;
+		uint32_t recordSize = 2 + valueSize;
+		for(uint32_t coverageIndex = 0; coverageIndex < firstGlyphs.size() && coverageIndex < pairSetCount; ++coverageIndex)
+		{
+			uint32_t pairSetOffset = offset + readU16(pairPos + 10 + coverageIndex*2);
+			if(pairSetOffset + 2 > length) return;
+			uint32_t pairCount = readU16(table + pairSetOffset);
+			if(pairSetOffset + 2 + pairCount * recordSize > length) return;
+			const uint8_t* record = table + pairSetOffset + 2;
+			for(uint32_t i = 0; i < pairCount; ++i, record += recordSize)
+			{
+				addKerningPair(outPairs, firstGlyphs[coverageIndex], readU16(record), readS16(record + 2 + advanceOffset), xScale);
+			}
+		}
+		return;
+	}
+
+	if(offset + 16 > length) return;
+	uint32_t classDef1Offset = offset + readU16(pairPos+8);
+	uint32_t classDef2Offset = offset + readU16(pairPos+10);
+	uint32_t class1Count = readU16(pairPos+12);
+	uint32_t class2Count = readU16(pairPos+14);
+	if(offset + 16 + class1Count * class2Count * valueSize > length) return;
+
+	stl::vector<uint32_t> classDef2;
+	if(!readClassDef(table, length, classDef2Offset, classDef2)) return;
+
+	// class 0 of the second glyph is every glyph not listed, it cannot be expanded and is skipped
+	for(uint32_t i = 0; i < firstGlyphs.size(); ++i)
+	{
+		uint32_t class1 = getGlyphClass(table, length, classDef1Offset, firstGlyphs[i]);
+		if(class1 >= class1Count) continue;
+		const uint8_t* class1Record = pairPos + 16 + class1 * class2Count * valueSize;
+		for(uint32_t j = 0; j < classDef2.size(); ++j)
+		{
+			uint32_t class2 = classDef2[j] >> 16;
+			if(class2 >= class2Count) break;
+			addKerningPair(outPairs, firstGlyphs[i], (uint16_t)(classDef2[j] & 0xffff), readS16(class1Record + class2 * valueSize + advanceOffset), xScale);
+		}
+	}
+}
+
+/// parse the pair adjustment lookups referenced by the 'kern' features of a GPOS table
+static void parseGposTable(const uint8_t* table, uint32_t length, FT_Fixed xScale, KerningPairs_t& outPairs)
+{
+	if(length < 10) return;
+	uint32_t featureListOffset = readU16(table+6);
+	uint32_t lookupListOffset = readU16(table+8);
+	if(featureListOffset + 2 > length || lookupListOffset + 2 > length) return;
+
+	uint32_t featureCount = readU16(table + featureListOffset);
+	uint32_t lookupCount = readU16(table + lookupListOffset);
+	if(lookupListOffset + 2 + lookupCount*2 > length) return;
+
+	// flag the lookups used by the kern features
+	uint8_t* kernLookups = new uint8_t[lookupCount];
+	memset(kernLookups, 0, lookupCount);
+	for(uint32_t f = 0; f < featureCount; ++f)
+	{
+		const uint8_t* record = table + featureListOffset + 2 + f*6;
+		if((uint32_t)(record + 6 - table) > length) break;
+		if(readU32(record) != FT_MAKE_TAG('k','e','r','n')) continue;
+		uint32_t featureOffset = featureListOffset + readU16(record+4);
+		if(featureOffset + 4 > length) continue;
+		uint32_t indexCount = readU16(table + featureOffset + 2);
+		for(uint32_t i = 0; i < indexCount && featureOffset + 4 + i*2 + 2 <= length; ++i)
+		{
+			uint32_t lookupIndex = readU16(table + featureOffset + 4 + i*2);
+			if(lookupIndex < lookupCount) kernLookups[lookupIndex] = 1;
+		}
+	}
+
+	for(uint32_t l = 0; l < lookupCount; ++l)
+	{
+		if(!kernLookups[l]) continue;
+		uint32_t lookupOffset = lookupListOffset + readU16(table + lookupListOffset + 2 + l*2);
+		if(lookupOffset + 6 > length) continue;
+		uint16_t lookupType = readU16(table + lookupOffset);
+		uint32_t subtableCount = readU16(table + lookupOffset + 4);
+		for(uint32_t st = 0; st < subtableCount && lookupOffset + 6 + st*2 + 2 <= length; ++st)
+		{
+			uint32_t subtableOffset = lookupOffset + readU16(table + lookupOffset + 6 + st*2);
+			uint16_t subtableType = lookupType;
+			// extension lookups point to the real subtable with a 32 bits offset
+			if(lookupType == 9 && subtableOffset + 8 <= length)
+			{
+				subtableType = readU16(table + subtableOffset + 2);
+				subtableOffset += readU32(table + subtableOffset + 4);
+			}
+			if(subtableType == 2)
+			{
+				parsePairPos(table, length, subtableOffset, xScale, outPairs);
+			}
+		}
+	}
+	delete [] kernLookups;
+}
+
+static int compareKerningPair(const void* a, const void* b)
+{
+	uint32_t pairA = ((const KerningPair*)a)->glyphPair;
+	uint32_t pairB = ((const KerningPair*)b)->glyphPair;
+	return pairA < pairB ? -1 : (pairA > pairB ? 1 : 0);
+}
+
+KerningPair* FontManager::TrueTypeFont::getKerningPairs(uint32_t& outPairCount)
+{
+	assert(m_font != NULL && "TrueTypeFont not initialized" );
+	FTHolder* holder = (FTHolder*) m_font;
+	FT_Fixed xScale = holder->face->size->metrics.x_scale;
+	outPairCount = 0;
+
+	KerningPairs_t pairs;
+	const FT_ULong tags[2] = { FT_MAKE_TAG('G','P','O','S'), FT_MAKE_TAG('k','e','r','n') };
+	for(uint32_t t = 0; t < 2 && pairs.size() == 0; ++t)
+	{
+		FT_ULong length = 0;
+		if(FT_Load_Sfnt_Table( holder->face, tags[t], 0, NULL, &length ) != 0 || length == 0)
+		{
+			continue;
+		}
+		uint8_t* table = new uint8_t[length];
+		if(FT_Load_Sfnt_Table( holder->face, tags[t], 0, table, &length ) == 0)
+		{
+			if(t == 0)
+			{
+				parseGposTable(table, (uint32_t)length, xScale, pairs);
+			}else
+			{
+				parseKernTable(table, (uint32_t)length, xScale, pairs);
+			}
+		}
+		delete [] table;
+	}
+
+	if(pairs.size() == 0)
+	{
+		return NULL;
+	}
+
+	KerningPair* sortedPairs = new KerningPair[pairs.size()];
+	memcpy(sortedPairs, &pairs[0], pairs.size() * sizeof(KerningPair));
+	qsort(sortedPairs, pairs.size(), sizeof(KerningPair), compareKerningPair);
+
+	// the first subtable defining a pair wins, as in the lookup order
+	uint32_t count = 0;
+	for(uint32_t i = 0; i < pairs.size(); ++i)
+	{
+		if(count == 0 || sortedPairs[count-1].glyphPair != sortedPairs[i].glyphPair)
+		{
+			sortedPairs[count++] = sortedPairs[i];
+		}
+	}
+	outPairCount = count;
+	return sortedPairs;
+}
+
+int32_t FontManager::TrueTypeFont::getGlyphIndex(CodePoint_t codePoint)
+{
+	assert(m_font != NULL && "TrueTypeFont not initialized" );
+	FTHolder* holder = (FTHolder*) m_font;
+	return (int32_t)FT_Get_Char_Index( holder->face, codePoint );
+}
+
+bool FontManager::TrueTypeFont::bakeGlyphAlpha(const FontInfo& fontInfo, int32_t glyphIndex, GlyphInfo& glyphInfo, uint8_t* outBuffer, uint32_t subpixelPhase)
 {	
 	assert(m_font != NULL && "TrueTypeFont not initialized" );
 	FTHolder* holder = (FTHolder*) m_font;
 	
-	glyphInfo.glyphIndex = FT_Get_Char_Index( holder->face, codePoint );
+	glyphInfo.glyphIndex = glyphIndex;
 	
 	FT_GlyphSlot slot = holder->face->glyph;
 	FT_Error error = FT_Load_Glyph(  holder->face, glyphInfo.glyphIndex, FT_LOAD_DEFAULT );
@@ -189,7 +604,11 @@ bool FontManager::TrueTypeFont::bakeGlyphAlpha(const FontInfo& fontInfo,CodePoin
 	error = FT_Get_Glyph( slot, &glyph );
 	if ( error ) { return false; }
 		
-	error = FT_Glyph_To_Bitmap( &glyph, FT_RENDER_MODE_NORMAL, 0, 1 );
+	//shift the outline by a fraction of pixel for subpixel positioning
+	FT_Vector origin;
+	origin.x = (fontInfo.subpixelPhaseCount > 1) ? (FT_Pos)((subpixelPhase * 64) / fontInfo.subpixelPhaseCount) : 0;
+	origin.y = 0;
+	error = FT_Glyph_To_Bitmap( &glyph, FT_RENDER_MODE_NORMAL, &origin, 1 );
 	if(error){ return false; }
 	
 	FT_BitmapGlyph bitmap = (FT_BitmapGlyph)glyph;
@@ -203,7 +622,8 @@ bool FontManager::TrueTypeFont::bakeGlyphAlpha(const FontInfo& fontInfo,CodePoin
 	glyphInfo.offset_y = (float) y;	
 	glyphInfo.width = (float) w;	
 	glyphInfo.height = (float) h;	
-	glyphInfo.advance_x = (float)slot->advance.x /64.0f;
+	//hinted advances are rounded to whole pixels, keep the fractional ones when positioning at subpixel precision
+	glyphInfo.advance_x = (fontInfo.subpixelPhaseCount > 1) ? (float)slot->linearHoriAdvance /65536.0f : (float)slot->advance.x /64.0f;
 	glyphInfo.advance_y = (float)slot->advance.y /64.0f;
 
 	int charsize = 1;
@@ -218,12 +638,12 @@ bool FontManager::TrueTypeFont::bakeGlyphAlpha(const FontInfo& fontInfo,CodePoin
 	return true;
 }
 
-bool FontManager::TrueTypeFont::bakeGlyphSubpixel(const FontInfo& fontInfo,CodePoint_t codePoint, GlyphInfo& glyphInfo, uint8_t* outBuffer)
+bool FontManager::TrueTypeFont::bakeGlyphSubpixel(const FontInfo& fontInfo, int32_t glyphIndex, GlyphInfo& glyphInfo, uint8_t* outBuffer, uint32_t subpixelPhase)
 {
 	assert(m_font != NULL && "TrueTypeFont not initialized" );
 	FTHolder* holder = (FTHolder*) m_font;
 	
-	glyphInfo.glyphIndex = FT_Get_Char_Index( holder->face, codePoint );
+	glyphInfo.glyphIndex = glyphIndex;
 	
 	FT_GlyphSlot slot = holder->face->glyph;
 	FT_Error error = FT_Load_Glyph(  holder->face, glyphInfo.glyphIndex, FT_LOAD_DEFAULT );
@@ -233,7 +653,11 @@ bool FontManager::TrueTypeFont::bakeGlyphSubpixel(const FontInfo& fontInfo,CodeP
 	error = FT_Get_Glyph( slot, &glyph );
 	if ( error ) { return false; }
 		
-	error = FT_Glyph_To_Bitmap( &glyph, FT_RENDER_MODE_LCD, 0, 1 );
+	//shift the outline by a fraction of pixel for subpixel positioning
+	FT_Vector origin;
+	origin.x = (fontInfo.subpixelPhaseCount > 1) ? (FT_Pos)((subpixelPhase * 64) / fontInfo.subpixelPhaseCount) : 0;
+	origin.y = 0;
+	error = FT_Glyph_To_Bitmap( &glyph, FT_RENDER_MODE_LCD, &origin, 1 );
 	if(error){ return false; }
 	
 	FT_BitmapGlyph bitmap = (FT_BitmapGlyph)glyph;
@@ -246,7 +670,8 @@ bool FontManager::TrueTypeFont::bakeGlyphSubpixel(const FontInfo& fontInfo,CodeP
 	glyphInfo.offset_y = (float) y;	
 	glyphInfo.width = (float) w;	
 	glyphInfo.height = (float) h;	
-	glyphInfo.advance_x = (float)slot->advance.x /64.0f;
+	//hinted advances are rounded to whole pixels, keep the fractional ones when positioning at subpixel precision
+	glyphInfo.advance_x = (fontInfo.subpixelPhaseCount > 1) ? (float)slot->linearHoriAdvance /65536.0f : (float)slot->advance.x /64.0f;
 	glyphInfo.advance_y = (float)slot->advance.y /64.0f;
 	int charsize = 1;
 	int depth=3;
@@ -338,12 +763,12 @@ void make_distance_map( unsigned char *img, unsigned char *outImg, unsigned int
 }
 
 
-bool FontManager::TrueTypeFont::bakeGlyphDistance(const FontInfo& fontInfo, CodePoint_t codePoint, GlyphInfo& glyphInfo, uint8_t* outBuffer)
+bool FontManager::TrueTypeFont::bakeGlyphDistance(const FontInfo& fontInfo, int32_t glyphIndex, GlyphInfo& glyphInfo, uint8_t* outBuffer)
 {	
 	assert(m_font != NULL && "TrueTypeFont not initialized" );
 	FTHolder* holder = (FTHolder*) m_font;
 	
-	glyphInfo.glyphIndex = FT_Get_Char_Index( holder->face, codePoint );
+	glyphInfo.glyphIndex = glyphIndex;
 	
 	FT_Int32 loadMode = FT_LOAD_DEFAULT|FT_LOAD_NO_HINTING;
 	FT_Render_Mode renderMode = FT_RENDER_MODE_NORMAL;
@@ -420,37 +845,163 @@ bool FontManager::TrueTypeFont::bakeGlyphDistance(const FontInfo& fontInfo, Code
 
 
 
+bool FontManager::TrueTypeFont::getGlyphMetrics(const FontInfo& fontInfo, int32_t glyphIndex, GlyphInfo& glyphInfo)
+{
+	assert(m_font != NULL && "TrueTypeFont not initialized" );
+	FTHolder* holder = (FTHolder*) m_font;
+
+	glyphInfo.glyphIndex = glyphIndex;
+
+	//load the glyph as the bake functions do, distance fonts are not hinted
+	bool distance = (fontInfo.fontType == FONT_TYPE_DISTANCE || fontInfo.fontType == FONT_TYPE_DISTANCE_SUBPIXEL);
+	FT_Int32 loadMode = distance ? (FT_LOAD_DEFAULT|FT_LOAD_NO_HINTING) : FT_LOAD_DEFAULT;
+	FT_GlyphSlot slot = holder->face->glyph;
+	FT_Error error = FT_Load_Glyph(  holder->face, glyphIndex, loadMode );
+	if(error) { return false; }
+
+	//outline box in 26.6, rounded outwards to whole pixels
+	FT_Pos x0 = slot->metrics.horiBearingX & ~63;
+	FT_Pos y0 = (slot->metrics.horiBearingY + 63) & ~63;
+	FT_Pos x1 = (slot->metrics.horiBearingX + slot->metrics.width + 63) & ~63;
+	FT_Pos y1 = (slot->metrics.horiBearingY - slot->metrics.height) & ~63;
+
+	glyphInfo.offset_x = (float) (x0 / 64);
+	glyphInfo.offset_y = (float) (-y0 / 64);
+	glyphInfo.width = (float) ((x1 - x0) / 64);
+	glyphInfo.height = (float) ((y0 - y1) / 64);
+	if(distance && glyphInfo.width * glyphInfo.height > 0.0f)
+	{
+		//same padding as bakeGlyphDistance
+		glyphInfo.offset_x -= 6.0f;
+		glyphInfo.offset_y -= 6.0f;
+		glyphInfo.width += 12.0f;
+		glyphInfo.height += 12.0f;
+	}
+	if(distance)
+	{
+		glyphInfo.advance_x = (float)slot->advance.x /64.0f;
+	}else
+	{
+		glyphInfo.advance_x = (fontInfo.subpixelPhaseCount > 1) ? (float)slot->linearHoriAdvance /65536.0f : (float)slot->advance.x /64.0f;
+	}
+	glyphInfo.advance_y = (float)slot->advance.y /64.0f;
+	glyphInfo.regionIndex = 0;
+	return true;
+}
+
 //*************************************************************
 
 typedef stl::unordered_map<CodePoint_t, GlyphInfo> GlyphHash_t;	
+typedef stl::unordered_map<CodePoint_t, const GlyphInfo*> GlyphPointerHash_t;	
+
+// subpixel variants of a glyph are stored with the phase above the unicode range
+static const uint32_t MAX_SUBPIXEL_PHASES = 16;
+static inline CodePoint_t getGlyphKey(CodePoint_t codePoint, uint32_t subpixelPhase)
+{
+	return codePoint | (CodePoint_t)(subpixelPhase << 24);
+}
+typedef stl::unordered_map<CodePoint_t, uint16_t> FallbackHash_t;	
 // cache font data
 struct FontManager::CachedFont
 {
-	CachedFont(){ trueTypeFont = NULL; masterFontHandle.idx = -1; }
+	CachedFont(){ trueTypeFont = NULL; coverage = NULL; kerningPairs = NULL; kerningPairCount = 0; masterFontHandle.idx = -1; fallbackFontHandle.idx = -1; trueTypeHandle.idx = -1; typefaceIndex = 0; refCount = 0; ownsMasterFont = false; sharing = FONT_UNSHARED; }
 	FontInfo fontInfo;
-	GlyphHash_t cachedGlyphs;
+	// glyphs by code point, pointing in cachedGlyphIndices (code points mapped to the same glyph share it)
+	GlyphPointerHash_t cachedGlyphs;
+	// glyphs by glyph index, every rasterization goes through this table
+	GlyphHash_t cachedGlyphIndices;
+	// metrics of the glyphs measured but not baked yet, by glyph index (see getGlyphMetrics)
+	GlyphHash_t glyphMetrics;
 	FontManager::TrueTypeFont* trueTypeFont;
+	// code points of the cmap, NULL for scaled fonts (see master) and fonts without cmap
+	CodePointSet* coverage;
+	// kerning pairs sorted by glyph pair, in pixels of this font, NULL for scaled fonts (see master)
+	KerningPair* kerningPairs;
+	uint32_t kerningPairCount;
 	// an handle to a master font in case of sub distance field font
 	FontHandle masterFontHandle; 
-	int16_t __padding__;
+	// next font of the fallback chain
+	FontHandle fallbackFontHandle;
+	// code point to font resolution of the chain starting at this font, only store the code points missing from this font
+	FallbackHash_t fallbackCache;
+	// the file and typeface the font was created from (used to find identical font instances)
+	TrueTypeHandle trueTypeHandle;
+	uint32_t typefaceIndex;
+	// number of owners of the font, identical requests of the same sharing kind share the same instance
+	uint16_t refCount;
+	// ladder fonts own a reference on their master font (the rung)
+	bool ownsMasterFont;
+	// FontSharing kind the instance was created with, only instances of the same kind are shared
+	uint8_t sharing;
 };
 
+typedef stl::unordered_map<uint64_t, uint16_t> SharedRegionHash_t;
+
+/// the atlas regions shared by every glyph baked with the same bitmap
+/// @remark the atlas can't free a region, an unused one is kept for the next identical bitmap
+struct FontManager::SharedRegions
+{
+	// bitmap content hash to region
+	SharedRegionHash_t regions;
+};
+
+static uint64_t hashBitmap(uint16_t width, uint16_t height, const uint8_t* data)
+{
+	//FNV-1a 64 bits, on the dimensions then the pixels
+	uint64_t hash = 14695981039346656037ull;
+	hash = (hash ^ width) * 1099511628211ull;
+	hash = (hash ^ height) * 1099511628211ull;
+	for(uint32_t i = 0, end = (uint32_t)width * height; i < end; ++i)
+	{
+		hash = (hash ^ data[i]) * 1099511628211ull;
+	}
+	return hash;
+}
+
+/// compare a gray bitmap with the content of an atlas region, read back from the texture mirror of the atlas
+static bool isRegionBitmap(bgfx::Atlas* atlas, uint16_t regionIndex, uint16_t width, uint16_t height, const uint8_t* data)
+{
+	const bgfx::AtlasRegion& region = atlas->getRegion(regionIndex);
+	if(region.width != width || region.height != height || region.getType() != bgfx::AtlasRegion::TYPE_GRAY)
+	{
+		return false;
+	}
+	uint32_t textureSize = atlas->getTextureSize();
+	const uint8_t* texels = atlas->getTextureBuffer() + region.getFaceIndex() * (textureSize*textureSize*4) + ((region.y*textureSize + region.x)*4) + region.getComponentIndex();
+	for(uint32_t y = 0; y < height; ++y, data += width, texels += textureSize*4)
+	{
+		for(uint32_t x = 0; x < width; ++x)
+		{
+			if(texels[x*4] != data[x]) return false;
+		}
+	}
+	return true;
+}
+
+// canonical pixel sizes baked by createFontByPixelSizeFromLadder, 
+// roughly sqrt(2) apart so that a glyph is never downscaled by more than 1.5
+static const uint16_t s_ladderPixelSizes[] = { 8, 12, 16, 24, 32, 48, 64, 96 };
+static const uint32_t LADDER_RUNG_COUNT = sizeof(s_ladderPixelSizes) / sizeof(s_ladderPixelSizes[0]);
+
 
 
 
-const uint16_t MAX_OPENED_FILES = 64;
-const uint16_t MAX_OPENED_FONT = 64;
 const uint32_t MAX_FONT_BUFFER_SIZE = 512*512*4;
+const uint16_t MAX_SHAPED_RUNS = 256;
 
-FontManager::FontManager(bgfx::Atlas* atlas):m_filesHandles(MAX_OPENED_FILES), m_fontHandles(MAX_OPENED_FONT)
+FontManager::FontManager(bgfx::Atlas* atlas, uint16_t maxFontCount, uint16_t maxFileCount):m_filesHandles(maxFileCount), m_fontHandles(maxFontCount)
 {
+	m_maxFontCount = maxFontCount;
+	m_maxFileCount = maxFileCount;
 	m_atlas = atlas;
 	m_ownAtlas = false;	
 	init(atlas->getTextureSize());	
 }
 
-FontManager::FontManager(uint32_t textureSideWidth):m_filesHandles(MAX_OPENED_FILES), m_fontHandles(MAX_OPENED_FONT)
+FontManager::FontManager(uint32_t textureSideWidth, uint16_t maxFontCount, uint16_t maxFileCount):m_filesHandles(maxFileCount), m_fontHandles(maxFontCount)
 {
+	m_maxFontCount = maxFontCount;
+	m_maxFileCount = maxFileCount;
 	m_atlas = new bgfx::Atlas(textureSideWidth);
 	m_ownAtlas = true;	
 	init(textureSideWidth);
@@ -458,9 +1009,18 @@ FontManager::FontManager(uint32_t textureSideWidth):m_filesHandles(MAX_OPENED_FI
 
 void FontManager::init(uint32_t textureSideWidth)
 {
-	m_cachedFiles = new CachedFile[MAX_OPENED_FILES];
-	m_cachedFonts = new CachedFont[MAX_OPENED_FONT];
+	m_cachedFiles = new CachedFile[m_maxFileCount];
+	m_cachedFonts = new CachedFont[m_maxFontCount];
 	m_buffer = new uint8_t[MAX_FONT_BUFFER_SIZE];
+	m_defaultTextShaper = new SimpleTextShaper();
+	m_textShaper = m_defaultTextShaper;
+	m_shapedRunCache = new ShapedRunCache(MAX_SHAPED_RUNS);
+	m_shapedGlyphs = NULL;
+	m_shapedGlyphCapacity = 0;
+	m_bakeShapedGlyphs = false;
+	m_sharedRegions = new SharedRegions;
+	m_shareBitmaps = false;
+	m_shareFonts = false;
 	
 	// Create filler rectangle
 	uint8_t buffer[4*4*4];
@@ -468,7 +1028,10 @@ void FontManager::init(uint32_t textureSideWidth)
 
 	m_blackGlyph.width=3;
 	m_blackGlyph.height=3;
-	assert( addBitmap(m_blackGlyph, buffer) );
+	//not inside the assert, the filler is needed in release builds too
+	bool added = addBitmap(m_blackGlyph, buffer);
+	assert(added);
+	BX_UNUSED(added);
 	//make sure the black glyph doesn't bleed
 	
 	/*int16_t texUnit = 65535 / m_textureWidth;
@@ -488,6 +1051,10 @@ FontManager::~FontManager()
 	delete [] m_cachedFiles;
 	
 	delete [] m_buffer;
+	delete m_defaultTextShaper;
+	delete m_shapedRunCache;
+	delete [] m_shapedGlyphs;
+	delete m_sharedRegions;
 	
 	if(m_ownAtlas)
 	{		
@@ -567,12 +1134,45 @@ void FontManager::unloadTrueType(TrueTypeHandle handle)
 	m_cachedFiles[handle.idx].bufferSize = 0;
 	m_cachedFiles[handle.idx].buffer = NULL;
 	m_filesHandles.free(handle.idx);
+
+	//the handle may be recycled for another file, forget it so that no ladder rung is shared by mistake
+	const uint16_t* fontHandles = m_fontHandles.getHandles();
+	for(uint16_t i = 0, end = m_fontHandles.getNumHandles(); i < end; ++i)
+	{
+		if(m_cachedFonts[fontHandles[i]].trueTypeHandle.idx == handle.idx)
+		{
+			m_cachedFonts[fontHandles[i]].trueTypeHandle.idx = bgfx::invalidHandle;
+		}
+	}
 }
 
 FontHandle FontManager::createFontByPixelSize(TrueTypeHandle handle, uint32_t typefaceIndex, uint32_t pixelSize, FontType fontType)
+{
+	return createFontInstance(handle, typefaceIndex, pixelSize, fontType, m_shareFonts ? FONT_SHARED : FONT_UNSHARED);
+}
+
+FontHandle FontManager::createFontInstance(TrueTypeHandle handle, uint32_t typefaceIndex, uint32_t pixelSize, FontType fontType, uint8_t sharing)
 {
 	assert(bgfx::invalidHandle != handle.idx);
 
+	//share the instance already created from the same file, typeface, size and type
+	const uint16_t* fontHandles = m_fontHandles.getHandles();
+	for(uint16_t i = 0, end = m_fontHandles.getNumHandles(); i < end && sharing != FONT_UNSHARED; ++i)
+	{
+		CachedFont& font = m_cachedFonts[fontHandles[i]];
+		if(font.sharing == sharing
+			&& font.masterFontHandle.idx == bgfx::invalidHandle
+			&& font.trueTypeHandle.idx == handle.idx
+			&& font.typefaceIndex == typefaceIndex
+			&& font.fontInfo.pixelSize == pixelSize
+			&& font.fontInfo.fontType == fontType)
+		{
+			++font.refCount;
+			FontHandle ret = {fontHandles[i]};
+			return ret;
+		}
+	}
+
 	TrueTypeFont* ttf = new TrueTypeFont();
 	if(!ttf->init(  m_cachedFiles[handle.idx].buffer,  m_cachedFiles[handle.idx].bufferSize, typefaceIndex, pixelSize))
 	{
@@ -589,20 +1189,67 @@ FontHandle FontManager::createFontByPixelSize(TrueTypeHandle handle, uint32_t ty
 	m_cachedFonts[fontIdx].fontInfo.fontType = fontType;	
 	m_cachedFonts[fontIdx].fontInfo.pixelSize = pixelSize;
 	m_cachedFonts[fontIdx].cachedGlyphs.clear();
+	m_cachedFonts[fontIdx].cachedGlyphIndices.clear();
+	m_cachedFonts[fontIdx].glyphMetrics.clear();
+	m_cachedFonts[fontIdx].coverage = new CodePointSet();
+	ttf->getCoverage(*m_cachedFonts[fontIdx].coverage);
+	m_cachedFonts[fontIdx].kerningPairs = ttf->getKerningPairs(m_cachedFonts[fontIdx].kerningPairCount);
 	m_cachedFonts[fontIdx].masterFontHandle.idx = -1;
+	m_cachedFonts[fontIdx].fallbackFontHandle.idx = -1;
+	m_cachedFonts[fontIdx].fallbackCache.clear();
+	m_cachedFonts[fontIdx].trueTypeHandle = handle;
+	m_cachedFonts[fontIdx].typefaceIndex = typefaceIndex;
+	m_cachedFonts[fontIdx].refCount = 1;
+	m_cachedFonts[fontIdx].ownsMasterFont = false;
+	m_cachedFonts[fontIdx].sharing = sharing;
 	FontHandle ret = {fontIdx};
 	return ret;
 }
 
+FontHandle FontManager::createFontByPixelSizeFromLadder(TrueTypeHandle handle, uint32_t typefaceIndex, uint32_t pixelSize, FontType fontType)
+{
+	assert(bgfx::invalidHandle != handle.idx);
+
+	//pick the nearest rung larger or equal to the requested size,
+	//sizes above the last rung are upscaled from it since the rasterizer does not take them
+	uint32_t rungSize = s_ladderPixelSizes[LADDER_RUNG_COUNT-1];
+	for(uint32_t i = 0; i < LADDER_RUNG_COUNT; ++i)
+	{
+		if(s_ladderPixelSizes[i] >= pixelSize)
+		{
+			rungSize = s_ladderPixelSizes[i];
+			break;
+		}
+	}
+
+	//the rungs are shared font instances, each ladder font owns a reference on its rung
+	FontHandle rungHandle = createFontInstance(handle, typefaceIndex, rungSize, fontType, FONT_LADDER_RUNG);
+	if(rungHandle.idx == bgfx::invalidHandle)
+	{
+		return rungHandle;
+	}
+
+	FontHandle ret = createScaledFontToPixelSize(rungHandle, pixelSize);
+	m_cachedFonts[ret.idx].ownsMasterFont = true;
+	return ret;
+}
+
 FontHandle FontManager::createScaledFontToPixelSize(FontHandle _baseFontHandle, uint32_t _pixelSize)
 {
 	assert(bgfx::invalidHandle != _baseFontHandle.idx);
+	//always reference the root font so that glyph lookups are a single indirection
+	if(m_cachedFonts[_baseFontHandle.idx].masterFontHandle.idx != bgfx::invalidHandle)
+	{
+		_baseFontHandle = m_cachedFonts[_baseFontHandle.idx].masterFontHandle;
+	}
 	CachedFont& font = m_cachedFonts[_baseFontHandle.idx];
 	FontInfo& fontInfo = font.fontInfo;
 
 	FontInfo newFontInfo = fontInfo;
 	newFontInfo.pixelSize = _pixelSize;
 	newFontInfo.scale = (float)_pixelSize / (float) fontInfo.pixelSize;
+	//the subpixel variants of the master are not shifted by a scaled amount
+	newFontInfo.subpixelPhaseCount = 1;
 	newFontInfo.ascender = (newFontInfo.ascender * newFontInfo.scale);
 	newFontInfo.descender = (newFontInfo.descender * newFontInfo.scale);
 	newFontInfo.lineGap = (newFontInfo.lineGap * newFontInfo.scale);
@@ -613,9 +1260,21 @@ FontHandle FontManager::createScaledFontToPixelSize(FontHandle _baseFontHandle,
 	uint16_t fontIdx = m_fontHandles.alloc();
 	assert(fontIdx != bx::HandleAlloc::invalid);
 	m_cachedFonts[fontIdx].cachedGlyphs.clear();
+	m_cachedFonts[fontIdx].cachedGlyphIndices.clear();
+	m_cachedFonts[fontIdx].glyphMetrics.clear();
 	m_cachedFonts[fontIdx].fontInfo = newFontInfo;
 	m_cachedFonts[fontIdx].trueTypeFont = NULL;
+	m_cachedFonts[fontIdx].coverage = NULL;
+	m_cachedFonts[fontIdx].kerningPairs = NULL;
+	m_cachedFonts[fontIdx].kerningPairCount = 0;
 	m_cachedFonts[fontIdx].masterFontHandle = _baseFontHandle;
+	m_cachedFonts[fontIdx].fallbackFontHandle.idx = -1;
+	m_cachedFonts[fontIdx].fallbackCache.clear();
+	m_cachedFonts[fontIdx].trueTypeHandle = font.trueTypeHandle;
+	m_cachedFonts[fontIdx].typefaceIndex = font.typefaceIndex;
+	m_cachedFonts[fontIdx].refCount = 1;
+	m_cachedFonts[fontIdx].ownsMasterFont = false;
+	m_cachedFonts[fontIdx].sharing = FONT_UNSHARED;
 	FontHandle ret = {fontIdx};
 	return ret;
 }
@@ -638,35 +1297,162 @@ void FontManager::destroyFont(FontHandle _handle)
 {
 	assert(bgfx::invalidHandle != _handle.idx);
 
+	//shared instances are destroyed with their last owner
+	if(m_cachedFonts[_handle.idx].refCount > 1)
+	{
+		--m_cachedFonts[_handle.idx].refCount;
+		return;
+	}
+	m_cachedFonts[_handle.idx].refCount = 0;
+
 	if(m_cachedFonts[_handle.idx].trueTypeFont != NULL)
 	{
 		delete m_cachedFonts[_handle.idx].trueTypeFont;
 		m_cachedFonts[_handle.idx].trueTypeFont = NULL;
 	}
+	delete m_cachedFonts[_handle.idx].coverage;
+	m_cachedFonts[_handle.idx].coverage = NULL;
+	delete [] m_cachedFonts[_handle.idx].kerningPairs;
+	m_cachedFonts[_handle.idx].kerningPairs = NULL;
+	m_cachedFonts[_handle.idx].kerningPairCount = 0;
 	m_cachedFonts[_handle.idx].cachedGlyphs.clear();	
+	m_cachedFonts[_handle.idx].cachedGlyphIndices.clear();
+	m_cachedFonts[_handle.idx].glyphMetrics.clear();
+	m_cachedFonts[_handle.idx].fallbackCache.clear();
+	m_cachedFonts[_handle.idx].fallbackFontHandle.idx = bgfx::invalidHandle;
 	m_fontHandles.free(_handle.idx);
+
+	//unlink the font from the fallback chains
+	const uint16_t* fontHandles = m_fontHandles.getHandles();
+	for(uint16_t i = 0, end = m_fontHandles.getNumHandles(); i < end; ++i)
+	{
+		CachedFont& font = m_cachedFonts[fontHandles[i]];
+		if(font.fallbackFontHandle.idx == _handle.idx)
+		{
+			font.fallbackFontHandle.idx = bgfx::invalidHandle;
+		}
+		font.fallbackCache.clear();
+	}
+	//the handle may be recycled, forget the runs shaped with it
+	m_shapedRunCache->clear();
+
+	//release the reference of a ladder font on its rung
+	FontHandle masterHandle = m_cachedFonts[_handle.idx].masterFontHandle;
+	m_cachedFonts[_handle.idx].masterFontHandle.idx = bgfx::invalidHandle;
+	if(m_cachedFonts[_handle.idx].ownsMasterFont)
+	{
+		m_cachedFonts[_handle.idx].ownsMasterFont = false;
+		destroyFont(masterHandle);
+	}
+}
+
+void FontManager::setFallbackFont(FontHandle handle, FontHandle fallbackHandle)
+{
+	assert(bgfx::invalidHandle != handle.idx);
+	m_cachedFonts[handle.idx].fallbackFontHandle = fallbackHandle;
+
+	//the font may be part of other chains, invalidate every resolution cache
+	const uint16_t* fontHandles = m_fontHandles.getHandles();
+	for(uint16_t i = 0, end = m_fontHandles.getNumHandles(); i < end; ++i)
+	{
+		m_cachedFonts[fontHandles[i]].fallbackCache.clear();
+	}
+	m_shapedRunCache->clear();
+}
+
+bool FontManager::hasCodePoint(FontHandle handle, CodePoint_t codePoint)
+{
+	assert(bgfx::invalidHandle != handle.idx);
+	if(m_cachedFonts[handle.idx].masterFontHandle.idx != bgfx::invalidHandle)
+	{
+		handle = m_cachedFonts[handle.idx].masterFontHandle;
+	}
+	const CodePointSet* coverage = m_cachedFonts[handle.idx].coverage;
+	//without cmap, assume the font can provide the glyph
+	return coverage == NULL || coverage->contains(codePoint);
+}
+
+bool FontManager::getCoverage(FontHandle handle, CodePointSet& outCoverage)
+{
+	assert(bgfx::invalidHandle != handle.idx);
+	const CodePointSet* coverage = m_cachedFonts[getMasterFontIndex(handle)].coverage;
+	if(coverage == NULL)
+	{
+		return false;
+	}
+	outCoverage.add(*coverage);
+	return true;
+}
+
+FontHandle FontManager::resolveFallbackFont(FontHandle handle, CodePoint_t codePoint)
+{
+	assert(bgfx::invalidHandle != handle.idx);
+	CachedFont& font = m_cachedFonts[handle.idx];
+	if(font.fallbackFontHandle.idx == bgfx::invalidHandle || hasCodePoint(handle, codePoint))
+	{
+		return handle;
+	}
+
+	FallbackHash_t::iterator iter = font.fallbackCache.find(codePoint);
+	if(iter != font.fallbackCache.end())
+	{
+		FontHandle ret = {iter->second};
+		return ret;
+	}
+
+	//walk the chain once, the length bounds protect against cycles
+	FontHandle resolved = handle;
+	FontHandle current = font.fallbackFontHandle;
+	for(uint16_t depth = 0; current.idx != bgfx::invalidHandle && depth < m_maxFontCount; ++depth)
+	{
+		if(hasCodePoint(current, codePoint))
+		{
+			resolved = current;
+			break;
+		}
+		current = m_cachedFonts[current.idx].fallbackFontHandle;
+	}
+
+	//when no font has it, the first font of the chain renders its missing glyph
+	font.fallbackCache[codePoint] = resolved.idx;
+	return resolved;
 }
 
 bool FontManager::preloadGlyph(FontHandle handle, const wchar_t* _string)
 {
 	assert(bgfx::invalidHandle != handle.idx);
+	//dedupe and sort the code points before baking them
+	CodePointSet codePoints;
+	codePoints.addWideString(_string);
+	return preloadGlyph(handle, codePoints);
+}
+
+bool FontManager::preloadGlyph(FontHandle handle, const CodePointSet& codePoints)
+{
+	assert(bgfx::invalidHandle != handle.idx);
+	if(m_cachedFonts[handle.idx].masterFontHandle.idx != bgfx::invalidHandle)
+	{
+		handle = m_cachedFonts[handle.idx].masterFontHandle;
+	}
 	CachedFont& font = m_cachedFonts[handle.idx];
-	FontInfo& fontInfo = font.fontInfo;	
 
 	//if truetype present
 	if(font.trueTypeFont != NULL)
 	{	
-		//parse string
-		for( size_t i=0, end = wcslen(_string) ; i < end; ++i )
+		//code points are visited in increasing order, which keeps the glyph access pattern of the font file linear
+		//and the atlas uploads the touched area of each face once at the end
+		bool result = true;
+		m_atlas->beginBatch();
+		for(CodePoint_t codePoint = codePoints.first(); codePoint != CodePointSet::END; codePoint = codePoints.next(codePoint))
 		{
-			//if glyph cached, continue
-			CodePoint_t codePoint = _string[i];
 			if(!preloadGlyph(handle, codePoint))
 			{
-				return false;
+				result = false;
+				break;
 			}
 		}
-		return true;
+		m_atlas->endBatch();
+		return result;
 	}
 
 	return false;
@@ -675,14 +1461,48 @@ bool FontManager::preloadGlyph(FontHandle handle, const wchar_t* _string)
 bool FontManager::preloadGlyph(FontHandle handle, CodePoint_t codePoint)
 {
 	assert(bgfx::invalidHandle != handle.idx);
-	CachedFont& font = m_cachedFonts[handle.idx];
-	FontInfo& fontInfo = font.fontInfo;
+	//scaled fonts share the glyph table of their master font
+	return bakeGlyph(getMasterFontIndex(handle), codePoint, 0) != NULL;
+}
+
+const GlyphInfo* FontManager::bakeGlyph(uint16_t fontIndex, CodePoint_t codePoint, uint32_t subpixelPhase)
+{
+	CachedFont& font = m_cachedFonts[fontIndex];
+	CodePoint_t key = getGlyphKey(codePoint, subpixelPhase);
 
 	//check if glyph not already present
-	GlyphHash_t::iterator iter = font.cachedGlyphs.find(codePoint);
+	GlyphPointerHash_t::iterator iter = font.cachedGlyphs.find(key);
 	if(iter != font.cachedGlyphs.end())
 	{
-		return true;
+		return iter->second;
+	}
+
+	//if truetype present
+	if(font.trueTypeFont != NULL)
+	{
+		//code points mapped to the same glyph (e.g. every missing character to .notdef) share its rasterization
+		const GlyphInfo* glyph = bakeGlyphByIndex(fontIndex, font.trueTypeFont->getGlyphIndex(codePoint), subpixelPhase);
+		if(glyph != NULL)
+		{
+			font.cachedGlyphs[key] = glyph;
+		}
+		return glyph;
+	}
+
+	return NULL;
+}
+
+const GlyphInfo* FontManager::bakeGlyphByIndex(uint16_t fontIndex, int32_t glyphIndex, uint32_t subpixelPhase)
+{
+	CachedFont& font = m_cachedFonts[fontIndex];
+	FontInfo& fontInfo = font.fontInfo;
+	CodePoint_t key = getGlyphKey(glyphIndex, subpixelPhase);
+
+	//check if glyph not already present
+	GlyphHash_t::iterator iter = font.cachedGlyphIndices.find(key);
+	if(iter != font.cachedGlyphIndices.end())
+	{
+		return &iter->second;
 	}
 
 	//if truetype present
@@ -694,16 +1514,16 @@ bool FontManager::preloadGlyph(FontHandle handle, CodePoint_t codePoint)
 		switch(font.fontInfo.fontType)
 		{
 		case FONT_TYPE_ALPHA:
-			font.trueTypeFont->bakeGlyphAlpha(fontInfo,codePoint, glyphInfo, m_buffer);
+			font.trueTypeFont->bakeGlyphAlpha(fontInfo, glyphIndex, glyphInfo, m_buffer, subpixelPhase);
 			break;
 		case FONT_TYPE_LCD:
-			font.trueTypeFont->bakeGlyphSubpixel(fontInfo,codePoint, glyphInfo, m_buffer);
+			font.trueTypeFont->bakeGlyphSubpixel(fontInfo, glyphIndex, glyphInfo, m_buffer, subpixelPhase);
 			break;
 		case FONT_TYPE_DISTANCE:
-			font.trueTypeFont->bakeGlyphDistance(fontInfo,codePoint, glyphInfo, m_buffer);
+			font.trueTypeFont->bakeGlyphDistance(fontInfo, glyphIndex, glyphInfo, m_buffer);
 			break;
 		case FONT_TYPE_DISTANCE_SUBPIXEL:
-			font.trueTypeFont->bakeGlyphDistance(fontInfo,codePoint, glyphInfo, m_buffer);
+			font.trueTypeFont->bakeGlyphDistance(fontInfo, glyphIndex, glyphInfo, m_buffer);
 			break;
 		default:
 			assert(false && "TextureType not supported yet");
@@ -712,44 +1532,110 @@ bool FontManager::preloadGlyph(FontHandle handle, CodePoint_t codePoint)
 		//copy bitmap to texture
 		if(!addBitmap(glyphInfo, m_buffer) )
 		{
-			return false;
+			return NULL;
 		}
 
-		glyphInfo.advance_x = (glyphInfo.advance_x * fontInfo.scale);
-		glyphInfo.advance_y = (glyphInfo.advance_y * fontInfo.scale);
-		glyphInfo.offset_x = (glyphInfo.offset_x * fontInfo.scale);
-		glyphInfo.offset_y = (glyphInfo.offset_y * fontInfo.scale);
-		glyphInfo.height = (glyphInfo.height * fontInfo.scale);
-		glyphInfo.width =  (glyphInfo.width * fontInfo.scale);
+		// store cached glyph (metrics are kept unscaled, see FontInfo::scale)
+		GlyphInfo& cachedGlyph = font.cachedGlyphIndices[key];
+		cachedGlyph = glyphInfo;
+		//the baked glyph answers getGlyphMetrics from now on
+		if(subpixelPhase == 0)
+		{
+			font.glyphMetrics.erase(glyphIndex);
+		}
+		return &cachedGlyph;
+	}
 
-		// store cached glyph
-		font.cachedGlyphs[codePoint] = glyphInfo;
-		return true;
-	}else
+	return NULL;
+}
+
+int32_t FontManager::getGlyphIndex(FontHandle handle, CodePoint_t codePoint)
+{
+	assert(bgfx::invalidHandle != handle.idx);
+	CachedFont& font = m_cachedFonts[getMasterFontIndex(handle)];
+	if(font.trueTypeFont != NULL)
+	{
+		return font.trueTypeFont->getGlyphIndex(codePoint);
+	}
+
+	//without truetype, only the glyphs already baked are known
+	GlyphPointerHash_t::iterator iter = font.cachedGlyphs.find(codePoint);
+	return (iter != font.cachedGlyphs.end()) ? iter->second->glyphIndex : 0;
+}
+
+const GlyphInfo* FontManager::getGlyphInfoByIndex(FontHandle fontHandle, int32_t glyphIndex, uint32_t subpixelPhase)
+{
+	assert(bgfx::invalidHandle != fontHandle.idx);
+	uint16_t fontIndex = getMasterFontIndex(fontHandle);
+	assert(subpixelPhase < m_cachedFonts[fontIndex].fontInfo.subpixelPhaseCount);
+	return bakeGlyphByIndex(fontIndex, glyphIndex, subpixelPhase);
+}
+
+const GlyphInfo* FontManager::getGlyphMetrics(FontHandle fontHandle, int32_t glyphIndex)
+{
+	assert(bgfx::invalidHandle != fontHandle.idx);
+	uint16_t fontIndex = getMasterFontIndex(fontHandle);
+	CachedFont& font = m_cachedFonts[fontIndex];
+
+	//a baked glyph already knows its metrics
+	GlyphHash_t::iterator iter = font.cachedGlyphIndices.find(getGlyphKey(glyphIndex, 0));
+	if(iter != font.cachedGlyphIndices.end())
+	{
+		return &iter->second;
+	}
+
+	//the glyph is about to be laid out, it is baked now rather than loaded twice (the subpixel variants are picked by the layout)
+	if(m_bakeShapedGlyphs && font.fontInfo.subpixelPhaseCount == 1)
 	{
-		//retrieve glyph from parent font if any
-		if(font.masterFontHandle.idx != bgfx::invalidHandle)
+		const GlyphInfo* glyph = bakeGlyphByIndex(fontIndex, glyphIndex, 0);
+		if(glyph != NULL)
 		{
-			if(preloadGlyph(font.masterFontHandle, codePoint))
-			{
-				GlyphInfo glyphInfo;
-				getGlyphInfo(font.masterFontHandle, codePoint, glyphInfo);
-
-				glyphInfo.advance_x = (glyphInfo.advance_x * fontInfo.scale);
-				glyphInfo.advance_y = (glyphInfo.advance_y * fontInfo.scale);
-				glyphInfo.offset_x = (glyphInfo.offset_x * fontInfo.scale);
-				glyphInfo.offset_y = (glyphInfo.offset_y * fontInfo.scale);
-				glyphInfo.height = (glyphInfo.height * fontInfo.scale);
-				glyphInfo.width = (glyphInfo.width * fontInfo.scale);
-
-				// store cached glyph
-				font.cachedGlyphs[codePoint] = glyphInfo;
-				return true;
-			}
+			return glyph;
 		}
 	}
 
-	return false;
+	iter = font.glyphMetrics.find(glyphIndex);
+	if(iter != font.glyphMetrics.end())
+	{
+		return &iter->second;
+	}
+
+	//measure the glyph without touching the atlas
+	if(font.trueTypeFont != NULL)
+	{
+		GlyphInfo glyphInfo;
+		if(font.trueTypeFont->getGlyphMetrics(font.fontInfo, glyphIndex, glyphInfo))
+		{
+			GlyphInfo& cachedGlyph = font.glyphMetrics[glyphIndex];
+			cachedGlyph = glyphInfo;
+			return &cachedGlyph;
+		}
+	}
+	return NULL;
+}
+
+const GlyphInfo* FontManager::getSubpixelGlyphInfo(FontHandle fontHandle, CodePoint_t codePoint, uint32_t subpixelPhase)
+{
+	assert(bgfx::invalidHandle != fontHandle.idx);
+	uint16_t fontIndex = getMasterFontIndex(fontHandle);
+	assert(subpixelPhase < m_cachedFonts[fontIndex].fontInfo.subpixelPhaseCount);
+	return bakeGlyph(fontIndex, codePoint, subpixelPhase);
+}
+
+void FontManager::setSubpixelPositioning(FontHandle handle, uint32_t phaseCount)
+{
+	assert(bgfx::invalidHandle != handle.idx);
+	assert(phaseCount >= 1 && phaseCount <= MAX_SUBPIXEL_PHASES);
+	CachedFont& font = m_cachedFonts[handle.idx];
+	assert(font.masterFontHandle.idx == bgfx::invalidHandle && "Subpixel positioning is not supported by scaled fonts");
+	assert(font.cachedGlyphIndices.empty() && "Subpixel positioning must be enabled before baking glyphs");
+	if(font.fontInfo.fontType == FONT_TYPE_ALPHA || font.fontInfo.fontType == FONT_TYPE_LCD)
+	{
+		font.fontInfo.subpixelPhaseCount = (uint16_t)phaseCount;
+	}
+	//the measured advances depend on the phase count
+	font.glyphMetrics.clear();
+	m_shapedRunCache->clear();
 }
 
 const FontInfo& FontManager::getFontInfo(FontHandle handle)
@@ -760,27 +1646,207 @@ const FontInfo& FontManager::getFontInfo(FontHandle handle)
 
 bool FontManager::getGlyphInfo(FontHandle fontHandle, CodePoint_t codePoint, GlyphInfo& outInfo)
 {	
-	GlyphHash_t::iterator iter = m_cachedFonts[fontHandle.idx].cachedGlyphs.find(codePoint);
-	if(iter == m_cachedFonts[fontHandle.idx].cachedGlyphs.end())
+	assert(bgfx::invalidHandle != fontHandle.idx);
+	//scaled fonts share the glyph table of their master font
+	const GlyphInfo* glyph = bakeGlyph(getMasterFontIndex(fontHandle), codePoint, 0);
+	if(glyph == NULL)
+	{
+		return false;
+	}
+	outInfo = *glyph;
+	return true;
+}
+
+float FontManager::getKerning(FontHandle fontHandle, int32_t leftGlyphIndex, int32_t rightGlyphIndex)
+{
+	assert(bgfx::invalidHandle != fontHandle.idx);
+	const CachedFont& font = m_cachedFonts[getMasterFontIndex(fontHandle)];
+	if(font.kerningPairCount == 0 || leftGlyphIndex <= 0 || rightGlyphIndex <= 0)
+	{
+		return 0.0f;
+	}
+
+	//binary search in the sorted pair table
+	uint32_t glyphPair = ((uint32_t)leftGlyphIndex << 16) | ((uint32_t)rightGlyphIndex & 0xffff);
+	uint32_t first = 0;
+	uint32_t last = font.kerningPairCount;
+	while(first < last)
 	{
-		if(preloadGlyph(fontHandle, codePoint))
+		uint32_t middle = (first + last) >> 1;
+		uint32_t pair = font.kerningPairs[middle].glyphPair;
+		if(pair == glyphPair)
+		{
+			return font.kerningPairs[middle].advance;
+		}
+		if(pair < glyphPair)
 		{
-			iter = m_cachedFonts[fontHandle.idx].cachedGlyphs.find(codePoint);
+			first = middle + 1;
 		}else
 		{
-			return false;
+			last = middle;
 		}
 	}
-	outInfo = iter->second;
-	return true;
+	return 0.0f;
+}
+
+bool FontManager::getGlyphRun(FontHandle fontHandle, const CodePoint_t* codePoints, uint32_t count, const GlyphInfo** outGlyphs, FontHandle* outFonts)
+{
+	assert(bgfx::invalidHandle != fontHandle.idx);
+
+	//resolve the font of each code point when a fallback chain is requested
+	if(outFonts != NULL)
+	{
+		for(uint32_t i = 0; i < count; ++i)
+		{
+			outFonts[i] = resolveFallbackFont(fontHandle, codePoints[i]);
+		}
+	}
+
+	//resolve the cached glyphs and count the misses
+	uint32_t missCount = 0;
+	for(uint32_t i = 0; i < count; ++i)
+	{
+		CachedFont& font = m_cachedFonts[getMasterFontIndex(outFonts != NULL ? outFonts[i] : fontHandle)];
+		GlyphPointerHash_t::iterator iter = font.cachedGlyphs.find(codePoints[i]);
+		if(iter != font.cachedGlyphs.end())
+		{
+			outGlyphs[i] = iter->second;
+		}else
+		{
+			outGlyphs[i] = NULL;
+			++missCount;
+		}
+	}
+
+	if(missCount == 0)
+	{
+		return true;
+	}
+
+	//gather the misses keyed by master font then code point, so that the duplicates fold together
+	//and each font bakes its glyphs in a row
+	stl::vector<uint64_t> misses;
+	misses.reserve(missCount);
+	for(uint32_t i = 0; i < count; ++i)
+	{
+		if(outGlyphs[i] == NULL)
+		{
+			uint64_t fontIndex = getMasterFontIndex(outFonts != NULL ? outFonts[i] : fontHandle);
+			misses.push_back( (fontIndex << 32) | (uint32_t)codePoints[i]);
+		}
+	}
+	qsort(&misses[0], misses.size(), sizeof(uint64_t), compareU64);
+
+	//bake the misses in one pass, the atlas uploads the touched area of each face once at the end
+	bool result = true;
+	m_atlas->beginBatch();
+	for(uint32_t i = 0; i < misses.size(); ++i)
+	{
+		if(i > 0 && misses[i] == misses[i-1])
+		{
+			continue;
+		}
+		if(bakeGlyph((uint16_t)(misses[i] >> 32), (CodePoint_t)(uint32_t)misses[i], 0) == NULL)
+		{
+			result = false;
+		}
+	}
+	m_atlas->endBatch();
+
+	//resolve the misses once the tables are stable
+	for(uint32_t i = 0; i < count; ++i)
+	{
+		if(outGlyphs[i] == NULL)
+		{
+			CachedFont& font = m_cachedFonts[getMasterFontIndex(outFonts != NULL ? outFonts[i] : fontHandle)];
+			GlyphPointerHash_t::iterator iter = font.cachedGlyphs.find(codePoints[i]);
+			if(iter != font.cachedGlyphs.end())
+			{
+				outGlyphs[i] = iter->second;
+			}
+		}
+	}
+	return result;
+}
+
+void FontManager::setFontSharing(bool enabled)
+{
+	m_shareFonts = enabled;
+}
+
+void FontManager::setBitmapSharing(bool enabled)
+{
+	m_shareBitmaps = enabled;
+}
+
+void FontManager::setTextShaper(TextShaper* shaper)
+{
+	m_textShaper = (shaper != NULL) ? shaper : m_defaultTextShaper;
+	m_shapedRunCache->clear();
+}
+
+const ShapedGlyph* FontManager::shapeText(FontHandle fontHandle, uint32_t script, const CodePoint_t* codePoints, uint32_t count, uint32_t& outGlyphCount, bool bakeGlyphs)
+{
+	assert(bgfx::invalidHandle != fontHandle.idx);
+	const ShapedGlyph* glyphs = m_shapedRunCache->find(fontHandle, script, codePoints, count, outGlyphCount);
+	if(glyphs != NULL)
+	{
+		return glyphs;
+	}
+
+	//leave room for shapers decomposing characters in several glyphs
+	uint32_t maxGlyphs = count * 2 + 4;
+	if(maxGlyphs > m_shapedGlyphCapacity)
+	{
+		delete [] m_shapedGlyphs;
+		m_shapedGlyphCapacity = maxGlyphs * 2;
+		m_shapedGlyphs = new ShapedGlyph[m_shapedGlyphCapacity];
+	}
+	m_bakeShapedGlyphs = bakeGlyphs;
+	outGlyphCount = m_textShaper->shape(this, fontHandle, script, codePoints, count, m_shapedGlyphs, maxGlyphs);
+	m_bakeShapedGlyphs = false;
+	assert(outGlyphCount <= maxGlyphs);
+	return m_shapedRunCache->insert(fontHandle, script, codePoints, count, m_shapedGlyphs, outGlyphCount);
 }
 
 // ****************************************************************************
 
+uint16_t FontManager::getMasterFontIndex(FontHandle handle)
+{
+	FontHandle master = m_cachedFonts[handle.idx].masterFontHandle;
+	return master.idx != bgfx::invalidHandle ? master.idx : handle.idx;
+}
 
 bool FontManager::addBitmap(GlyphInfo& glyphInfo, const uint8_t* data)
 {
-	glyphInfo.regionIndex = m_atlas->addRegion((uint16_t) ceil(glyphInfo.width),(uint16_t) ceil(glyphInfo.height), data, bgfx::AtlasRegion::TYPE_GRAY);
+	//blank glyphs (e.g. space) take no atlas space, they share the filler region and are drawn as empty quads
+	if(glyphInfo.width * glyphInfo.height == 0)
+	{
+		glyphInfo.regionIndex = m_blackGlyph.regionIndex;
+		return true;
+	}
+	uint16_t width = (uint16_t) ceil(glyphInfo.width);
+	uint16_t height = (uint16_t) ceil(glyphInfo.height);
+	if(m_shareBitmaps)
+	{
+		//reuse the region of an identical bitmap, the hash only selects the candidate
+		uint64_t contentHash = hashBitmap(width, height, data);
+		SharedRegionHash_t::iterator iter = m_sharedRegions->regions.find(contentHash);
+		if(iter != m_sharedRegions->regions.end() && isRegionBitmap(m_atlas, iter->second, width, height, data))
+		{
+			glyphInfo.regionIndex = iter->second;
+			return true;
+		}
+
+		glyphInfo.regionIndex = m_atlas->addRegion(width, height, data, bgfx::AtlasRegion::TYPE_GRAY);
+		//on a collision the first bitmap stays the shared one
+		if(iter == m_sharedRegions->regions.end())
+		{
+			m_sharedRegions->regions[contentHash] = glyphInfo.regionIndex;
+		}
+		return true;
+	}
+	glyphInfo.regionIndex = m_atlas->addRegion(width, height, data, bgfx::AtlasRegion::TYPE_GRAY);
 	return true;
 }
 
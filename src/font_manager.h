@@ -10,6 +10,11 @@ namespace bgfx{ class Atlas; }
 namespace bgfx_font
 {
 
+class CodePointSet;
+class TextShaper;
+class ShapedRunCache;
+struct ShapedGlyph;
+
 enum FontType
 {
 	FONT_TYPE_ALPHA    = 0x00000100 , // L8
@@ -37,8 +42,12 @@ struct FontInfo
 	/// The position of the underline relatively to the baseline
 	float underline_position;
 				
-	//scale to apply to glyph data
+	/// scale to apply to glyph data at layout time
+	/// @remark scaled fonts share the (unscaled) glyph table of their master font
 	float scale;
+
+	/// number of horizontal subpixel positions a glyph can be baked at (1 means whole pixels only)
+	uint16_t subpixelPhaseCount;
 };
 
 // Glyph metrics:
@@ -76,6 +85,8 @@ struct FontInfo
 typedef int32_t CodePoint_t;
 
 /// A structure that describe a glyph.	
+/// @remark metrics are expressed in pixels of the font that baked the glyph,
+/// multiply them by FontInfo::scale to get the metrics of a scaled font.
 struct GlyphInfo
 {
 	/// Index for faster retrieval
@@ -116,14 +127,19 @@ class FontManager
 {
 public:
 	/// create the font manager using an external cube atlas (doesn't take ownership of the atlas)
-	FontManager(bgfx::Atlas* atlas);
+	/// @param maxFontCount maximum number of fonts alive at once (scaled fonts included)
+	/// @param maxFileCount maximum number of TrueType files loaded at once
+	FontManager(bgfx::Atlas* atlas, uint16_t maxFontCount = 64, uint16_t maxFileCount = 64);
 	/// create the font manager and create the texture cube as BGRA8 with linear filtering
-	FontManager(uint32_t textureSideWidth = 512);
+	FontManager(uint32_t textureSideWidth = 512, uint16_t maxFontCount = 64, uint16_t maxFileCount = 64);
 
 	~FontManager();
 
 	/// retrieve the atlas used by the font manager (e.g. to add stuff to it)
 	bgfx::Atlas* getAtlas() { return m_atlas; }	
+
+	/// retrieve the cache of shaped runs (e.g. to read its hit counters)
+	ShapedRunCache* getShapedRunCache() { return m_shapedRunCache; }
 	
 	/// load a TrueType font from a file path
 	/// @return invalid handle if the loading fail
@@ -138,8 +154,21 @@ public:
 	void unloadTrueType(TrueTypeHandle handle);
 	
 	/// return a font whose height is a fixed pixel size	
+	/// @remark with font sharing enabled, identical requests share the same instance (see setFontSharing)
 	FontHandle createFontByPixelSize(TrueTypeHandle handle, uint32_t typefaceIndex, uint32_t pixelSize, FontType fontType = FONT_TYPE_ALPHA);
 
+	/// return a font whose height is a fixed pixel size, by scaling the nearest larger size of a ladder of canonical sizes
+	/// the canonical sizes are baked on demand and shared by every font of the same file, typeface and type
+	/// @remark trade a bit of sharpness for far less rasterization when an UI uses many sizes
+	/// @remark sizes above the largest canonical size are upscaled from it
+	/// @remark the ladder font must be destroyed with destroyFont like any other font
+	FontHandle createFontByPixelSizeFromLadder(TrueTypeHandle handle, uint32_t typefaceIndex, uint32_t pixelSize, FontType fontType = FONT_TYPE_ALPHA);
+
+	/// enable subpixel glyph positioning: glyphs are placed on whole pixels and up to phaseCount variants of each glyph,
+	/// shifted by 1/phaseCount pixel steps, are baked on demand to match the fractional pen position (e.g. 4 for 1/4 pixel)
+	/// @remark only alpha and lcd fonts use it, must be called before any glyph of the font is baked
+	void setSubpixelPositioning(FontHandle handle, uint32_t phaseCount);
+
 	/// return a scaled child font whose height is a fixed pixel size
 	FontHandle createScaledFontToPixelSize(FontHandle baseFontHandle, uint32_t pixelSize);
 
@@ -159,6 +188,10 @@ public:
 	/// if the Font is a baked font, this only do validation on the characters
 	bool preloadGlyph(FontHandle handle, const wchar_t* _string);
 
+	/// Preload a set of glyphs from a TrueType file, in increasing code point order
+	/// @return true if every glyph could be preloaded, false otherwise	
+	bool preloadGlyph(FontHandle handle, const CodePointSet& codePoints);
+
 	/// Preload a single glyph, return true on success
 	bool preloadGlyph(FontHandle handle, CodePoint_t character);
 
@@ -172,35 +205,142 @@ public:
 	
 	/// Return the rendering informations about the glyph region
 	/// Load the glyph from a TrueType font if possible
+	/// @remark the glyph metrics are unscaled, use FontInfo::scale to size them
 	/// @return true if the Glyph is available
 	bool getGlyphInfo(FontHandle fontHandle, CodePoint_t codePoint, GlyphInfo& outInfo);	
 
+	/// return the index of the glyph the cmap of the font maps the code point to, 0 (the missing glyph) if there is none
+	int32_t getGlyphIndex(FontHandle handle, CodePoint_t codePoint);
+
+	/// Return the rendering informations about a glyph of the font, baked on first use
+	/// @param subpixelPhase variant to use when subpixel positioning is enabled (see setSubpixelPositioning)
+	/// @remark the glyph metrics are unscaled, use FontInfo::scale to size them
+	/// @return NULL if the glyph is not available
+	const GlyphInfo* getGlyphInfoByIndex(FontHandle fontHandle, int32_t glyphIndex, uint32_t subpixelPhase = 0);
+
+	/// Return the metrics of a glyph of the font without baking it (the atlas is left untouched)
+	/// @remark the regionIndex is meaningless and the bounds may differ from the baked bitmap by a pixel, the advance is exact
+	/// @remark the glyph metrics are unscaled, use FontInfo::scale to size them
+	/// @remark while shapeText shapes a run to lay out, the glyph is baked instead so that FreeType loads it once
+	/// @return NULL if the glyph is not available, the metrics stay valid until the glyph is baked
+	const GlyphInfo* getGlyphMetrics(FontHandle fontHandle, int32_t glyphIndex);
+
+	/// Return the variant of a glyph shifted by subpixelPhase / FontInfo::subpixelPhaseCount pixel, baked on first use
+	/// @return NULL if the glyph is not available
+	const GlyphInfo* getSubpixelGlyphInfo(FontHandle fontHandle, CodePoint_t codePoint, uint32_t subpixelPhase);
+
+	/// Resolve the rendering informations of a whole run of code points in one call
+	/// The missing glyphs are gathered first, deduplicated, then baked in one pass whose atlas texture uploads are merged per cube face
+	/// @param outGlyphs array of count pointers, filled with the glyph of each code point or NULL if it is not available
+	/// @remark the pointers stay valid until the font (or its master font) is destroyed
+	/// @param outFonts optional array of count handles, when supplied the code points are resolved through the fallback chain of the font
+	/// and filled with the font providing each glyph
+	/// @remark the glyph metrics are unscaled, use FontInfo::scale to size them
+	/// @return true if every glyph is available
+	bool getGlyphRun(FontHandle fontHandle, const CodePoint_t* codePoints, uint32_t count, const GlyphInfo** outGlyphs, FontHandle* outFonts = NULL);
+
+	/// set the font used for the code points missing from a font, fallbacks can be chained (e.g. UI font -> CJK font -> emoji font)
+	/// @param fallbackHandle the next font of the chain, or an invalid handle to end the chain
+	void setFallbackFont(FontHandle handle, FontHandle fallbackHandle);
+
+	/// return true if the cmap of the font maps the code point
+	bool hasCodePoint(FontHandle handle, CodePoint_t codePoint);
+
+	/// add every code point mapped by the cmap of the font to outCoverage
+	/// @return false if the cmap of the font is unknown
+	bool getCoverage(FontHandle handle, CodePointSet& outCoverage);
+
+	/// return the first font of the fallback chain starting at handle that maps the code point, 
+	/// or handle itself if none does (it will render its missing glyph)
+	/// @remark the resolution is cached per chain, lookups are O(1) after the first one
+	FontHandle resolveFallbackFont(FontHandle handle, CodePoint_t codePoint);
+
+	/// Return the kerning adjustment to apply between two glyphs (see GlyphInfo::glyphIndex)
+	/// the pairs are extracted once at font creation, so this works after the TrueType file is unloaded
+	/// @remark the value is unscaled, use FontInfo::scale to size it
+	float getKerning(FontHandle fontHandle, int32_t leftGlyphIndex, int32_t rightGlyphIndex);
+
+	/// share the font instance of identical createFontByPixelSize requests (same file, typeface, size and type)
+	/// the shared instance is destroyed when every handle returned for it has been destroyed
+	/// @remark the settings of a shared instance (fallback font, subpixel positioning) apply to all its owners,
+	/// only enable it when the callers agree on them, disabled by default
+	void setFontSharing(bool enabled);
+
+	/// share the atlas region of glyphs baked with identical bitmaps, across all the fonts
+	/// the baked bitmaps are hashed with their dimensions, a region is reused once its content is checked to be identical
+	/// @remark cut the atlas use of apps baking the same glyphs in several fonts, for the cost of hashing each baked glyph
+	void setBitmapSharing(bool enabled);
+
+	/// set the shaper converting runs of code points to glyphs, NULL restores the default one (one glyph per code point and pair kerning)
+	/// @remark the ownership of the shaper is not taken, the shaped run cache is flushed
+	void setTextShaper(TextShaper* shaper);
+
+	/// shape a run of code points without line break, through the shaped run cache
+	/// @param script ISO 15924 tag of the script of the run (e.g. 'Latn', 'Arab'), 0 if unknown
+	/// @param bakeGlyphs the run is laid out next, the glyphs are baked while they are shaped instead of being measured, then baked
+	/// @return the glyphs of the run, valid until the next call
+	const ShapedGlyph* shapeText(FontHandle fontHandle, uint32_t script, const CodePoint_t* codePoints, uint32_t count, uint32_t& outGlyphCount, bool bakeGlyphs = false);
+
 	GlyphInfo& getBlackGlyph(){ return m_blackGlyph; }
 
 	class TrueTypeFont; //public to shut off Intellisense warning
 private:
 	
 	struct CachedFont;
+	struct SharedRegions;
 	struct CachedFile
 	{		
 		uint8_t* buffer;
 		uint32_t bufferSize;
 	};	
 
+	/// how a TrueType font instance is shared, see CachedFont::sharing
+	enum FontSharing
+	{
+		FONT_UNSHARED,
+		FONT_SHARED,
+		FONT_LADDER_RUNG
+	};
+
 	void init(uint32_t textureSideWidth);
+	/// create a TrueType font instance, or return a new reference on an identical one of the same sharing kind
+	FontHandle createFontInstance(TrueTypeHandle handle, uint32_t typefaceIndex, uint32_t pixelSize, FontType fontType, uint8_t sharing);
+	/// return the index of the font owning the glyph table (the master font for scaled fonts)
+	uint16_t getMasterFontIndex(FontHandle handle);
+	/// bake a glyph variant in the glyph table of the font if it is not already there
+	const GlyphInfo* bakeGlyph(uint16_t fontIndex, CodePoint_t codePoint, uint32_t subpixelPhase);
+	/// bake a glyph variant in the glyph index table of the font if it is not already there
+	const GlyphInfo* bakeGlyphByIndex(uint16_t fontIndex, int32_t glyphIndex, uint32_t subpixelPhase);
 	bool addBitmap(GlyphInfo& glyphInfo, const uint8_t* data);	
 
 	bool m_ownAtlas;
-	(bgfx::Atlas* m_atlas;
+	bgfx::Atlas* m_atlas;
 	
 	bx::HandleAlloc m_fontHandles;	
 	CachedFont* m_cachedFonts;	
+	uint16_t m_maxFontCount;
 	
 	bx::HandleAlloc m_filesHandles;
 	CachedFile* m_cachedFiles;	
+	uint16_t m_maxFileCount;
 		
 	GlyphInfo m_blackGlyph;
 
+	//atlas regions of the baked bitmaps, when bitmap sharing is enabled
+	SharedRegions* m_sharedRegions;
+	bool m_shareBitmaps;
+	//identical createFontByPixelSize requests share an instance
+	bool m_shareFonts;
+
+	TextShaper* m_textShaper;
+	TextShaper* m_defaultTextShaper;
+	ShapedRunCache* m_shapedRunCache;
+	//temporary buffer receiving the glyphs of a shaper
+	ShapedGlyph* m_shapedGlyphs;
+	uint32_t m_shapedGlyphCapacity;
+	//the run being shaped is laid out next, the glyphs measured by the shaper are baked right away
+	bool m_bakeShapedGlyphs;
+
 	//temporary buffer to raster glyph
 	uint8_t* m_buffer;	
 };
@@ -0,0 +1,130 @@
+/* Copyright 2013 Jeremie Roy. All rights reserved.
+ * License: http://www.opensource.org/licenses/BSD-2-Clause
+*/
+#include "line_breaker.h"
+
+namespace bgfx_font
+{
+
+LineBreakClass getLineBreakClass(CodePoint_t codePoint)
+{
+	//ASCII first, it covers most of the text
+	if(codePoint < 0x80)
+	{
+		switch(codePoint)
+		{
+		case L' ':
+			return LINE_BREAK_SP;
+		case L'\t':
+			return LINE_BREAK_BA;
+		case L'-':
+			return LINE_BREAK_HY;
+		case L'(': case L'[': case L'{':
+			return LINE_BREAK_OP;
+		case L')': case L']': case L'}':
+		case L'!': case L'?':
+		case L',': case L'.': case L':': case L';':
+			return LINE_BREAK_CL;
+		case L'/':
+			return LINE_BREAK_SY;
+		default:
+			return LINE_BREAK_AL;
+		}
+	}
+
+	switch(codePoint)
+	{
+	case 0x200B:
+		return LINE_BREAK_ZW;
+	case 0x00A0: case 0x2007: case 0x202F: case 0x2060: case 0xFEFF:
+		return LINE_BREAK_GL;
+	case 0x00AD: case 0x1680: case 0x2010: case 0x2012: case 0x2013: case 0x3000:
+		return LINE_BREAK_BA;
+	case 0x00A1: case 0x00BF: case 0x2018: case 0x201C:
+	case 0x3008: case 0x300A: case 0x300C: case 0x300E: case 0x3010: case 0xFF08:
+		return LINE_BREAK_OP;
+	case 0x2019: case 0x201D: case 0x3001: case 0x3002:
+	case 0x3009: case 0x300B: case 0x300D: case 0x300F: case 0x3011:
+	case 0xFF01: case 0xFF09: case 0xFF0C: case 0xFF0E: case 0xFF1A: case 0xFF1B: case 0xFF1F:
+		return LINE_BREAK_CL;
+	case 0x200D:
+		return LINE_BREAK_CM;
+	}
+
+	if( (codePoint >= 0x2000 && codePoint <= 0x2006) || (codePoint >= 0x2008 && codePoint <= 0x200A) )
+	{
+		return LINE_BREAK_BA;
+	}
+	if( (codePoint >= 0x0300 && codePoint <= 0x036F) || (codePoint >= 0xFE00 && codePoint <= 0xFE0F) || (codePoint >= 0xFE20 && codePoint <= 0xFE2F) )
+	{
+		return LINE_BREAK_CM;
+	}
+	if( (codePoint >= 0x2E80 && codePoint <= 0x2FFF) //CJK radicals
+		|| (codePoint >= 0x3040 && codePoint <= 0x30FF) //kana
+		|| (codePoint >= 0x3400 && codePoint <= 0x4DBF) //CJK extension A
+		|| (codePoint >= 0x4E00 && codePoint <= 0x9FFF) //CJK unified ideographs
+		|| (codePoint >= 0xAC00 && codePoint <= 0xD7A3) //hangul syllables
+		|| (codePoint >= 0xF900 && codePoint <= 0xFAFF) //CJK compatibility ideographs
+		|| (codePoint >= 0xFF00 && codePoint <= 0xFFEF) //fullwidth forms
+		|| (codePoint >= 0x1F300 && codePoint <= 0x1FAFF) //pictographs
+		|| (codePoint >= 0x20000 && codePoint <= 0x3FFFD) ) //CJK extensions
+	{
+		return LINE_BREAK_ID;
+	}
+	return LINE_BREAK_AL;
+}
+
+/// pair rules of UAX #14, between a character of class before and one of class after
+/// @param afterOpening the last character before the spaces preceding after is an opening punctuation
+static bool isBreakAllowed(LineBreakClass before, LineBreakClass after, bool afterDigit, bool afterOpening)
+{
+	//LB8: break after a zero width space
+	if(before == LINE_BREAK_ZW) return true;
+	//LB7, LB9, LB11, LB12: no break before spaces and marks, no break around glue
+	if(after == LINE_BREAK_SP || after == LINE_BREAK_ZW || after == LINE_BREAK_CM) return false;
+	if(before == LINE_BREAK_GL || after == LINE_BREAK_GL) return false;
+	//LB13: no break before closing punctuation and separators
+	if(after == LINE_BREAK_CL || after == LINE_BREAK_SY) return false;
+	//LB14: no break after opening punctuation, even with spaces in between
+	if(afterOpening) return false;
+	//LB18: break after spaces
+	if(before == LINE_BREAK_SP) return true;
+	//LB21: no break before dashes, break after them
+	if(after == LINE_BREAK_BA || after == LINE_BREAK_HY) return false;
+	if(before == LINE_BREAK_BA) return true;
+	//LB25: keep the sign of numbers and the solidus of fractions with their digits
+	if(before == LINE_BREAK_HY || before == LINE_BREAK_SY) return !afterDigit;
+	//LB31: ideographs break everywhere, the words of the other scripts only at the opportunities above
+	return before == LINE_BREAK_ID || after == LINE_BREAK_ID;
+}
+
+void findLineBreaks(const CodePoint_t* codePoints, uint32_t count, bool* outBreaks)
+{
+	if(count == 0)
+	{
+		return;
+	}
+
+	LineBreakClass before = getLineBreakClass(codePoints[0]);
+	//class of the last character that is not a space
+	LineBreakClass lastNonSpace = before;
+	for(uint32_t i = 1; i < count; ++i)
+	{
+		LineBreakClass after = getLineBreakClass(codePoints[i]);
+		bool afterDigit = (codePoints[i] >= L'0' && codePoints[i] <= L'9');
+		outBreaks[i-1] = isBreakAllowed(before, after, afterDigit, lastNonSpace == LINE_BREAK_OP);
+
+		//LB9: a combining mark takes the class of its base character
+		if(after != LINE_BREAK_CM)
+		{
+			before = after;
+			if(after != LINE_BREAK_SP)
+			{
+				lastNonSpace = after;
+			}
+		}
+	}
+	outBreaks[count-1] = false;
+}
+
+}
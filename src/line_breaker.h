@@ -0,0 +1,48 @@
+/* Copyright 2013 Jeremie Roy. All rights reserved.
+ * License: http://www.opensource.org/licenses/BSD-2-Clause
+*/
+#pragma once
+#include "font_manager.h"
+
+namespace bgfx_font
+{
+
+/// Line breaking classes of UAX #14 (Unicode line breaking algorithm) used to find the break opportunities
+/// @remark only the classes that matter for the common scripts are distinguished, the others are laid out like letters
+enum LineBreakClass
+{
+	/// letters, digits and everything else
+	LINE_BREAK_AL,
+	/// space, a line may break after it
+	LINE_BREAK_SP,
+	/// zero width space, a line may break after it
+	LINE_BREAK_ZW,
+	/// non breaking glue (no-break space, word joiner)
+	LINE_BREAK_GL,
+	/// break after (tab, dashes, breaking spaces other than the space)
+	LINE_BREAK_BA,
+	/// hyphen-minus
+	LINE_BREAK_HY,
+	/// opening punctuation, never separated from what follows
+	LINE_BREAK_OP,
+	/// closing punctuation, exclamation/interrogation, infix separators: never separated from what precedes
+	LINE_BREAK_CL,
+	/// solidus, a line may break after it unless a digit follows
+	LINE_BREAK_SY,
+	/// combining marks, stay with their base character
+	LINE_BREAK_CM,
+	/// ideographs and syllables of the CJK scripts, a line may break around each of them
+	LINE_BREAK_ID,
+};
+
+/// line breaking class of a code point
+LineBreakClass getLineBreakClass(CodePoint_t codePoint);
+
+/// spaces hang at the end of a line: they are not counted in its width when it is wrapped
+inline bool isLineBreakSpace(CodePoint_t codePoint) { return codePoint == L' ' || codePoint == L'\t' || codePoint == 0x3000; }
+
+/// find the break opportunities of a paragraph (a run of code points without line feed)
+/// @param outBreaks receive for each code point if a line may break right after it, the last one is always false
+void findLineBreaks(const CodePoint_t* codePoints, uint32_t count, bool* outBreaks);
+
+}
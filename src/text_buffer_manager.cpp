@@ -2,18 +2,42 @@
  * License: http://www.opensource.org/licenses/BSD-2-Clause
 */
 #include "text_buffer_manager.h"
+#include "text_shaper.h"
+#include "line_breaker.h"
 #include "cube_atlas.h"
+#include "utf8.h"
 
 #include <assert.h>
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
+#include <float.h>
 #include <stddef.h>     /* offsetof */
+#include <new>
+
+#if BGFX_CONFIG_USE_TINYSTL
+#	include <TINYSTL/unordered_map.h>
+#	include <TINYSTL/vector.h>
+namespace stl = tinystl;
+#else
+#	include <unordered_map>
+#	include <vector>
+namespace std { namespace tr1 {} }
+namespace stl {
+	using namespace std;
+	using namespace std::tr1;
+}
+#endif // BGFX_CONFIG_USE_TINYSTL
 
 namespace bgfx_font
 {
 
-const uint16_t MAX_TEXT_BUFFER_COUNT = 64;
+/// maximum number of vertices drawn by a single submit, indices are 16 bits and relative to the first vertex of their draw
+const uint32_t MAX_VERTICES_PER_DRAW = 65536;
+/// every quad is made of 4 vertices and 6 indices, following the pattern of the shared quad index buffer
+const uint32_t MAX_QUADS_PER_DRAW = MAX_VERTICES_PER_DRAW / 4;
+/// the atlas coordinates of the instance records are packed two by two in a float, which holds integers up to 2^24 exactly
+const uint32_t INSTANCE_REGION_PACKING = 4096;
 
 long int fsize(FILE* _file)
 {
@@ -48,52 +72,291 @@ static const bgfx::Memory* loadShader(const char* _shaderPath, const char* _shad
 
 
 
-// Table from Flexible and Economical UTF-8 Decoder
-// Copyright (c) 2008-2009 Bjoern Hoehrmann <bjoern@hoehrmann.de>
-// See http://bjoern.hoehrmann.de/utf-8/decoder/dfa/ for details.
 
-static const uint8_t utf8d[] = {
-  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0, // 00..1f
-  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0, // 20..3f
-  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0, // 40..5f
-  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0, // 60..7f
-  1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9, // 80..9f
-  7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7, // a0..bf
-  8,8,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2, // c0..df
-  0xa,0x3,0x3,0x3,0x3,0x3,0x3,0x3,0x3,0x3,0x3,0x3,0x3,0x4,0x3,0x3, // e0..ef
-  0xb,0x6,0x6,0x6,0x5,0x8,0x8,0x8,0x8,0x8,0x8,0x8,0x8,0x8,0x8,0x8, // f0..ff
-  0x0,0x1,0x2,0x3,0x5,0x8,0x7,0x1,0x1,0x1,0x4,0x6,0x1,0x1,0x1,0x1, // s0..s0
-  1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,0,1,1,1,1,1,0,1,0,1,1,1,1,1,1, // s1..s2
-  1,2,1,1,1,1,1,2,1,2,1,1,1,1,1,1,1,1,1,1,1,1,1,2,1,1,1,1,1,1,1,1, // s3..s4
-  1,2,1,1,1,1,1,1,1,2,1,1,1,1,1,1,1,1,1,1,1,1,1,3,1,3,1,1,1,1,1,1, // s5..s6
-  1,3,1,1,1,1,1,3,1,3,1,1,1,1,1,1,1,3,1,1,1,1,1,1,1,1,1,1,1,1,1,1, // s7..s8
+/// Size classed pool of memory blocks, the blocks of class n are baseSize << n bytes.
+/// Blocks are carved from slabs that go back to the heap only when the pool is destroyed,
+/// so once the slabs are warm, allocating and freeing blocks of the pooled classes doesn't touch the heap.
+class BlockPool
+{
+public:
+	BlockPool(uint32_t baseSize);
+	~BlockPool();
+
+	/// return a block of baseSize << sizeClass bytes
+	uint8_t* allocate(uint32_t sizeClass);
+	/// give a block back to the pool
+	void free(uint8_t* block, uint32_t sizeClass);
+	/// size in bytes of the blocks of a size class
+	uint32_t getBlockSize(uint32_t sizeClass) const { return m_baseSize << sizeClass; }
+
+private:
+	/// number of pooled size classes, bigger blocks are allocated on the heap
+	static const uint32_t POOLED_CLASS_COUNT = 8;
+	/// minimum size of a slab, a slab holds at least one block
+	static const uint32_t SLAB_SIZE = 64 * 1024;
+	/// a slab starts with a link to the previous slab, padded to keep the blocks aligned
+	static const uint32_t SLAB_HEADER_SIZE = 16;
+
+	uint32_t m_baseSize;
+	uint8_t* m_freeBlocks[POOLED_CLASS_COUNT];
+	uint8_t* m_slabs;
 };
 
-#define UTF8_ACCEPT 0
-#define UTF8_REJECT 1
+BlockPool::BlockPool(uint32_t baseSize)
+{
+	m_baseSize = baseSize;
+	memset(m_freeBlocks, 0, sizeof(m_freeBlocks));
+	m_slabs = NULL;
+}
+
+BlockPool::~BlockPool()
+{
+	while(m_slabs != NULL)
+	{
+		uint8_t* slab = m_slabs;
+		m_slabs = *(uint8_t**)slab;
+		delete [] slab;
+	}
+}
+
+uint8_t* BlockPool::allocate(uint32_t sizeClass)
+{
+	if(sizeClass >= POOLED_CLASS_COUNT)
+	{
+		return new uint8_t[m_baseSize << sizeClass];
+	}
+
+	if(m_freeBlocks[sizeClass] == NULL)
+	{
+		uint32_t blockSize = m_baseSize << sizeClass;
+		uint32_t blockCount = SLAB_SIZE / blockSize;
+		if(blockCount == 0)
+		{
+			blockCount = 1;
+		}
+
+		uint8_t* slab = new uint8_t[SLAB_HEADER_SIZE + blockCount * blockSize];
+		*(uint8_t**)slab = m_slabs;
+		m_slabs = slab;
 
-inline uint32_t utf8_decode(uint32_t* state, uint32_t* codep, uint32_t byte) {
-  uint32_t type = utf8d[byte];
+		//thread the blocks of the new slab on the free list
+		for(uint32_t i = 0; i < blockCount; ++i)
+		{
+			uint8_t* block = slab + SLAB_HEADER_SIZE + i * blockSize;
+			*(uint8_t**)block = m_freeBlocks[sizeClass];
+			m_freeBlocks[sizeClass] = block;
+		}
+	}
 
-  *codep = (*state != UTF8_ACCEPT) ?
-    (byte & 0x3fu) | (*codep << 6) :
-    (0xff >> type) & (byte);
+	uint8_t* block = m_freeBlocks[sizeClass];
+	m_freeBlocks[sizeClass] = *(uint8_t**)block;
+	return block;
+}
 
-  *state = utf8d[256 + *state*16 + type];
-  return *state;
+void BlockPool::free(uint8_t* block, uint32_t sizeClass)
+{
+	if(sizeClass >= POOLED_CLASS_COUNT)
+	{
+		delete [] block;
+		return;
+	}
+	*(uint8_t**)block = m_freeBlocks[sizeClass];
+	m_freeBlocks[sizeClass] = block;
 }
 
-inline int utf8_strlen(uint8_t* s, size_t* count) {
-  uint32_t codepoint;
-  uint32_t state = 0;
+/// growable array of plain structs stored in the blocks of a BlockPool, for the records of the text buffers
+/// @remark no block is taken before the first item, the items are moved with memcpy and clear keeps the block
+template<typename T>
+class PooledArray
+{
+public:
+	PooledArray(BlockPool* pool): m_pool(pool), m_items(NULL), m_size(0), m_capacity(0), m_sizeClass(0) {}
+	~PooledArray()
+	{
+		if(m_items != NULL)
+		{
+			m_pool->free((uint8_t*)m_items, m_sizeClass);
+		}
+	}
+
+	uint32_t size() const { return m_size; }
+	bool empty() const { return m_size == 0; }
+	T& operator[](uint32_t index) { assert(index < m_size); return m_items[index]; }
+	const T& operator[](uint32_t index) const { assert(index < m_size); return m_items[index]; }
+	T& back() { return (*this)[m_size - 1]; }
+	const T& back() const { return (*this)[m_size - 1]; }
+
+	void push_back(const T& item)
+	{
+		reserve(m_size + 1);
+		m_items[m_size++] = item;
+	}
+	void pop_back() { --m_size; }
+	/// the items added are not initialized
+	void resize(uint32_t size)
+	{
+		reserve(size);
+		m_size = size;
+	}
+	void clear() { m_size = 0; }
+	/// move count items from src to dst, the ranges may overlap
+	void move(uint32_t dst, uint32_t src, uint32_t count)
+	{
+		assert(dst + count <= m_size && src + count <= m_size);
+		if(count > 0)
+		{
+			memmove(m_items + dst, m_items + src, count * sizeof(T));
+		}
+	}
+	/// exchange the items of two arrays of the same pool, without copy
+	void swap(PooledArray& other)
+	{
+		assert(m_pool == other.m_pool);
+		T* items = m_items; m_items = other.m_items; other.m_items = items;
+		uint32_t size = m_size; m_size = other.m_size; other.m_size = size;
+		uint32_t capacity = m_capacity; m_capacity = other.m_capacity; other.m_capacity = capacity;
+		uint32_t sizeClass = m_sizeClass; m_sizeClass = other.m_sizeClass; other.m_sizeClass = sizeClass;
+	}
+
+	/// grow the block so that it holds at least capacity items
+	void reserve(uint32_t capacity)
+	{
+		if(capacity <= m_capacity)
+		{
+			return;
+		}
+		//capacities double from one size class to the next
+		uint32_t sizeClass = (m_items != NULL) ? m_sizeClass + 1 : 0;
+		while(m_pool->getBlockSize(sizeClass) / sizeof(T) < capacity)
+		{
+			++sizeClass;
+		}
+		T* items = (T*)m_pool->allocate(sizeClass);
+		if(m_items != NULL)
+		{
+			memcpy(items, m_items, m_size * sizeof(T));
+			m_pool->free((uint8_t*)m_items, m_sizeClass);
+		}
+		m_items = items;
+		m_sizeClass = sizeClass;
+		m_capacity = m_pool->getBlockSize(sizeClass) / sizeof(T);
+	}
+
+private:
+	PooledArray(const PooledArray&);
+	PooledArray& operator=(const PooledArray&);
+
+	BlockPool* m_pool;
+	T* m_items;
+	uint32_t m_size;
+	uint32_t m_capacity;
+	uint32_t m_sizeClass;
+};
+
+// ****************************************************************
+
+/// maximum number of code points shaped at once when laying out or measuring text
+static const uint32_t GLYPH_RUN_SIZE = 128;
+/// maximum number of strings kept cut at their break opportunities, the cache is emptied when it is full
+static const uint32_t MAX_BROKEN_TEXTS = 64;
+/// maximum number of string layouts kept for the buffers with layout caching, the least recently used one is evicted when it is full
+static const uint32_t MAX_CACHED_LAYOUTS = 256;
+/// caret of a code point not laid out yet
+static const float INVALID_CARET = -FLT_MAX;
+/// size in bytes of the smallest block of the text, caret, style and line records of a text buffer
+static const uint32_t RECORD_BLOCK_SIZE = 128;
+
+/// length of the head of a full run to shape first: up to its last space so that ligatures and kerning stay within words
+static uint32_t splitRun(const CodePoint_t* run, uint32_t length)
+{
+	for(uint32_t i = length; i > 0; --i)
+	{
+		if(run[i-1] == L' ')
+		{
+			return i;
+		}
+	}
+	return length;
+}
 
-  for (*count = 0; *s; ++s)
-    if (!utf8_decode(&state, &codepoint, *s))
-      *count += 1;
+/// grow the metrics of a line to fit a font, the line is as tall as its tallest font
+static void growLineMetrics(float fontAscender, float fontDescender, float fontLineGap, float& ascender, float& descender, float& lineGap)
+{
+	if( fontAscender > ascender || (fontDescender < descender) )
+	{
+		if( fontAscender > ascender )
+		{
+			ascender = fontAscender;
+		}
+		if( fontDescender < descender )
+		{
+			descender = fontDescender;
+		}
+		lineGap = fontLineGap;
+	}
+}
 
-  return state != UTF8_ACCEPT;
+static void growLineMetrics(const FontInfo& font, float& ascender, float& descender, float& lineGap)
+{
+	growLineMetrics(font.ascender, font.descender, font.lineGap, ascender, descender, lineGap);
 }
 
+/// quad of the open line of a text buffer, its vertical position is resolved once the line metrics are known
+struct LineQuad
+{
+	float x0, x1;
+	// top of the quad from the baseline, unused by the backgrounds and the underlines that follow the line metrics
+	float offsetY;
+	float height;
+	uint32_t rgba;
+	uint16_t regionIndex;
+	// STYLE_NORMAL for a glyph, the decoration otherwise
+	uint8_t style;
+};
+
+/// layout of a string without line feed, relative to the whole pixel left of the pen position it was appended at
+struct CachedLayout
+{
+	stl::vector<CodePoint_t> codePoints;
+	stl::vector<LineQuad> quads;
+	/// caret of each code point
+	stl::vector<float> carets;
+	/// pen position after the string
+	float advance;
+	/// metrics of the line holding only the string
+	float ascender;
+	float descender;
+	float lineGap;
+};
+
+/// a string cut at its break opportunities and shaped once, so that it can be wrapped again at any width
+struct BrokenText
+{
+	/// glyphs between two break opportunities
+	struct Segment
+	{
+		/// index in the string of the first code point of the segment
+		uint32_t firstCodePoint;
+		uint32_t firstGlyph;
+		/// glyphs of the segment, its trailing spaces included
+		uint32_t glyphCount;
+		/// trailing spaces, they hang at the end of a wrapped line
+		uint32_t spaceCount;
+		/// width of the segment without its trailing spaces, and width of the trailing spaces
+		float width;
+		float spaceWidth;
+		/// a line feed follows the segment
+		bool lineFeed;
+	};
+
+	FontHandle fontHandle;
+	stl::vector<CodePoint_t> codePoints;
+	/// glyphs of the whole string, the cluster of a glyph is the index of its first code point in the string
+	stl::vector<ShapedGlyph> glyphs;
+	/// scaled advance of each glyph, kerning included
+	stl::vector<float> advances;
+	stl::vector<Segment> segments;
+};
 
 class TextBuffer
 {
@@ -101,9 +364,15 @@ public:
 	
 	/// TextBuffer is bound to a fontManager for glyph retrieval
 	/// @remark the ownership of the manager is not taken
-	TextBuffer(FontManager* fontManager);
+	/// @param storagePool pool providing the vertex storage, in blocks of getStorageSize() bytes << size class
+	/// @param recordPool pool providing the text, caret, style and line records, in blocks of RECORD_BLOCK_SIZE bytes << size class
+	/// @param instanced store a compact instance record per quad instead of its four vertices
+	TextBuffer(FontManager* fontManager, BlockPool* storagePool, BlockPool* recordPool, bool instanced = false);
 	~TextBuffer();
 
+	/// size in bytes of the storage of the smallest buffer, the instance record of a quad fits in the storage of its vertices
+	static uint32_t getStorageSize() { return INITIAL_QUAD_CAPACITY * 4 * sizeof(TextVertex); }
+
 	void setStyle(uint32_t flags = STYLE_NORMAL) { m_styleFlags = flags; }
 	void setTextColor(uint32_t rgba = 0x000000FF) { m_textColor = toABGR(rgba); }
 	void setBackgroundColor(uint32_t rgba = 0x000000FF) { m_backgroundColor = toABGR(rgba); }
@@ -113,19 +382,80 @@ public:
 	void setStrikeThroughColor(uint32_t rgba = 0x000000FF) { m_strikeThroughColor = toABGR(rgba); }
 	
 	void setPenPosition(float x, float y) { m_penX = x; };// m_penY = y; }
+
+	void setWrapping(TextWrapMode mode, float width) { m_wrapMode = mode; m_wrapWidth = width; }
+	TextWrapMode getWrapMode() const { return m_wrapMode; }
 	
-	/// return the size of the text 
-	//Rectangle measureText(FontHandle fontHandle, const char * _string);
-	//Rectangle measureText(FontHandle fontHandle, const wchar_t * _string);
+	/// append code points to the buffer using current pen position and color
+	void appendText(FontHandle fontHandle, const CodePoint_t* codePoints, uint32_t count);
+
+	/// append a string cut at its break opportunities, wrapping or truncating its lines to the wrap width
+	void appendText(FontHandle fontHandle, const BrokenText& text);
+
+	/// replace the code points [start, end) of the text and lay out the lines they span again, with the current color and style
+	void replaceRange(FontHandle fontHandle, uint32_t start, uint32_t end, const CodePoint_t* codePoints, uint32_t count);
+
+	/// number of code points appended to the buffer
+	uint32_t getTextLength() const { return (uint32_t)m_text.size(); }
+
+	/// record the layout of the text appended to the open line until endLayoutCapture, the text must not contain any line feed
+	void beginLayoutCapture(FontHandle fontHandle);
+	void endLayoutCapture(CachedLayout& outLayout);
+
+	/// append the key of the current style to outKey, and the subpixel pen offset when the font has subpixel variants
+	/// a captured layout can only be appended again with the same key
+	void getLayoutKey(FontHandle fontHandle, stl::vector<uint8_t>& outKey);
+
+	/// append a captured layout at the pen position, with the current style
+	void appendLayout(FontHandle fontHandle, const CachedLayout& layout);
+
+	/// the captured layouts are relative to the whole pixel of the pen with subpixel variants, to the pen itself without
+	float getLayoutOrigin(FontHandle fontHandle) const;
 
-	/// append an ASCII/utf-8 string to the buffer using current pen position and color
-	void appendText(FontHandle fontHandle, const char * _string);
+	/// a laid out line, from one of its code points of the text to the first one of the next line
+	struct LineRecord
+	{
+		uint32_t firstCodePoint;
+		size_t firstVertex;
+		size_t vertexCount;
+		/// top of the line and distance to the top of the next one
+		float top;
+		float height;
+		float baseline;
+		/// pen position at the end of the line
+		float endX;
+	};
+
+	/// number of lines, the last one is open (more text can be appended to it)
+	uint32_t getLineCount() const { return (uint32_t)m_lines.size(); }
+	const LineRecord& getLine(uint32_t index) const { return m_lines[index]; }
+
+	/// index of the code point whose caret is the closest to (x, y), the lines are searched by their top and the code points of the line by their caret
+	/// @remark the caret after the last code point of a line is the one of its line feed, or of its last code point if the line is wrapped
+	/// @remark the open line is measured from the pen and its metrics so far, it is not flushed
+	uint32_t hitTest(float x, float y) const;
 
-	/// append a wide char unicode string to the buffer using current pen position and color
-	void appendText(FontHandle fontHandle, const wchar_t * _string);	
+	/// caret before the code point index (the end of the text if index is the length of the text), as a zero width rectangle spanning its line
+	TextRectangle getCaretRectangle(uint32_t index) const;
+
+	/// forget the text and the vertices of every line but the open one (e.g. once they have been copied elsewhere)
+	/// @remark the layout goes on below the forgotten lines
+	void discardClosedLines();
+
+	/// move the laid out lines, the pen and the origin down by offsetY (up if negative)
+	void offsetText(float offsetY);
+
+	/// first vertex and end of the vertices modified since the last call to clearDirtySpan, the span is empty when first >= end
+	size_t getDirtyFirst() const { return m_dirtyFirst; }
+	size_t getDirtyEnd() const { return m_dirtyEnd; }
+	void clearDirtySpan() { m_dirtyFirst = (size_t)-1; m_dirtyEnd = 0; }
 
 	/// Clear the text buffer and reset its state (pen/color)
 	void clearTextBuffer();
+
+	/// lay out the vertices of the open line, call it before reading the vertices
+	/// @remark the line stays open, appending to it lays it out again at the next flush
+	void flushLine();
 	
 	/// get pointer to the vertex buffer to submit it to the graphic card
 	const uint8_t* getVertexBuffer(){ return (uint8_t*) m_vertexBuffer; }
@@ -133,18 +463,83 @@ public:
 	uint32_t getVertexCount(){ return m_vertexCount; }
 	/// size in bytes of a vertex
 	uint32_t getVertexSize(){ return sizeof(TextVertex); }
-		
-	/// get a pointer to the index buffer to submit it to the graphic
-	const uint16_t* getIndexBuffer(){ return m_indexBuffer; }
-	/// number of index in the index buffer
-	uint32_t getIndexCount(){ return m_indexCount; }
-	/// size in bytes of an index
-	uint32_t getIndexSize(){ return sizeof(uint16_t); }
+
+	/// get a pointer to the instance records of an instanced buffer, one record per quad
+	const uint8_t* getInstanceBuffer(){ return (uint8_t*) m_instanceBuffer; }
+	/// number of instance records
+	uint32_t getInstanceCount(){ return (uint32_t)(m_vertexCount / 4); }
+	/// size in bytes of an instance record
+	uint32_t getInstanceSize(){ return sizeof(GlyphInstance); }
+
 
 	uint32_t getTextColor(){ return toABGR(m_textColor); }
 private:
-	void appendGlyph(CodePoint_t codePoint, const FontInfo& font, const GlyphInfo& glyphInfo);
-	void verticalCenterLastLine(float txtDecalY, float top, float bottom);
+	/// record a code point of the text with its style record and lay it out
+	void pushCodePoint(FontHandle fontHandle, CodePoint_t codePoint, uint32_t style);
+	/// add the code point at index of the text to the pending run, the run is shaped at line breaks or when it is full
+	void layoutCodePoint(FontHandle fontHandle, CodePoint_t codePoint, uint32_t index);
+	/// shape and append the pending run
+	void flushRun(FontHandle fontHandle);
+	/// shape a run of code points at once and append its glyphs
+	/// @param firstCodePoint index in the text of the first code point of the run
+	void appendShapedRun(FontHandle fontHandle, const CodePoint_t* codePoints, uint32_t count, uint32_t firstCodePoint);
+	/// append a glyph with the decorations of the current style
+	/// @param firstCodePoint index in the text of the code point of cluster 0, the caret of the cluster of the glyph is recorded unless it is NO_CODE_POINT
+	void appendGlyph(const ShapedGlyph& shapedGlyph, const FontInfo& font, uint32_t firstCodePoint);
+	/// append glyphs shaped with fontHandle (or its fallback fonts) with the emitter of the current decorations, chosen once for the run
+	void appendGlyphRun(FontHandle fontHandle, const FontInfo& font, const ShapedGlyph* glyphs, uint32_t count, uint32_t firstCodePoint);
+	/// style flags of the decorations to draw, the ones of a transparent color are left out
+	uint32_t getDecorations() const;
+	/// glyph emitter specialized for a combination of decorations, so that the glyph loop only writes the decorations drawn
+	template<uint32_t Decorations>
+	void emitGlyphs(FontHandle fontHandle, const FontInfo& runFont, const ShapedGlyph* glyphs, uint32_t count, uint32_t firstCodePoint);
+	typedef void (TextBuffer::*GlyphEmitter)(FontHandle fontHandle, const FontInfo& runFont, const ShapedGlyph* glyphs, uint32_t count, uint32_t firstCodePoint);
+	/// emitters indexed by the decorations to draw
+	static const GlyphEmitter s_glyphEmitters[];
+	/// add the quad of a decoration below the advance of the glyph at the pen position
+	void addDecorationQuad(uint8_t style, float advance, float offsetY, float height, uint32_t rgba, uint16_t regionIndex);
+	/// append count glyphs of a broken text, breaking the line between two glyphs when they exceed the wrap width
+	/// @param base index in the text of the buffer of the first code point of the broken text
+	void appendGlyphs(const BrokenText& text, uint32_t base, uint32_t firstGlyph, uint32_t count, bool breakGlyphs);
+	/// append the glyphs of a broken text that fit in the wrap width followed by an ellipsis, and skip the others
+	void appendTruncated(FontHandle fontHandle, const BrokenText& text, uint32_t base, uint32_t firstGlyph, uint32_t count);
+	/// reset the origin and the line metrics when the first text is appended
+	void beginText();
+	/// append a quad textured with an atlas region, as four vertices or as an instance record
+	void appendQuad(uint16_t regionIndex, float x0, float y0, float x1, float y1, uint32_t rgba);
+	/// extend the last quad of the decoration on the line when the new one continues it with the same color and height, append a quad otherwise
+	void appendDecoration(uint8_t style, float x0, float y0, float x1, float y1, uint32_t rgba);
+	/// close the open line and open the one starting at the code point nextCodePoint of the text
+	void newLine(uint32_t nextCodePoint);
+	/// copy the layout of the open line in its record
+	void updateLineRecord();
+	/// give the code points from first on that got no caret from a glyph the caret of the next code point of their line, or the end of their line
+	void resolveCarets(uint32_t first);
+	/// index of the last line starting at or before the code point index
+	uint32_t findLine(uint32_t index) const;
+	/// index of the style record matching the current style, a new record is added when the style changed since the last one
+	uint32_t getStyleIndex(FontHandle fontHandle);
+	struct TextStyle;
+	void getCurrentStyle(FontHandle fontHandle, TextStyle& outStyle);
+	/// move vertexCount vertices (or their instance records) from srcVertex to dstVertex
+	void moveQuads(size_t dstVertex, size_t srcVertex, size_t vertexCount);
+	/// move the quads of the vertices [firstVertex, endVertex) by offsetY
+	void offsetQuads(size_t firstVertex, size_t endVertex, float offsetY);
+	void markDirty(size_t firstVertex, size_t endVertex)
+	{
+		m_dirtyFirst = (firstVertex < m_dirtyFirst) ? firstVertex : m_dirtyFirst;
+		m_dirtyEnd = (endVertex > m_dirtyEnd) ? endVertex : m_dirtyEnd;
+	}
+	/// grow the buffers so that they can hold at least quadCount quads
+	void reserveQuads(uint32_t quadCount);
+	/// point the vertex buffer in a storage block
+	void setStorage(uint8_t* storage, uint32_t quadCapacity);
+	/// add a quad to the open line
+	LineQuad& addLineQuad()
+	{
+		m_lineQuads.resize(m_lineQuads.size() + 1);
+		return m_lineQuads.back();
+	}
 	uint32_t toABGR(uint32_t rgba) 
 { 
 	return (((rgba >> 0) & 0xff) << 24) |  
@@ -153,7 +548,14 @@ private:
 		(((rgba >> 24) & 0xff) << 0);   
 }
 
-	static const size_t MAX_BUFFERED_CHARACTERS = 8192;
+	/// number of quads the buffers are allocated for at creation, they grow geometrically from there
+	static const uint32_t INITIAL_QUAD_CAPACITY = 16;
+	/// number of decoration styles, from STYLE_OVERLINE to STYLE_BACKGROUND
+	static const uint32_t DECORATION_COUNT = 4;
+	/// style flags of the decorations
+	static const uint32_t DECORATION_MASK = STYLE_OVERLINE | STYLE_UNDERLINE | STYLE_STRIKE_THROUGH | STYLE_BACKGROUND;
+	static const size_t INVALID_QUAD = (size_t)-1;
+	static const uint32_t NO_CODE_POINT = (uint32_t)-1;
 
 	uint32_t m_styleFlags;
 
@@ -175,16 +577,58 @@ private:
 	float m_lineAscender;
 	float m_lineDescender;
 	float m_lineGap;
+
+	/// font, color and style a code point of the text was appended with
+	struct TextStyle
+	{
+		FontHandle fontHandle;
+		uint32_t flags;
+		uint32_t textColor;
+		uint32_t backgroundColor;
+		uint32_t overlineColor;
+		uint32_t underlineColor;
+		uint32_t strikeThroughColor;
+	};
+
+	// code points appended to the buffer and the index of their style record, to lay their lines out again
+	PooledArray<CodePoint_t> m_text;
+	PooledArray<uint32_t> m_textStyles;
+	PooledArray<TextStyle> m_styles;
+	// pen position before the glyph of each code point of the text, INVALID_CARET until it is laid out, see resolveCarets
+	PooledArray<float> m_caretX;
+	// the last line is the open one
+	PooledArray<LineRecord> m_lines;
+
+	// vertices to upload, see getDirtyFirst
+	size_t m_dirtyFirst;
+	size_t m_dirtyEnd;
+
+	TextWrapMode m_wrapMode;
+	float m_wrapWidth;
+	// the open line ended with an ellipsis, the text is skipped up to the next line feed
+	bool m_truncated;
+
+	// state of the open line when the layout capture began
+	uint32_t m_captureCodePoint;
+	uint32_t m_captureQuad;
+	float m_capturePenX;
+	float m_captureAscender;
+	float m_captureDescender;
+	float m_captureLineGap;
+
+	// code points waiting to be shaped and index in the text of the first one
+	CodePoint_t m_run[GLYPH_RUN_SIZE];
+	uint32_t m_runLength;
+	uint32_t m_runStart;
 	
 	///
 	FontManager* m_fontManager;	
 	
-	void setVertex(size_t i, float scale, float x, float y, uint32_t rgba, uint8_t style = STYLE_NORMAL)
+	void setVertex(size_t i, float x, float y, uint32_t rgba)
 	{
 		m_vertexBuffer[i].x = x;
 		m_vertexBuffer[i].y = y;		
 		m_vertexBuffer[i].rgba = rgba;
-		m_styleBuffer[i] = style;
 	}
 
 	struct TextVertex
@@ -194,13 +638,42 @@ private:
 		uint32_t rgba;		
 	};
 
+	/// quad of the instanced buffers, expanded by vs_font_instanced
+	/// the shader attributes are floats, so the atlas region and the color are packed two by two
+	struct GlyphInstance
+	{
+		float x0,y0,x1,y1;
+		// x + y * INSTANCE_REGION_PACKING and width + height * INSTANCE_REGION_PACKING of the atlas region
+		float regionPosition;
+		float regionSize;
+		// red + green * 256 and blue + alpha * 256 + (face * 4 + component) * 65536
+		float colorLow;
+		float colorHigh;
+	};
+
 	TextVertex* m_vertexBuffer;
-	uint16_t* m_indexBuffer;
-	uint8_t* m_styleBuffer;
+	GlyphInstance* m_instanceBuffer;
+	bool m_instanced;
+
+	// quads of the open line
+	PooledArray<LineQuad> m_lineQuads;
+	// the vertices of the open line are out of date
+	bool m_lineDirty;
 	
+	// 4 per quad, instanced buffers included
 	size_t m_vertexCount;
-	size_t m_indexCount;
 	size_t m_lineStartIndex;	
+	uint32_t m_quadCapacity;
+
+	// first vertex and color of the last quad of each decoration, a quad is only extended on its own line
+	size_t m_lastDecorations[DECORATION_COUNT];
+	uint32_t m_lastDecorationColors[DECORATION_COUNT];
+
+	BlockPool* m_storagePool;
+	BlockPool* m_recordPool;
+	uint8_t* m_storage;
+	// size class of the storage block, the capacity is INITIAL_QUAD_CAPACITY << m_storageClass
+	uint32_t m_storageClass;
 };
 
 
@@ -208,7 +681,8 @@ private:
 
 
 
-TextBuffer::TextBuffer(FontManager* fontManager)
+TextBuffer::TextBuffer(FontManager* fontManager, BlockPool* storagePool, BlockPool* recordPool, bool instanced)
+	: m_text(recordPool), m_textStyles(recordPool), m_styles(recordPool), m_caretX(recordPool), m_lines(recordPool), m_lineQuads(recordPool)
 {		
 	m_styleFlags = STYLE_NORMAL;
 	//0xAABBGGRR
@@ -225,314 +699,2022 @@ TextBuffer::TextBuffer(FontManager* fontManager)
 	m_lineAscender = 0;
 	m_lineDescender = 0;
 	m_lineGap = 0;
+	m_runLength = 0;
+	m_runStart = 0;
+	m_wrapMode = WRAP_NONE;
+	m_wrapWidth = 0;
+	m_truncated = false;
 	m_fontManager = fontManager;	
+	m_instanced = instanced;
 
 	
-	m_vertexBuffer = new TextVertex[MAX_BUFFERED_CHARACTERS * 4];
-	m_indexBuffer = new uint16_t[MAX_BUFFERED_CHARACTERS * 6];
-	m_styleBuffer = new uint8_t[MAX_BUFFERED_CHARACTERS * 4];
+	m_storagePool = storagePool;
+	m_recordPool = recordPool;
+	m_storageClass = 0;
+	setStorage(m_storagePool->allocate(m_storageClass), INITIAL_QUAD_CAPACITY);
 	m_vertexCount = 0;
-	m_indexCount = 0;
 	m_lineStartIndex = 0;
-	
-	
+	for(uint32_t i = 0; i < DECORATION_COUNT; ++i)
+	{
+		m_lastDecorations[i] = INVALID_QUAD;
+	}
+
+	m_lineDirty = false;
+
+	LineRecord line = { 0, 0, 0, m_penY, 0.0f, m_penY, m_penX };
+	m_lines.push_back(line);
+	clearDirtySpan();
 }
 
 TextBuffer::~TextBuffer()
 {
-	delete[] m_vertexBuffer;
-	delete[] m_indexBuffer;
+	m_storagePool->free(m_storage, m_storageClass);
 }
 
-void TextBuffer::appendText(FontHandle fontHandle, const char * _string)
-{	
-	GlyphInfo glyph;
-	const FontInfo& font = m_fontManager->getFontInfo(fontHandle);	
-		
-	if(m_vertexCount == 0)
+void TextBuffer::setStorage(uint8_t* storage, uint32_t quadCapacity)
+{
+	m_storage = storage;
+	m_quadCapacity = quadCapacity;
+	m_vertexBuffer = (TextVertex*) storage;
+	m_instanceBuffer = (GlyphInstance*) storage;
+}
+
+void TextBuffer::reserveQuads(uint32_t quadCount)
+{
+	if(quadCount <= m_quadCapacity)
+	{
+		return;
+	}
+
+	//capacities double from one size class to the next
+	uint32_t storageClass = m_storageClass;
+	while((INITIAL_QUAD_CAPACITY << storageClass) < quadCount)
+	{
+		++storageClass;
+	}
+
+	uint8_t* storage = m_storage;
+
+	//vertices and instance records both start the storage
+	uint32_t quadSize = m_instanced ? sizeof(GlyphInstance) : 4 * sizeof(TextVertex);
+	setStorage(m_storagePool->allocate(storageClass), INITIAL_QUAD_CAPACITY << storageClass);
+	memcpy(m_storage, storage, (m_vertexCount / 4) * quadSize);
+
+	m_storagePool->free(storage, m_storageClass);
+	m_storageClass = storageClass;
+}
+
+void TextBuffer::beginText()
+{
+	//blank glyphs have no quad, only the text tells if something was appended
+	if(m_text.empty())
 	{
 		m_originX = m_penX;
 		m_originY = m_penY;
 		m_lineDescender = 0;// font.descender;
 		m_lineAscender = 0;//font.ascender;
+		m_lineGap = 0;
+		m_lines.back().top = m_penY;
 	}
+}
+
+void TextBuffer::appendText(FontHandle fontHandle, const CodePoint_t* codePoints, uint32_t count)
+{	
+	beginText();
 	
-	uint32_t codepoint;
-	uint32_t state = 0;
+	uint32_t first = (uint32_t)m_text.size();
+	uint32_t style = getStyleIndex(fontHandle);
+	for(uint32_t i = 0; i < count; ++i)
+	{
+		pushCodePoint(fontHandle, codePoints[i], style);
+	}
+	flushRun(fontHandle);
+	resolveCarets(first);
+}
 
-	for (; *_string; ++_string)
-		if (!utf8_decode(&state, &codepoint, *_string))
+void TextBuffer::appendText(FontHandle fontHandle, const BrokenText& text)
+{
+	beginText();
+
+	uint32_t base = (uint32_t)m_text.size();
+	uint32_t style = getStyleIndex(fontHandle);
+	for(uint32_t i = 0, end = (uint32_t)text.codePoints.size(); i < end; ++i)
+	{
+		m_text.push_back(text.codePoints[i]);
+		m_textStyles.push_back(style);
+		m_caretX.push_back(INVALID_CARET);
+	}
+
+	//trailing spaces of the last segment, only appended when the line goes on after them
+	uint32_t spaceGlyph = 0;
+	uint32_t spaceCount = 0;
+	float spaceWidth = 0;
+	uint32_t lineStart = 0;
+	for(uint32_t i = 0, end = (uint32_t)text.segments.size(); i < end; ++i)
+	{
+		const BrokenText::Segment& segment = text.segments[i];
+		if(m_wrapMode == WRAP_WORD)
 		{
-			if(m_fontManager->getGlyphInfo(fontHandle, (CodePoint_t)codepoint, glyph))
+			if(m_penX > m_originX && m_penX + spaceWidth + segment.width > m_originX + m_wrapWidth)
 			{
-				appendGlyph((CodePoint_t)codepoint, font, glyph);
+				newLine(base + segment.firstCodePoint);
 			}else
 			{
-				assert(false && "Glyph not found");
+				appendGlyphs(text, base, spaceGlyph, spaceCount, false);
 			}
+			appendGlyphs(text, base, segment.firstGlyph, segment.glyphCount - segment.spaceCount, segment.width > m_wrapWidth);
+			spaceGlyph = segment.firstGlyph + segment.glyphCount - segment.spaceCount;
+			spaceCount = segment.spaceCount;
+			spaceWidth = segment.spaceWidth;
+		}else if(segment.lineFeed || i + 1 == end)
+		{
+			//the whole line is known, truncate it at once
+			const BrokenText::Segment& first = text.segments[lineStart];
+			appendTruncated(fontHandle, text, base, first.firstGlyph, segment.firstGlyph + segment.glyphCount - first.firstGlyph);
+			lineStart = i + 1;
 		}
-	  //printf("U+%04X\n", codepoint);
 
-	if (state != UTF8_ACCEPT)
-	{
-	//	assert(false && "The string is not well-formed");
-		return; //"The string is not well-formed\n"
+		if(segment.lineFeed)
+		{
+			appendGlyphs(text, base, spaceGlyph, spaceCount, false);
+			spaceCount = 0;
+			spaceWidth = 0;
+			//a line feed is always followed by the segment of the next paragraph
+			newLine(base + text.segments[i+1].firstCodePoint);
+			m_truncated = false;
+		}
 	}
+	//the next string may continue the line
+	appendGlyphs(text, base, spaceGlyph, spaceCount, false);
+	resolveCarets(base);
 }
 
-void TextBuffer::appendText(FontHandle fontHandle, const wchar_t * _string)
-{		
-	GlyphInfo glyph;
-	const FontInfo& font = m_fontManager->getFontInfo(fontHandle);	
-	
-	if(m_vertexCount == 0)
+void TextBuffer::appendGlyphs(const BrokenText& text, uint32_t base, uint32_t firstGlyph, uint32_t count, bool breakGlyphs)
+{
+	if(!breakGlyphs)
 	{
-		m_originX = m_penX;
-		m_originY = m_penY;
-		m_lineDescender = 0;// font.descender;
-		m_lineAscender = 0;//font.ascender;
-		m_lineGap = 0;
+		if(count > 0)
+		{
+			appendGlyphRun(text.fontHandle, m_fontManager->getFontInfo(text.fontHandle), &text.glyphs[firstGlyph], count, base);
+		}
+		return;
 	}
 
-	//parse string
-	for( size_t i=0, end = wcslen(_string) ; i < end; ++i )
+	for(uint32_t i = firstGlyph, end = firstGlyph + count; i < end; ++i)
 	{
-		//if glyph cached, continue
-		uint32_t codePoint = _string[i];
-		if(m_fontManager->getGlyphInfo(fontHandle, codePoint, glyph))
-		{
-			appendGlyph(codePoint, font, glyph);
-		}else
+		if(m_penX > m_originX && m_penX + text.advances[i] > m_originX + m_wrapWidth)
 		{
-			assert(false && "Glyph not found");
+			newLine(base + text.glyphs[i].cluster);
 		}
+		const ShapedGlyph& glyph = text.glyphs[i];
+		appendGlyph(glyph, m_fontManager->getFontInfo(glyph.fontHandle), base);
 	}
 }
-/*
-TextBuffer::Rectangle TextBuffer::measureText(FontHandle fontHandle, const char * _string)
-{	
-}
 
-TextBuffer::Rectangle TextBuffer::measureText(FontHandle fontHandle, const wchar_t * _string)
+void TextBuffer::appendTruncated(FontHandle fontHandle, const BrokenText& text, uint32_t base, uint32_t firstGlyph, uint32_t count)
 {
-}
-*/
+	if(m_truncated)
+	{
+		return;
+	}
 
-void TextBuffer::clearTextBuffer()
-{
-	m_vertexCount = 0;
-	m_indexCount = 0;
-	m_lineStartIndex = 0;
-	m_lineAscender = 0;
-	m_lineDescender = 0;
+	//the trailing spaces don't need to fit
+	uint32_t end = firstGlyph + count;
+	float width = 0;
+	float lineWidth = 0;
+	for(uint32_t i = firstGlyph; i < end; ++i)
+	{
+		width += text.advances[i];
+		if(!isLineBreakSpace(text.codePoints[text.glyphs[i].cluster]))
+		{
+			lineWidth = width;
+		}
+	}
+	float maxX = m_originX + m_wrapWidth;
+	if(m_penX + lineWidth <= maxX)
+	{
+		appendGlyphs(text, base, firstGlyph, count, false);
+		return;
+	}
+
+	//U+2026 horizontal ellipsis, or three full stops when the font doesn't have it
+	ShapedGlyph ellipsis[3];
+	uint32_t ellipsisCount;
+	CodePoint_t codePoints[3] = { 0x2026, L'.', L'.' };
+	const ShapedGlyph* glyphs = m_fontManager->shapeText(fontHandle, 0, codePoints, 1, ellipsisCount, true);
+	if(ellipsisCount == 0 || glyphs[0].glyphIndex == 0)
+	{
+		codePoints[0] = L'.';
+		glyphs = m_fontManager->shapeText(fontHandle, 0, codePoints, 3, ellipsisCount, true);
+	}
+	ellipsisCount = (ellipsisCount < 3) ? ellipsisCount : 3;
+	float ellipsisWidth = 0;
+	for(uint32_t i = 0; i < ellipsisCount; ++i)
+	{
+		ellipsis[i] = glyphs[i];
+		ellipsisWidth += ellipsis[i].advance_x * m_fontManager->getFontInfo(ellipsis[i].fontHandle).scale;
+	}
+
+	for(uint32_t i = firstGlyph; i < end && m_penX + text.advances[i] + ellipsisWidth <= maxX; ++i)
+	{
+		const ShapedGlyph& glyph = text.glyphs[i];
+		appendGlyph(glyph, m_fontManager->getFontInfo(glyph.fontHandle), base);
+	}
+	if(m_penX + ellipsisWidth <= maxX)
+	{
+		//the ellipsis stands for the code points skipped, they take the caret of the end of the line
+		for(uint32_t i = 0; i < ellipsisCount; ++i)
+		{
+			appendGlyph(ellipsis[i], m_fontManager->getFontInfo(ellipsis[i].fontHandle), NO_CODE_POINT);
+		}
+	}
+	m_truncated = true;
 }
 
-void TextBuffer::appendGlyph(CodePoint_t codePoint, const FontInfo& font, const GlyphInfo& glyphInfo)
-{	
-	//handle newlines
-	if(codePoint == L'\n' )
-    {
-        m_penX = m_originX;
-        m_penY -= m_lineDescender;
-		m_penY += m_lineGap;
-		m_lineDescender = 0;
-		m_lineAscender = 0;
-        m_lineStartIndex = m_vertexCount;
+void TextBuffer::replaceRange(FontHandle fontHandle, uint32_t start, uint32_t end, const CodePoint_t* codePoints, uint32_t count)
+{
+	assert(m_wrapMode == WRAP_NONE && "The lines of wrapped buffers can't be laid out again");
+	assert(start <= end && end <= m_text.size());
+	if(m_wrapMode != WRAP_NONE)
+	{
+		//rejected, the buffer is left untouched
 		return;
-    }
-	
-	if( font.ascender > m_lineAscender || (font.descender < m_lineDescender) )
-    {
-		if( font.descender < m_lineDescender )
+	}
+	flushLine();
+	updateLineRecord();
+
+	//lines spanned by the range, the line following a removed line feed is joined to the range
+	uint32_t firstLine = 0;
+	uint32_t lastLine = 0;
+	for(uint32_t i = 1, lineCount = (uint32_t)m_lines.size(); i < lineCount && m_lines[i].firstCodePoint <= end; ++i)
+	{
+		if(m_lines[i].firstCodePoint <= start)
 		{
-			m_lineDescender = font.descender;
-			m_lineGap = font.lineGap;
+			firstLine = i;
 		}
-				
-		float txtDecals = (font.ascender - m_lineAscender);
-		m_lineAscender = font.ascender;
-		m_lineGap = font.lineGap;		
-				
-		m_penY += txtDecals;
-		verticalCenterLastLine((txtDecals), (m_penY - m_lineAscender), (m_penY - m_lineDescender+m_lineGap));		
-    }
-			
-	//handle kerning
-	float kerning = 0;
-	/*	
-    if( previous && markup->font->kerning )
-    {
-        kerning = texture_glyph_get_kerning( glyph, previous );
-    }
-	*/
-	m_penX += kerning * font.scale;
-
-	GlyphInfo& blackGlyph = m_fontManager->getBlackGlyph();
-	
-	if( m_styleFlags & STYLE_BACKGROUND && m_backgroundColor & 0xFF000000)
-	{
-		float x0 = ( m_penX - kerning );
-		float y0 = ( m_penY  - m_lineAscender);
-		float x1 = ( (float)x0 + (glyphInfo.advance_x));
-		float y1 = ( m_penY - m_lineDescender + m_lineGap );
+		lastLine = i;
+	}
 
-		m_fontManager->getAtlas()->packUV(blackGlyph.regionIndex, (uint8_t*)m_vertexBuffer,sizeof(TextVertex) *m_vertexCount + offsetof(TextVertex, u), sizeof(TextVertex));
+	//splice the text, the new code points take the current style
+	uint32_t style = getStyleIndex(fontHandle);
+	uint32_t oldLength = (uint32_t)m_text.size();
+	uint32_t newLength = oldLength - (end - start) + count;
+	if(newLength > oldLength)
+	{
+		m_text.resize(newLength);
+		m_textStyles.resize(newLength);
+		m_caretX.resize(newLength);
+	}
+	if(oldLength > end)
+	{
+		memmove(&m_text[start + count], &m_text[end], (oldLength - end) * sizeof(CodePoint_t));
+		memmove(&m_textStyles[start + count], &m_textStyles[end], (oldLength - end) * sizeof(uint32_t));
+		memmove(&m_caretX[start + count], &m_caretX[end], (oldLength - end) * sizeof(float));
+	}
+	for(uint32_t i = 0; i < count; ++i)
+	{
+		m_text[start + i] = codePoints[i];
+		m_textStyles[start + i] = style;
+	}
+	if(newLength < oldLength)
+	{
+		m_text.resize(newLength);
+		m_textStyles.resize(newLength);
+		m_caretX.resize(newLength);
+	}
 
-		setVertex(m_vertexCount+0, font.scale, x0, y0, m_backgroundColor,STYLE_BACKGROUND);
-		setVertex(m_vertexCount+1, font.scale, x0, y1, m_backgroundColor,STYLE_BACKGROUND);
-		setVertex(m_vertexCount+2, font.scale, x1, y1, m_backgroundColor,STYLE_BACKGROUND);
-		setVertex(m_vertexCount+3, font.scale, x1, y0, m_backgroundColor,STYLE_BACKGROUND);
+	//the lines following the range keep their layout, they are only moved
+	uint32_t lineCount = (uint32_t)m_lines.size();
+	bool hasTail = (lastLine + 1 < lineCount);
+	int32_t codePointDelta = (int32_t)newLength - (int32_t)oldLength;
+	uint32_t rangeFirst = m_lines[firstLine].firstCodePoint;
+	uint32_t rangeEnd = hasTail ? m_lines[lastLine+1].firstCodePoint + codePointDelta : newLength;
+	size_t firstVertex = m_lines[firstLine].firstVertex;
+	size_t oldRangeEnd = hasTail ? m_lines[lastLine+1].firstVertex : m_vertexCount;
+	size_t oldVertexCount = m_vertexCount;
+	float tailTop = hasTail ? m_lines[lastLine+1].top : 0.0f;
+
+	//the state of the open line is restored when it follows the range, its quads are set aside without copy
+	PooledArray<LineQuad> openQuads(m_recordPool);
+	if(hasTail)
+	{
+		openQuads.swap(m_lineQuads);
+	}
+	float penX = m_penX;
+	float penY = m_penY;
+	float lineAscender = m_lineAscender;
+	float lineDescender = m_lineDescender;
+	float lineGap = m_lineGap;
+	size_t lineStartIndex = m_lineStartIndex;
+	bool lineDirty = m_lineDirty;
+	size_t dirtyFirst = m_dirtyFirst;
+	size_t dirtyEnd = m_dirtyEnd;
+	TextStyle currentStyle = m_styles[style];
+
+	//lay the range out after the last line and the last vertex, then move it in place
+	LineRecord rangeLine = m_lines[firstLine];
+	rangeLine.firstVertex = oldVertexCount;
+	m_lines.push_back(rangeLine);
+	m_penX = m_originX;
+	m_penY = rangeLine.top;
+	m_lineAscender = 0;
+	m_lineDescender = 0;
+	m_lineGap = 0;
+	m_lineStartIndex = oldVertexCount;
+	m_lineQuads.clear();
+	m_lineDirty = false;
 
-		m_indexBuffer[m_indexCount + 0] = m_vertexCount+0;
-		m_indexBuffer[m_indexCount + 1] = m_vertexCount+1;
-		m_indexBuffer[m_indexCount + 2] = m_vertexCount+2;
-		m_indexBuffer[m_indexCount + 3] = m_vertexCount+0;
-		m_indexBuffer[m_indexCount + 4] = m_vertexCount+2;
-		m_indexBuffer[m_indexCount + 5] = m_vertexCount+3;
-		m_vertexCount += 4;
-		m_indexCount += 6;
+	for(uint32_t i = rangeFirst; i < rangeEnd; ++i)
+	{
+		m_caretX[i] = INVALID_CARET;
 	}
-	
-	if( m_styleFlags & STYLE_UNDERLINE && m_underlineColor & 0xFF000000)
+	uint32_t appliedStyle = (uint32_t)-1;
+	FontHandle runFont = fontHandle;
+	for(uint32_t i = rangeFirst; i < rangeEnd; ++i)
 	{
-		float x0 = ( m_penX - kerning );
-		float y0 = (m_penY - m_lineDescender/2 );
-		float x1 = ( (float)x0 + (glyphInfo.advance_x));
-		float y1 = y0+font.underline_thickness;
-
-		m_fontManager->getAtlas()->packUV(blackGlyph.regionIndex, (uint8_t*)m_vertexBuffer,sizeof(TextVertex) *m_vertexCount + offsetof(TextVertex, u), sizeof(TextVertex));
+		//the glyphs of a run are appended with the same style
+		if(m_textStyles[i] != appliedStyle)
+		{
+			flushRun(runFont);
+			appliedStyle = m_textStyles[i];
+			const TextStyle& textStyle = m_styles[appliedStyle];
+			runFont = textStyle.fontHandle;
+			m_styleFlags = textStyle.flags;
+			m_textColor = textStyle.textColor;
+			m_backgroundColor = textStyle.backgroundColor;
+			m_overlineColor = textStyle.overlineColor;
+			m_underlineColor = textStyle.underlineColor;
+			m_strikeThroughColor = textStyle.strikeThroughColor;
+		}
+		layoutCodePoint(runFont, m_text[i], i);
+	}
+	flushRun(runFont);
+	flushLine();
+	updateLineRecord();
+
+	m_styleFlags = currentStyle.flags;
+	m_textColor = currentStyle.textColor;
+	m_backgroundColor = currentStyle.backgroundColor;
+	m_overlineColor = currentStyle.overlineColor;
+	m_underlineColor = currentStyle.underlineColor;
+	m_strikeThroughColor = currentStyle.strikeThroughColor;
+	m_dirtyFirst = dirtyFirst;
+	m_dirtyEnd = dirtyEnd;
+
+	size_t rangeVertexCount = m_vertexCount - oldVertexCount;
+	size_t oldRangeVertexCount = oldRangeEnd - firstVertex;
+	size_t tailVertexCount = oldVertexCount - oldRangeEnd;
+	//the range ends with the line feed opening the first line of the tail, it is laid out again from its record
+	float offsetY = 0;
+	if(hasTail)
+	{
+		offsetY = m_lines.back().top - tailTop;
+		m_lines.pop_back();
+	}
+	uint32_t rangeLineCount = (uint32_t)m_lines.size() - lineCount;
+	uint32_t oldRangeLineCount = lastLine + 1 - firstLine;
+	uint32_t tailLineCount = lineCount - lastLine - 1;
+	for(uint32_t i = lineCount, end = (uint32_t)m_lines.size(); i < end; ++i)
+	{
+		m_lines[i].firstVertex = m_lines[i].firstVertex - oldVertexCount + firstVertex;
+	}
 
-		setVertex(m_vertexCount+0, font.scale, x0, y0, m_underlineColor,STYLE_UNDERLINE);
-		setVertex(m_vertexCount+1, font.scale, x0, y1, m_underlineColor,STYLE_UNDERLINE);
-		setVertex(m_vertexCount+2, font.scale, x1, y1, m_underlineColor,STYLE_UNDERLINE);
-		setVertex(m_vertexCount+3, font.scale, x1, y0, m_underlineColor,STYLE_UNDERLINE);
+	//move the line records of the range in place, the ones of the tail only move when the number of lines changed
+	if(rangeLineCount != oldRangeLineCount)
+	{
+		//the tail is set aside after the range, then both are moved down
+		m_lines.resize(lineCount + rangeLineCount + tailLineCount);
+		m_lines.move(lineCount + rangeLineCount, lastLine + 1, tailLineCount);
+		m_lines.move(firstLine, lineCount, rangeLineCount + tailLineCount);
+	}else
+	{
+		m_lines.move(firstLine, lineCount, rangeLineCount);
+	}
+	m_lines.resize(firstLine + rangeLineCount + tailLineCount);
 
-		m_indexBuffer[m_indexCount + 0] = m_vertexCount+0;
-		m_indexBuffer[m_indexCount + 1] = m_vertexCount+1;
-		m_indexBuffer[m_indexCount + 2] = m_vertexCount+2;
-		m_indexBuffer[m_indexCount + 3] = m_vertexCount+0;
-		m_indexBuffer[m_indexCount + 4] = m_vertexCount+2;
-		m_indexBuffer[m_indexCount + 5] = m_vertexCount+3;
-		m_vertexCount += 4;
-		m_indexCount += 6;
+	//same for the quads, the tail moves over the end of the range laid out when the range grew
+	if(rangeVertexCount == oldRangeVertexCount)
+	{
+		moveQuads(firstVertex, oldVertexCount, rangeVertexCount);
+	}else
+	{
+		size_t rangeVertex = oldVertexCount;
+		if(rangeVertexCount > oldRangeVertexCount)
+		{
+			size_t growth = rangeVertexCount - oldRangeVertexCount;
+			reserveQuads((uint32_t)((m_vertexCount + growth) / 4));
+			moveQuads(rangeVertex + growth, rangeVertex, rangeVertexCount);
+			rangeVertex += growth;
+		}
+		moveQuads(firstVertex + rangeVertexCount, oldRangeEnd, tailVertexCount);
+		moveQuads(firstVertex, rangeVertex, rangeVertexCount);
 	}
-	
-	if( m_styleFlags & STYLE_OVERLINE && m_overlineColor & 0xFF000000)
+	size_t vertexDelta = firstVertex + rangeVertexCount - oldRangeEnd;
+	m_vertexCount = firstVertex + rangeVertexCount + tailVertexCount;
+	if(offsetY != 0)
 	{
-		float x0 = ( m_penX - kerning );
-		float y0 = (m_penY - font.ascender );
-		float x1 = ( (float)x0 + (glyphInfo.advance_x));
-		float y1 = y0+font.underline_thickness;
+		offsetQuads(firstVertex + rangeVertexCount, m_vertexCount, offsetY);
+	}
+	markDirty(firstVertex, (rangeVertexCount == oldRangeVertexCount && offsetY == 0) ? firstVertex + rangeVertexCount : m_vertexCount);
 
-		m_fontManager->getAtlas()->packUV(blackGlyph.regionIndex, (uint8_t*)m_vertexBuffer,sizeof(TextVertex) *m_vertexCount + offsetof(TextVertex, u), sizeof(TextVertex));
+	//the records of the tail are only updated when its text, vertices or position moved
+	if(codePointDelta != 0 || vertexDelta != 0 || offsetY != 0)
+	{
+		for(uint32_t i = firstLine + rangeLineCount, end = (uint32_t)m_lines.size(); i < end; ++i)
+		{
+			LineRecord& line = m_lines[i];
+			line.firstCodePoint += codePointDelta;
+			line.firstVertex += vertexDelta;
+			line.top += offsetY;
+			line.baseline += offsetY;
+		}
+	}
+
+	if(hasTail)
+	{
+		//the open line is the last of the tail
+		m_lineQuads.swap(openQuads);
+		m_penX = penX;
+		m_penY = penY + offsetY;
+		m_lineAscender = lineAscender;
+		m_lineDescender = lineDescender;
+		m_lineGap = lineGap;
+		m_lineStartIndex = lineStartIndex + vertexDelta;
+		m_lineDirty = lineDirty;
+	}else
+	{
+		m_lineStartIndex = m_lineStartIndex - oldVertexCount + firstVertex;
+	}
+	for(uint32_t i = 0; i < DECORATION_COUNT; ++i)
+	{
+		m_lastDecorations[i] = INVALID_QUAD;
+	}
+	resolveCarets(rangeFirst);
+}
+
+void TextBuffer::discardClosedLines()
+{
+	if(m_lines.size() < 2)
+	{
+		return;
+	}
+
+	LineRecord line = m_lines.back();
+	size_t firstVertex = m_lineStartIndex;
+	moveQuads(0, firstVertex, m_vertexCount - firstVertex);
+	m_vertexCount -= firstVertex;
+	m_lineStartIndex = 0;
+
+	uint32_t textLength = (uint32_t)m_text.size() - line.firstCodePoint;
+	//the styles before the first one of the open line are not referenced anymore
+	uint32_t firstStyle = (uint32_t)m_styles.size();
+	for(uint32_t i = 0; i < textLength; ++i)
+	{
+		uint32_t style = m_textStyles[line.firstCodePoint + i];
+		m_text[i] = m_text[line.firstCodePoint + i];
+		m_textStyles[i] = style;
+		m_caretX[i] = m_caretX[line.firstCodePoint + i];
+		firstStyle = (style < firstStyle) ? style : firstStyle;
+	}
+	m_text.resize(textLength);
+	m_textStyles.resize(textLength);
+	m_caretX.resize(textLength);
+	if(textLength == 0)
+	{
+		m_styles.clear();
+	}else if(firstStyle > 0)
+	{
+		uint32_t styleCount = (uint32_t)m_styles.size() - firstStyle;
+		memmove(&m_styles[0], &m_styles[firstStyle], styleCount * sizeof(TextStyle));
+		m_styles.resize(styleCount);
+		for(uint32_t i = 0; i < textLength; ++i)
+		{
+			m_textStyles[i] -= firstStyle;
+		}
+	}
+
+	line.firstCodePoint = 0;
+	line.firstVertex = 0;
+	m_lines.clear();
+	m_lines.push_back(line);
+
+	for(uint32_t i = 0; i < DECORATION_COUNT; ++i)
+	{
+		m_lastDecorations[i] = INVALID_QUAD;
+	}
+	clearDirtySpan();
+	markDirty(0, m_vertexCount);
+}
+
+void TextBuffer::offsetText(float offsetY)
+{
+	m_penY += offsetY;
+	m_originY += offsetY;
+	for(uint32_t i = 0, count = m_lines.size(); i < count; ++i)
+	{
+		m_lines[i].top += offsetY;
+		m_lines[i].baseline += offsetY;
+	}
+	//the quads of the open line are relative to its baseline, only the flushed vertices are moved
+	offsetQuads(0, m_vertexCount, offsetY);
+	markDirty(0, m_vertexCount);
+}
+
+void TextBuffer::moveQuads(size_t dstVertex, size_t srcVertex, size_t vertexCount)
+{
+	if(dstVertex == srcVertex || vertexCount == 0)
+	{
+		return;
+	}
+	size_t quadSize = m_instanced ? sizeof(GlyphInstance) : 4 * sizeof(TextVertex);
+	memmove(m_storage + dstVertex / 4 * quadSize, m_storage + srcVertex / 4 * quadSize, vertexCount / 4 * quadSize);
+}
+
+void TextBuffer::offsetQuads(size_t firstVertex, size_t endVertex, float offsetY)
+{
+	if(m_instanced)
+	{
+		for(size_t i = firstVertex / 4; i < endVertex / 4; ++i)
+		{
+			m_instanceBuffer[i].y0 += offsetY;
+			m_instanceBuffer[i].y1 += offsetY;
+		}
+	}else
+	{
+		for(size_t i = firstVertex; i < endVertex; ++i)
+		{
+			m_vertexBuffer[i].y += offsetY;
+		}
+	}
+}
+
+void TextBuffer::pushCodePoint(FontHandle fontHandle, CodePoint_t codePoint, uint32_t style)
+{
+	uint32_t index = (uint32_t)m_text.size();
+	m_text.push_back(codePoint);
+	m_textStyles.push_back(style);
+	m_caretX.push_back(INVALID_CARET);
+	layoutCodePoint(fontHandle, codePoint, index);
+}
+
+void TextBuffer::layoutCodePoint(FontHandle fontHandle, CodePoint_t codePoint, uint32_t index)
+{
+	//runs never contain line breaks, the shaper lays out a single line
+	if(codePoint == L'\n')
+	{
+		flushRun(fontHandle);
+		newLine(index + 1);
+		return;
+	}
+
+	if(m_runLength == GLYPH_RUN_SIZE)
+	{
+		uint32_t split = splitRun(m_run, m_runLength);
+		appendShapedRun(fontHandle, m_run, split, m_runStart);
+		memmove(m_run, m_run + split, (m_runLength - split) * sizeof(CodePoint_t));
+		m_runLength -= split;
+		m_runStart += split;
+	}
+	if(m_runLength == 0)
+	{
+		m_runStart = index;
+	}
+	m_run[m_runLength++] = codePoint;
+}
+
+void TextBuffer::flushRun(FontHandle fontHandle)
+{
+	appendShapedRun(fontHandle, m_run, m_runLength, m_runStart);
+	m_runLength = 0;
+}
+
+void TextBuffer::appendShapedRun(FontHandle fontHandle, const CodePoint_t* codePoints, uint32_t count, uint32_t firstCodePoint)
+{
+	if(count == 0)
+	{
+		return;
+	}
+
+	uint32_t glyphCount;
+	const ShapedGlyph* glyphs = m_fontManager->shapeText(fontHandle, 0, codePoints, count, glyphCount, true);
+	appendGlyphRun(fontHandle, m_fontManager->getFontInfo(fontHandle), glyphs, glyphCount, firstCodePoint);
+}
+
+void TextBuffer::clearTextBuffer()
+{
+	//the text is laid out again from where it started
+	m_penX = m_originX;
+	m_penY = m_originY;
+	m_vertexCount = 0;
+	m_lineStartIndex = 0;
+	for(uint32_t i = 0; i < DECORATION_COUNT; ++i)
+	{
+		m_lastDecorations[i] = INVALID_QUAD;
+	}
+	m_lineAscender = 0;
+	m_lineDescender = 0;
+	m_lineGap = 0;
+	m_lineQuads.clear();
+	m_lineDirty = false;
+	m_runLength = 0;
+	m_truncated = false;
+	m_text.clear();
+	m_textStyles.clear();
+	m_styles.clear();
+	m_caretX.clear();
+	m_lines.clear();
+	LineRecord line = { 0, 0, 0, m_penY, 0.0f, m_penY, m_penX };
+	m_lines.push_back(line);
+}
+
+void TextBuffer::newLine(uint32_t nextCodePoint)
+{
+	flushLine();
+	updateLineRecord();
+	//the pen is at the top of the line until its baseline is known
+	m_penX = m_originX;
+	m_penY += m_lineAscender - m_lineDescender + m_lineGap;
+	m_lineDescender = 0;
+	m_lineAscender = 0;
+	m_lineGap = 0;
+	m_lineStartIndex = m_vertexCount;
+	m_lineQuads.clear();
+
+	LineRecord line = { nextCodePoint, m_vertexCount, 0, m_penY, 0.0f, m_penY, m_penX };
+	m_lines.push_back(line);
+}
+
+void TextBuffer::updateLineRecord()
+{
+	LineRecord& line = m_lines.back();
+	line.firstVertex = m_lineStartIndex;
+	line.vertexCount = m_vertexCount - m_lineStartIndex;
+	line.top = m_penY;
+	line.height = m_lineAscender - m_lineDescender + m_lineGap;
+	line.baseline = m_penY + m_lineAscender;
+	line.endX = m_penX;
+}
+
+void TextBuffer::resolveCarets(uint32_t first)
+{
+	uint32_t textLength = (uint32_t)m_text.size();
+	uint32_t lineCount = (uint32_t)m_lines.size();
+	uint32_t line = findLine(first);
+	uint32_t i = first;
+	while(i < textLength)
+	{
+		if(m_caretX[i] != INVALID_CARET)
+		{
+			++i;
+			continue;
+		}
+		//code points without glyph: line feeds, spaces hanging at a wrap, code points of a ligature or skipped by an ellipsis
+		while(line + 1 < lineCount && m_lines[line + 1].firstCodePoint <= i)
+		{
+			++line;
+		}
+		uint32_t lineEnd = (line + 1 < lineCount) ? m_lines[line + 1].firstCodePoint : textLength;
+		uint32_t next = i + 1;
+		while(next < lineEnd && m_caretX[next] == INVALID_CARET)
+		{
+			++next;
+		}
+		//the record of the open line is only updated when it is flushed
+		float x = (next < lineEnd) ? m_caretX[next] : ((line + 1 < lineCount) ? m_lines[line].endX : m_penX);
+		for(; i < next; ++i)
+		{
+			m_caretX[i] = x;
+		}
+	}
+}
+
+uint32_t TextBuffer::findLine(uint32_t index) const
+{
+	uint32_t first = 0;
+	uint32_t count = (uint32_t)m_lines.size();
+	while(count > 1)
+	{
+		uint32_t half = count / 2;
+		if(m_lines[first + half].firstCodePoint <= index)
+		{
+			first += half;
+			count -= half;
+		}else
+		{
+			count = half;
+		}
+	}
+	return first;
+}
+
+uint32_t TextBuffer::hitTest(float x, float y) const
+{
+	//last line whose top is above y, the first one when y is above the text
+	//the record of the open line is only updated when it is flushed, its top is the one of the pen
+	uint32_t line = 0;
+	uint32_t lineCount = (uint32_t)m_lines.size();
+	uint32_t count = lineCount;
+	while(count > 1)
+	{
+		uint32_t half = count / 2;
+		float top = (line + half + 1 < lineCount) ? m_lines[line + half].top : m_penY;
+		if(top <= y)
+		{
+			line += half;
+			count -= half;
+		}else
+		{
+			count = half;
+		}
+	}
+
+	//the caret of the last code point of a closed line is at its end (line feed or space of the wrap), the one of the open line is after the text
+	uint32_t first = m_lines[line].firstCodePoint;
+	uint32_t last = (line + 1 < m_lines.size()) ? m_lines[line + 1].firstCodePoint - 1 : (uint32_t)m_text.size();
+	if(last < first)
+	{
+		return first;
+	}
+
+	//first caret right of x, the carets of a line don't decrease
+	uint32_t index = first;
+	count = last - first + 1;
+	while(count > 0)
+	{
+		uint32_t half = count / 2;
+		float caret = (index + half < m_text.size()) ? m_caretX[index + half] : m_penX;
+		if(caret <= x)
+		{
+			index += half + 1;
+			count -= half + 1;
+		}else
+		{
+			count = half;
+		}
+	}
+	if(index == first)
+	{
+		return first;
+	}
+	if(index > last)
+	{
+		return last;
+	}
+	//the closest of the carets around x
+	float left = m_caretX[index - 1];
+	float right = (index < m_text.size()) ? m_caretX[index] : m_penX;
+	return (x - left < right - x) ? index - 1 : index;
+}
+
+TextRectangle TextBuffer::getCaretRectangle(uint32_t index) const
+{
+	assert(index <= m_text.size());
+	uint32_t line = findLine(index);
+	TextRectangle caret;
+	caret.x = (index < m_text.size()) ? m_caretX[index] : m_penX;
+	caret.width = 0;
+	if(line + 1 < m_lines.size())
+	{
+		caret.y = m_lines[line].top;
+		caret.height = m_lines[line].height;
+	}else
+	{
+		//the open line, as measured so far
+		caret.y = m_penY;
+		caret.height = m_lineAscender - m_lineDescender + m_lineGap;
+	}
+	return caret;
+}
+
+void TextBuffer::getCurrentStyle(FontHandle fontHandle, TextStyle& outStyle)
+{
+	//the padding is cleared so that the styles can be compared and hashed as bytes
+	memset(&outStyle, 0, sizeof(outStyle));
+	outStyle.fontHandle = fontHandle;
+	outStyle.flags = m_styleFlags;
+	outStyle.textColor = m_textColor;
+	outStyle.backgroundColor = m_backgroundColor;
+	outStyle.overlineColor = m_overlineColor;
+	outStyle.underlineColor = m_underlineColor;
+	outStyle.strikeThroughColor = m_strikeThroughColor;
+}
+
+uint32_t TextBuffer::getStyleIndex(FontHandle fontHandle)
+{
+	TextStyle style;
+	getCurrentStyle(fontHandle, style);
+	if(m_styles.empty() || memcmp(&m_styles.back(), &style, sizeof(style)) != 0)
+	{
+		m_styles.push_back(style);
+	}
+	return (uint32_t)m_styles.size() - 1;
+}
+
+void TextBuffer::beginLayoutCapture(FontHandle fontHandle)
+{
+	beginText();
+	m_captureCodePoint = (uint32_t)m_text.size();
+	m_captureQuad = m_lineQuads.size();
+	m_capturePenX = getLayoutOrigin(fontHandle);
+	//the string is measured on its own, its metrics are merged with the ones of the line at the end
+	m_captureAscender = m_lineAscender;
+	m_captureDescender = m_lineDescender;
+	m_captureLineGap = m_lineGap;
+	m_lineAscender = 0;
+	m_lineDescender = 0;
+	m_lineGap = 0;
+}
+
+void TextBuffer::endLayoutCapture(CachedLayout& outLayout)
+{
+	uint32_t codePointCount = (uint32_t)m_text.size() - m_captureCodePoint;
+	outLayout.codePoints.resize(codePointCount);
+	if(codePointCount > 0)
+	{
+		memcpy(&outLayout.codePoints[0], &m_text[m_captureCodePoint], codePointCount * sizeof(CodePoint_t));
+	}
+	uint32_t quadCount = m_lineQuads.size() - m_captureQuad;
+	outLayout.quads.resize(quadCount);
+	for(uint32_t i = 0; i < quadCount; ++i)
+	{
+		LineQuad& quad = outLayout.quads[i];
+		quad = m_lineQuads[m_captureQuad + i];
+		quad.x0 -= m_capturePenX;
+		quad.x1 -= m_capturePenX;
+	}
+	outLayout.carets.resize(codePointCount);
+	for(uint32_t i = 0; i < codePointCount; ++i)
+	{
+		outLayout.carets[i] = m_caretX[m_captureCodePoint + i] - m_capturePenX;
+	}
+	outLayout.advance = m_penX - m_capturePenX;
+	outLayout.ascender = m_lineAscender;
+	outLayout.descender = m_lineDescender;
+	outLayout.lineGap = m_lineGap;
+
+	m_lineAscender = m_captureAscender;
+	m_lineDescender = m_captureDescender;
+	m_lineGap = m_captureLineGap;
+	growLineMetrics(outLayout.ascender, outLayout.descender, outLayout.lineGap, m_lineAscender, m_lineDescender, m_lineGap);
+}
+
+void TextBuffer::getLayoutKey(FontHandle fontHandle, stl::vector<uint8_t>& outKey)
+{
+	TextStyle style;
+	getCurrentStyle(fontHandle, style);
+	size_t size = outKey.size();
+	outKey.resize(size + sizeof(style));
+	memcpy(&outKey[size], &style, sizeof(style));
+	if(m_fontManager->getFontInfo(fontHandle).subpixelPhaseCount > 1)
+	{
+		//the subpixel variants of the glyphs depend on the fractional part of the pen position
+		float penOffset = m_penX - floorf(m_penX);
+		outKey.resize(size + sizeof(style) + sizeof(penOffset));
+		memcpy(&outKey[size + sizeof(style)], &penOffset, sizeof(penOffset));
+	}
+}
+
+void TextBuffer::appendLayout(FontHandle fontHandle, const CachedLayout& layout)
+{
+	beginText();
+
+	uint32_t style = getStyleIndex(fontHandle);
+	uint32_t codePointCount = (uint32_t)layout.codePoints.size();
+	uint32_t textLength = (uint32_t)m_text.size();
+	float penX = getLayoutOrigin(fontHandle);
+	m_text.resize(textLength + codePointCount);
+	m_textStyles.resize(textLength + codePointCount);
+	m_caretX.resize(textLength + codePointCount);
+	if(codePointCount > 0)
+	{
+		memcpy(&m_text[textLength], &layout.codePoints[0], codePointCount * sizeof(CodePoint_t));
+	}
+	for(uint32_t i = 0; i < codePointCount; ++i)
+	{
+		m_textStyles[textLength + i] = style;
+		m_caretX[textLength + i] = layout.carets[i] + penX;
+	}
+
+	uint32_t quadCount = (uint32_t)layout.quads.size();
+	uint32_t firstQuad = m_lineQuads.size();
+	m_lineQuads.resize(firstQuad + quadCount);
+	for(uint32_t i = 0; i < quadCount; ++i)
+	{
+		LineQuad& quad = m_lineQuads[firstQuad + i];
+		quad = layout.quads[i];
+		quad.x0 += penX;
+		quad.x1 += penX;
+	}
+
+	growLineMetrics(layout.ascender, layout.descender, layout.lineGap, m_lineAscender, m_lineDescender, m_lineGap);
+	m_lineDirty = m_lineDirty || codePointCount > 0;
+	m_penX = penX + layout.advance;
+}
+
+float TextBuffer::getLayoutOrigin(FontHandle fontHandle) const
+{
+	return (m_fontManager->getFontInfo(fontHandle).subpixelPhaseCount > 1) ? floorf(m_penX) : m_penX;
+}
+
+void TextBuffer::flushLine()
+{
+	if(!m_lineDirty)
+	{
+		return;
+	}
+	m_lineDirty = false;
+
+	//the line is laid out from its start, the glyphs appended since the last flush may have changed its metrics
+	m_vertexCount = m_lineStartIndex;
+	for(uint32_t i = 0; i < DECORATION_COUNT; ++i)
+	{
+		m_lastDecorations[i] = INVALID_QUAD;
+	}
+	reserveQuads((uint32_t)(m_lineStartIndex / 4) + m_lineQuads.size());
+
+	float baseline = m_penY + m_lineAscender;
+	for(uint32_t i = 0, end = m_lineQuads.size(); i < end; ++i)
+	{
+		const LineQuad& quad = m_lineQuads[i];
+		float y0 = baseline + quad.offsetY;
+		switch(quad.style)
+		{
+		case STYLE_BACKGROUND:
+			appendDecoration(STYLE_BACKGROUND, quad.x0, baseline - m_lineAscender, quad.x1, baseline - m_lineDescender + m_lineGap, quad.rgba);
+			break;
+		case STYLE_UNDERLINE:
+			y0 = baseline - m_lineDescender/2;
+			appendDecoration(STYLE_UNDERLINE, quad.x0, y0, quad.x1, y0 + quad.height, quad.rgba);
+			break;
+		case STYLE_OVERLINE:
+		case STYLE_STRIKE_THROUGH:
+			appendDecoration(quad.style, quad.x0, y0, quad.x1, y0 + quad.height, quad.rgba);
+			break;
+		default:
+			appendQuad(quad.regionIndex, quad.x0, y0, quad.x1, y0 + quad.height, quad.rgba);
+			break;
+		}
+	}
+	updateLineRecord();
+	markDirty(m_lineStartIndex, m_vertexCount);
+}
+
+uint32_t TextBuffer::getDecorations() const
+{
+	//the decorations of a transparent color are not drawn
+	uint32_t decorations = m_styleFlags & DECORATION_MASK;
+	if(!(m_backgroundColor & 0xFF000000))
+	{
+		decorations &= ~STYLE_BACKGROUND;
+	}
+	if(!(m_underlineColor & 0xFF000000))
+	{
+		decorations &= ~STYLE_UNDERLINE;
+	}
+	if(!(m_overlineColor & 0xFF000000))
+	{
+		decorations &= ~STYLE_OVERLINE;
+	}
+	if(!(m_strikeThroughColor & 0xFF000000))
+	{
+		decorations &= ~STYLE_STRIKE_THROUGH;
+	}
+	return decorations;
+}
+
+void TextBuffer::appendGlyphRun(FontHandle fontHandle, const FontInfo& font, const ShapedGlyph* glyphs, uint32_t count, uint32_t firstCodePoint)
+{
+	(this->*s_glyphEmitters[getDecorations()])(fontHandle, font, glyphs, count, firstCodePoint);
+}
+
+void TextBuffer::appendGlyph(const ShapedGlyph& shapedGlyph, const FontInfo& font, uint32_t firstCodePoint)
+{
+	appendGlyphRun(shapedGlyph.fontHandle, font, &shapedGlyph, 1, firstCodePoint);
+}
+
+void TextBuffer::addDecorationQuad(uint8_t style, float advance, float offsetY, float height, uint32_t rgba, uint16_t regionIndex)
+{
+	LineQuad& quad = addLineQuad();
+	quad.x0 = m_penX;
+	quad.x1 = m_penX + advance;
+	quad.offsetY = offsetY;
+	quad.height = height;
+	quad.rgba = rgba;
+	quad.regionIndex = regionIndex;
+	quad.style = style;
+}
+
+template<uint32_t Decorations>
+void TextBuffer::emitGlyphs(FontHandle fontHandle, const FontInfo& runFont, const ShapedGlyph* glyphs, uint32_t count, uint32_t firstCodePoint)
+{
+	uint16_t blackRegion = (Decorations != 0) ? m_fontManager->getBlackGlyph().regionIndex : 0;
+	for(uint32_t i = 0; i < count; ++i)
+	{
+		const ShapedGlyph& shapedGlyph = glyphs[i];
+		//glyphs from a fallback font are laid out with their own metrics
+		const FontInfo& font = (shapedGlyph.fontHandle.idx == fontHandle.idx) ? runFont : m_fontManager->getFontInfo(shapedGlyph.fontHandle);
+		const GlyphInfo* glyphInfo = m_fontManager->getGlyphInfoByIndex(shapedGlyph.fontHandle, shapedGlyph.glyphIndex);
+		if(glyphInfo == NULL)
+		{
+			assert(false && "Glyph not found");
+			continue;
+		}
+
+		//the quads of the line are only placed vertically when it is flushed
+		growLineMetrics(font, m_lineAscender, m_lineDescender, m_lineGap);
+		m_lineDirty = true;
+
+		//the caret of a cluster is before its first glyph
+		if(firstCodePoint != NO_CODE_POINT && m_caretX[firstCodePoint + shapedGlyph.cluster] == INVALID_CARET)
+		{
+			m_caretX[firstCodePoint + shapedGlyph.cluster] = m_penX;
+		}
+				
+		//glyph metrics are shared with the master font, scale them here (the shaper already applied the kerning)
+		float advance = shapedGlyph.advance_x * font.scale;
+
+		//the background spans the line from its ascender to its descender, the underline is placed half way to its descender
+		if(Decorations & STYLE_BACKGROUND)
+		{
+			addDecorationQuad(STYLE_BACKGROUND, advance, 0, 0, m_backgroundColor, blackRegion);
+		}
+		if(Decorations & STYLE_UNDERLINE)
+		{
+			addDecorationQuad(STYLE_UNDERLINE, advance, 0, font.underline_thickness, m_underlineColor, blackRegion);
+		}
+		if(Decorations & STYLE_OVERLINE)
+		{
+			addDecorationQuad(STYLE_OVERLINE, advance, -font.ascender, font.underline_thickness, m_overlineColor, blackRegion);
+		}
+		if(Decorations & STYLE_STRIKE_THROUGH)
+		{
+			addDecorationQuad(STYLE_STRIKE_THROUGH, advance, -font.ascender/3, font.underline_thickness, m_strikeThroughColor, blackRegion);
+		}
+		
+		//handle glyph
+		const GlyphInfo* glyph = glyphInfo;
+		float originX = m_penX + shapedGlyph.offset_x * font.scale;
+		float x0 = originX + (glyphInfo->offset_x * font.scale);
+		if(font.subpixelPhaseCount > 1)
+		{
+			//place the glyph on a whole pixel, using the variant baked at the nearest fractional pen position
+			float penX = floorf(originX);
+			uint32_t phase = (uint32_t)((originX - penX) * font.subpixelPhaseCount + 0.5f);
+			if(phase == font.subpixelPhaseCount)
+			{
+				phase = 0;
+				penX += 1.0f;
+			}
+			if(phase != 0)
+			{
+				glyph = m_fontManager->getGlyphInfoByIndex(shapedGlyph.fontHandle, shapedGlyph.glyphIndex, phase);
+			}
+			
+			if(glyph != NULL)
+			{
+				x0 = penX + glyph->offset_x;
+			}else
+			{
+				//the variant can't be baked anymore, snap the original glyph
+				glyph = glyphInfo;
+				x0 = floorf(x0 + 0.5f);
+			}
+		}
+
+		//blank glyphs (e.g. spaces) and transparent text only move the pen
+		if(glyph->width > 0 && glyph->height > 0 && (m_textColor & 0xFF000000))
+		{
+			LineQuad& quad = addLineQuad();
+			quad.x0 = x0;
+			quad.x1 = x0 + glyph->width * font.scale;
+			quad.offsetY = (glyph->offset_y - shapedGlyph.offset_y) * font.scale;
+			quad.height = glyph->height * font.scale;
+			quad.rgba = m_textColor;
+			quad.regionIndex = glyph->regionIndex;
+			quad.style = STYLE_NORMAL;
+		}
+		
+		m_penX += advance;
+	}
+}
+
+const TextBuffer::GlyphEmitter TextBuffer::s_glyphEmitters[DECORATION_MASK + 1] =
+{
+	&TextBuffer::emitGlyphs<0>,  &TextBuffer::emitGlyphs<1>,  &TextBuffer::emitGlyphs<2>,  &TextBuffer::emitGlyphs<3>,
+	&TextBuffer::emitGlyphs<4>,  &TextBuffer::emitGlyphs<5>,  &TextBuffer::emitGlyphs<6>,  &TextBuffer::emitGlyphs<7>,
+	&TextBuffer::emitGlyphs<8>,  &TextBuffer::emitGlyphs<9>,  &TextBuffer::emitGlyphs<10>, &TextBuffer::emitGlyphs<11>,
+	&TextBuffer::emitGlyphs<12>, &TextBuffer::emitGlyphs<13>, &TextBuffer::emitGlyphs<14>, &TextBuffer::emitGlyphs<15>,
+};
+
+void TextBuffer::appendQuad(uint16_t regionIndex, float x0, float y0, float x1, float y1, uint32_t rgba)
+{
+	if(m_instanced)
+	{
+		const bgfx::AtlasRegion& region = m_fontManager->getAtlas()->getRegion(regionIndex);
+		GlyphInstance& instance = m_instanceBuffer[m_vertexCount / 4];
+		instance.x0 = x0;
+		instance.y0 = y0;
+		instance.x1 = x1;
+		instance.y1 = y1;
+		assert(region.width < INSTANCE_REGION_PACKING && "The region is too wide for the instance records");
+		instance.regionPosition = (float)(region.x + region.y * INSTANCE_REGION_PACKING);
+		instance.regionSize = (float)(region.width + region.height * INSTANCE_REGION_PACKING);
+		instance.colorLow = (float)(rgba & 0xffff);
+		instance.colorHigh = (float)((rgba >> 16) + ((region.getFaceIndex() * 4 + region.getComponentIndex()) << 16));
+	}else
+	{
+		m_fontManager->getAtlas()->packUV(regionIndex, (uint8_t*)m_vertexBuffer, sizeof(TextVertex) *m_vertexCount + offsetof(TextVertex, u), sizeof(TextVertex));
+
+		setVertex(m_vertexCount+0, x0, y0, rgba);
+		setVertex(m_vertexCount+1, x0, y1, rgba);
+		setVertex(m_vertexCount+2, x1, y1, rgba);
+		setVertex(m_vertexCount+3, x1, y0, rgba);
+	}
+	m_vertexCount += 4;
+}
+
+void TextBuffer::appendDecoration(uint8_t style, float x0, float y0, float x1, float y1, uint32_t rgba)
+{
+	//the decorations are single bits of the style flags
+	uint32_t slot = 0;
+	while((1u << slot) != style)
+	{
+		++slot;
+	}
+	assert(slot < DECORATION_COUNT);
+
+	size_t quad = m_lastDecorations[slot];
+	//the lines are drawn over the backgrounds, they can't be extended over a background appended after them
+	size_t background = m_lastDecorations[DECORATION_COUNT - 1];
+	bool coveredByBackground = (style != STYLE_BACKGROUND && background != INVALID_QUAD && background > quad);
+	if(quad != INVALID_QUAD && quad >= m_lineStartIndex && m_lastDecorationColors[slot] == rgba && !coveredByBackground)
+	{
+		if(m_instanced)
+		{
+			GlyphInstance& instance = m_instanceBuffer[quad / 4];
+			if(instance.x1 == x0 && instance.y0 == y0 && instance.y1 == y1)
+			{
+				instance.x1 = x1;
+				return;
+			}
+		}else if(m_vertexBuffer[quad+2].x == x0 && m_vertexBuffer[quad+0].y == y0 && m_vertexBuffer[quad+1].y == y1)
+		{
+			m_vertexBuffer[quad+2].x = x1;
+			m_vertexBuffer[quad+3].x = x1;
+			return;
+		}
+	}
+
+	m_lastDecorations[slot] = m_vertexCount;
+	m_lastDecorationColors[slot] = rgba;
+	appendQuad(m_fontManager->getBlackGlyph().regionIndex, x0, y0, x1, y1, rgba);
+}
+
+/// lay out text like TextBuffer but only keep its extents, from the shaped advances and the font metrics
+/// @remark no glyph is baked and no vertex is written
+class TextMeasurer
+{
+public:
+	TextMeasurer(FontManager* fontManager, TextLineMetrics* outLines, uint32_t maxLineCount);
+
+	void pushCodePoint(FontHandle fontHandle, CodePoint_t codePoint);
+	/// measure the pending run and close the last line
+	/// @return the bounding box of the text, its origin being the pen position of the first line
+	TextRectangle finish(FontHandle fontHandle, uint32_t* outLineCount);
+
+private:
+	void flushRun(FontHandle fontHandle);
+	void measureShapedRun(FontHandle fontHandle, const CodePoint_t* codePoints, uint32_t count);
+	void newLine();
+
+	FontManager* m_fontManager;
+	TextLineMetrics* m_lines;
+	uint32_t m_maxLineCount;
+	uint32_t m_lineCount;
+
+	float m_penX;
+	float m_lineTop;
+	float m_lineAscender;
+	float m_lineDescender;
+	float m_lineGap;
+	TextRectangle m_bounds;
+
+	CodePoint_t m_run[GLYPH_RUN_SIZE];
+	uint32_t m_runLength;
+};
+
+TextMeasurer::TextMeasurer(FontManager* fontManager, TextLineMetrics* outLines, uint32_t maxLineCount): m_fontManager(fontManager), m_lines(outLines), m_maxLineCount(maxLineCount)
+{
+	m_lineCount = 0;
+	m_penX = 0;
+	m_lineTop = 0;
+	m_lineAscender = 0;
+	m_lineDescender = 0;
+	m_lineGap = 0;
+	m_bounds.x = 0;
+	m_bounds.y = 0;
+	m_bounds.width = 0;
+	m_bounds.height = 0;
+	m_runLength = 0;
+}
+
+void TextMeasurer::pushCodePoint(FontHandle fontHandle, CodePoint_t codePoint)
+{
+	//same runs as TextBuffer::pushCodePoint, so that the shaped advances match
+	if(codePoint == L'\n')
+	{
+		flushRun(fontHandle);
+		newLine();
+		return;
+	}
+
+	if(m_runLength == GLYPH_RUN_SIZE)
+	{
+		uint32_t split = splitRun(m_run, m_runLength);
+		measureShapedRun(fontHandle, m_run, split);
+		memmove(m_run, m_run + split, (m_runLength - split) * sizeof(CodePoint_t));
+		m_runLength -= split;
+	}
+	m_run[m_runLength++] = codePoint;
+}
+
+TextRectangle TextMeasurer::finish(FontHandle fontHandle, uint32_t* outLineCount)
+{
+	flushRun(fontHandle);
+	newLine();
+	if(outLineCount != NULL)
+	{
+		*outLineCount = m_lineCount;
+	}
+	return m_bounds;
+}
+
+void TextMeasurer::flushRun(FontHandle fontHandle)
+{
+	measureShapedRun(fontHandle, m_run, m_runLength);
+	m_runLength = 0;
+}
+
+void TextMeasurer::measureShapedRun(FontHandle fontHandle, const CodePoint_t* codePoints, uint32_t count)
+{
+	if(count == 0)
+	{
+		return;
+	}
+
+	const FontInfo& font = m_fontManager->getFontInfo(fontHandle);
+	uint32_t glyphCount;
+	const ShapedGlyph* glyphs = m_fontManager->shapeText(fontHandle, 0, codePoints, count, glyphCount);
+	for(uint32_t i = 0; i < glyphCount; ++i)
+	{
+		const FontInfo& glyphFont = (glyphs[i].fontHandle.idx == fontHandle.idx) ? font : m_fontManager->getFontInfo(glyphs[i].fontHandle);
+		growLineMetrics(glyphFont, m_lineAscender, m_lineDescender, m_lineGap);
+		m_penX += glyphs[i].advance_x * glyphFont.scale;
+	}
+}
+
+void TextMeasurer::newLine()
+{
+	if(m_lineCount < m_maxLineCount)
+	{
+		TextLineMetrics& line = m_lines[m_lineCount];
+		line.width = m_penX;
+		line.baseline = m_lineTop + m_lineAscender;
+		line.ascender = m_lineAscender;
+		line.descender = m_lineDescender;
+	}
+	++m_lineCount;
+
+	if(m_penX > m_bounds.width)
+	{
+		m_bounds.width = m_penX;
+	}
+	//lines without glyphs have no height, like in TextBuffer
+	float bottom = m_lineTop + m_lineAscender - m_lineDescender;
+	if(bottom > m_bounds.height)
+	{
+		m_bounds.height = bottom;
+	}
+
+	m_penX = 0;
+	m_lineTop += m_lineAscender - m_lineDescender + m_lineGap;
+	m_lineAscender = 0;
+	m_lineDescender = 0;
+	m_lineGap = 0;
+}
+
+/// code points of the last string received by the manager, whatever its encoding
+class TextDecoder
+{
+public:
+	TextDecoder() { m_count = 0; }
+
+	void decodeUtf8(const char* _string, uint32_t length);
+	void decodeUtf16(const uint16_t* _string, uint32_t length);
+	void decodeUtf32(const uint32_t* _string, uint32_t length);
+	/// wide chars are utf-16 or utf-32 code units, depending on the platform
+	void decode(const wchar_t* _string, uint32_t length);
+
+	const CodePoint_t* getCodePoints() const { return (m_count > 0) ? &m_codePoints[0] : NULL; }
+	uint32_t getCount() const { return m_count; }
+
+private:
+	/// room for length code points, the storage only grows
+	uint32_t* reserve(uint32_t length);
+
+	stl::vector<CodePoint_t> m_codePoints;
+	uint32_t m_count;
+};
+
+uint32_t* TextDecoder::reserve(uint32_t length)
+{
+	if(m_codePoints.size() < length)
+	{
+		m_codePoints.resize(length);
+	}
+	//CodePoint_t is the signed variant of uint32_t
+	return (length > 0) ? (uint32_t*)&m_codePoints[0] : NULL;
+}
+
+void TextDecoder::decodeUtf8(const char* _string, uint32_t length)
+{
+	m_count = utf8_decode_string((const uint8_t*)_string, length, reserve(length));
+}
+
+void TextDecoder::decodeUtf16(const uint16_t* _string, uint32_t length)
+{
+	m_count = utf16_decode_string(_string, length, reserve(length));
+}
+
+void TextDecoder::decodeUtf32(const uint32_t* _string, uint32_t length)
+{
+	uint32_t* codePoints = reserve(length);
+	if(length > 0)
+	{
+		memcpy(codePoints, _string, length * sizeof(uint32_t));
+	}
+	m_count = length;
+}
+
+void TextDecoder::decode(const wchar_t* _string, uint32_t length)
+{
+	if(sizeof(wchar_t) == sizeof(uint16_t))
+	{
+		decodeUtf16((const uint16_t*)_string, length);
+	}else
+	{
+		decodeUtf32((const uint32_t*)_string, length);
+	}
+}
+
+/// cache of the strings appended with wrapping, so that wrapping them again at another width doesn't shape them again
+class BrokenTextCache
+{
+public:
+	BrokenTextCache(FontManager* fontManager, uint32_t capacity);
+	~BrokenTextCache();
+
+	/// return the string cut at its break opportunities, it is shaped on first use
+	/// @remark the text stays valid until the next call
+	const BrokenText& get(FontHandle fontHandle, const CodePoint_t* codePoints, uint32_t count);
+
+private:
+	/// shape a paragraph (code points between two line feeds) and cut it in segments
+	void breakParagraph(BrokenText& text, uint32_t begin, uint32_t end);
+	void clear();
+
+	typedef stl::unordered_map<uint32_t, BrokenText*> BrokenTextHash_t;
+	BrokenTextHash_t m_texts;
+	FontManager* m_fontManager;
+	uint32_t m_capacity;
+	// generation of the shaped runs the texts were shaped with
+	uint32_t m_generation;
+};
+
+BrokenTextCache::BrokenTextCache(FontManager* fontManager, uint32_t capacity): m_fontManager(fontManager), m_capacity(capacity)
+{
+	m_generation = 0;
+}
+
+BrokenTextCache::~BrokenTextCache()
+{
+	clear();
+}
+
+void BrokenTextCache::clear()
+{
+	for(BrokenTextHash_t::iterator iter = m_texts.begin(); iter != m_texts.end(); ++iter)
+	{
+		delete iter->second;
+	}
+	m_texts.clear();
+}
+
+const BrokenText& BrokenTextCache::get(FontHandle fontHandle, const CodePoint_t* codePoints, uint32_t count)
+{
+	//the texts are shaped, they are stale when the shaped runs are
+	uint32_t generation = m_fontManager->getShapedRunCache()->getGeneration();
+	if(generation != m_generation)
+	{
+		clear();
+		m_generation = generation;
+	}
+
+	//FNV-1a
+	uint32_t hash = 2166136261u;
+	hash = (hash ^ fontHandle.idx) * 16777619u;
+	for(uint32_t i = 0; i < count; ++i)
+	{
+		hash = (hash ^ (uint32_t)codePoints[i]) * 16777619u;
+	}
+
+	BrokenTextHash_t::iterator iter = m_texts.find(hash);
+	if(iter != m_texts.end())
+	{
+		BrokenText& text = *iter->second;
+		if(text.fontHandle.idx == fontHandle.idx
+			&& text.codePoints.size() == count
+			&& (count == 0 || memcmp(&text.codePoints[0], codePoints, count * sizeof(CodePoint_t)) == 0))
+		{
+			return text;
+		}
+		//strings colliding on the hash replace each other
+		delete iter->second;
+		m_texts.erase(iter);
+	}
+	if(m_texts.size() >= m_capacity)
+	{
+		clear();
+	}
+
+	BrokenText* text = new BrokenText;
+	text->fontHandle = fontHandle;
+	text->codePoints.resize(count);
+	if(count > 0)
+	{
+		memcpy(&text->codePoints[0], codePoints, count * sizeof(CodePoint_t));
+	}
+	uint32_t begin = 0;
+	for(;;)
+	{
+		uint32_t end = begin;
+		while(end < count && codePoints[end] != L'\n')
+		{
+			++end;
+		}
+		breakParagraph(*text, begin, end);
+		if(end == count)
+		{
+			break;
+		}
+		text->segments.back().lineFeed = true;
+		begin = end + 1;
+	}
+	m_texts[hash] = text;
+	return *text;
+}
+
+void BrokenTextCache::breakParagraph(BrokenText& text, uint32_t begin, uint32_t end)
+{
+	const CodePoint_t* codePoints = text.codePoints.empty() ? NULL : &text.codePoints[0];
+	bool* breaks = new bool[end > begin ? end - begin : 1];
+	if(end > begin)
+	{
+		findLineBreaks(codePoints + begin, end - begin, breaks);
+	}
+
+	//shape in runs cut at break opportunities, like TextBuffer cuts them at spaces
+	uint32_t firstGlyph = (uint32_t)text.glyphs.size();
+	for(uint32_t runStart = begin; runStart < end; )
+	{
+		uint32_t runEnd = end;
+		if(runEnd - runStart > GLYPH_RUN_SIZE)
+		{
+			runEnd = runStart + GLYPH_RUN_SIZE;
+			for(uint32_t i = runEnd; i > runStart + 1; --i)
+			{
+				if(breaks[i - 1 - begin])
+				{
+					runEnd = i;
+					break;
+				}
+			}
+		}
+
+		uint32_t glyphCount;
+		const ShapedGlyph* glyphs = m_fontManager->shapeText(text.fontHandle, 0, codePoints + runStart, runEnd - runStart, glyphCount, true);
+		for(uint32_t i = 0; i < glyphCount; ++i)
+		{
+			ShapedGlyph glyph = glyphs[i];
+			glyph.cluster += runStart;
+			text.glyphs.push_back(glyph);
+			text.advances.push_back(glyph.advance_x * m_fontManager->getFontInfo(glyph.fontHandle).scale);
+		}
+		runStart = runEnd;
+	}
+
+	//a segment ends with the last glyph of the cluster followed by a break opportunity
+	BrokenText::Segment segment = { begin, firstGlyph, 0, 0, 0.0f, 0.0f, false };
+	for(uint32_t i = firstGlyph, glyphEnd = (uint32_t)text.glyphs.size(); i < glyphEnd; ++i)
+	{
+		uint32_t cluster = text.glyphs[i].cluster;
+		if(isLineBreakSpace(codePoints[cluster]))
+		{
+			segment.spaceWidth += text.advances[i];
+			++segment.spaceCount;
+		}else
+		{
+			//spaces that can't be broken after (e.g. after an opening bracket) are part of the segment
+			segment.width += segment.spaceWidth + text.advances[i];
+			segment.spaceWidth = 0;
+			segment.spaceCount = 0;
+		}
+		++segment.glyphCount;
+
+		uint32_t nextCluster = (i + 1 < glyphEnd) ? text.glyphs[i+1].cluster : end;
+		if(i + 1 < glyphEnd && nextCluster > cluster && breaks[nextCluster - 1 - begin])
+		{
+			text.segments.push_back(segment);
+			segment.firstCodePoint = nextCluster;
+			segment.firstGlyph = i + 1;
+			segment.glyphCount = 0;
+			segment.spaceCount = 0;
+			segment.width = 0;
+			segment.spaceWidth = 0;
+		}
+	}
+	text.segments.push_back(segment);
+	delete [] breaks;
+}
+
+// ****************************************************************
+
+/// LRU cache of the layouts of the strings appended to the buffers with layout caching (see TextBufferManager::setLayoutCaching)
+class LayoutCache
+{
+public:
+	LayoutCache(FontManager* fontManager, uint32_t capacity);
+	~LayoutCache();
+
+	/// make the key of code points appended to a buffer: the style and subpixel pen offset of the buffer, then the code points
+	/// @return false if the code points contain a line feed, their layout can't be cached
+	bool setKey(TextBuffer& textBuffer, FontHandle fontHandle, const CodePoint_t* codePoints, uint32_t count);
+
+	/// look for the layout of the key and mark it as the most recently used
+	/// @return NULL if it is not in the cache
+	const CachedLayout* find();
+
+	/// layout to capture the string of the key in, the least recently used layout is evicted when the cache is full
+	CachedLayout& insert();
+
+	/// number of lookups that found their layout, or missed it, since the last reset
+	uint32_t getHitCount() const { return m_hitCount; }
+	uint32_t getMissCount() const { return m_missCount; }
+	void resetCounters() { m_hitCount = 0; m_missCount = 0; }
+
+private:
+	struct Entry
+	{
+		uint32_t hash;
+		stl::vector<uint8_t> key;
+		CachedLayout layout;
+		// neighbours in the recently used list
+		Entry* previous;
+		Entry* next;
+	};
+
+	void unlink(Entry* entry);
+	void pushFront(Entry* entry);
+	void clear();
+
+	typedef stl::unordered_map<uint32_t, Entry*> EntryHash_t;
+	EntryHash_t m_entries;
+	FontManager* m_fontManager;
+	uint32_t m_capacity;
+	// most and least recently used entries
+	Entry* m_head;
+	Entry* m_tail;
+	// generation of the shaped runs the layouts were made with
+	uint32_t m_generation;
+	stl::vector<uint8_t> m_key;
+	uint32_t m_hash;
+	uint32_t m_hitCount;
+	uint32_t m_missCount;
+};
+
+LayoutCache::LayoutCache(FontManager* fontManager, uint32_t capacity): m_fontManager(fontManager), m_capacity(capacity)
+{
+	m_head = NULL;
+	m_tail = NULL;
+	m_generation = 0;
+	m_hash = 0;
+	m_hitCount = 0;
+	m_missCount = 0;
+}
+
+LayoutCache::~LayoutCache()
+{
+	clear();
+}
+
+void LayoutCache::clear()
+{
+	for(EntryHash_t::iterator iter = m_entries.begin(); iter != m_entries.end(); ++iter)
+	{
+		delete iter->second;
+	}
+	m_entries.clear();
+	m_head = NULL;
+	m_tail = NULL;
+}
+
+bool LayoutCache::setKey(TextBuffer& textBuffer, FontHandle fontHandle, const CodePoint_t* codePoints, uint32_t count)
+{
+	for(uint32_t i = 0; i < count; ++i)
+	{
+		if(codePoints[i] == L'\n')
+		{
+			return false;
+		}
+	}
+	m_key.clear();
+	textBuffer.getLayoutKey(fontHandle, m_key);
+	size_t size = m_key.size();
+	m_key.resize(size + count * sizeof(CodePoint_t));
+	if(count > 0)
+	{
+		memcpy(&m_key[size], codePoints, count * sizeof(CodePoint_t));
+	}
+	return true;
+}
+
+const CachedLayout* LayoutCache::find()
+{
+	//the layouts hold shaped glyphs, they are stale when the shaped runs are
+	uint32_t generation = m_fontManager->getShapedRunCache()->getGeneration();
+	if(generation != m_generation)
+	{
+		clear();
+		m_generation = generation;
+	}
+
+	//FNV-1a
+	m_hash = 2166136261u;
+	for(uint32_t i = 0, size = (uint32_t)m_key.size(); i < size; ++i)
+	{
+		m_hash = (m_hash ^ m_key[i]) * 16777619u;
+	}
+
+	EntryHash_t::iterator iter = m_entries.find(m_hash);
+	if(iter != m_entries.end())
+	{
+		Entry* entry = iter->second;
+		if(entry->key.size() == m_key.size() && memcmp(&entry->key[0], &m_key[0], m_key.size()) == 0)
+		{
+			++m_hitCount;
+			unlink(entry);
+			pushFront(entry);
+			return &entry->layout;
+		}
+	}
+	++m_missCount;
+	return NULL;
+}
+
+CachedLayout& LayoutCache::insert()
+{
+	Entry* entry = NULL;
+	EntryHash_t::iterator iter = m_entries.find(m_hash);
+	if(iter != m_entries.end())
+	{
+		//keys colliding on the hash replace each other
+		entry = iter->second;
+		unlink(entry);
+	}else
+	{
+		if(m_entries.size() >= m_capacity)
+		{
+			entry = m_tail;
+			unlink(entry);
+			m_entries.erase(m_entries.find(entry->hash));
+		}else
+		{
+			entry = new Entry;
+		}
+		entry->hash = m_hash;
+		m_entries[m_hash] = entry;
+	}
+	entry->key = m_key;
+	pushFront(entry);
+	return entry->layout;
+}
+
+void LayoutCache::unlink(Entry* entry)
+{
+	if(entry->previous != NULL)
+	{
+		entry->previous->next = entry->next;
+	}else
+	{
+		m_head = entry->next;
+	}
+	if(entry->next != NULL)
+	{
+		entry->next->previous = entry->previous;
+	}else
+	{
+		m_tail = entry->previous;
+	}
+}
+
+void LayoutCache::pushFront(Entry* entry)
+{
+	entry->previous = NULL;
+	entry->next = m_head;
+	if(m_head != NULL)
+	{
+		m_head->previous = entry;
+	}
+	m_head = entry;
+	if(m_tail == NULL)
+	{
+		m_tail = entry;
+	}
+}
+
+/// vertices of a page of the ring of a console buffer, each page is a dynamic vertex buffer updated on its own
+static const uint32_t CONSOLE_PAGE_VERTICES = 4096;
+
+/// distance of the oldest line of a console from the origin above which the lines are moved back to it, a float is exact to 1/128 pixel below
+static const float CONSOLE_REBASE_DISTANCE = 65536.0f;
+
+/// Vertex ring of a CONSOLE text buffer: the lines are copied in it once closed and stay until newer lines overwrite them.
+/// A line is never split across the end of the ring, the space left there is skipped.
+class TextConsole
+{
+public:
+	/// @param maxLineCount maximum number of lines kept
+	/// @param maxQuadCount maximum number of quads kept, rounded up to a number of pages
+	TextConsole(uint32_t maxLineCount, uint32_t maxQuadCount, uint32_t vertexSize);
+	~TextConsole();
+
+	/// copy a laid out line at the head of the ring, evicting the oldest lines where it is written
+	void appendLine(const uint8_t* vertices, uint32_t vertexCount, float top, float height);
+
+	/// forget every line
+	void clear();
+
+	/// move the lines kept down by offsetY (up if negative), the base moves the other way so that they stay at the same place once drawn
+	void offsetLines(float offsetY);
+
+	/// upload the pages modified since the last call, from their first vertex to the last one written
+	void update(const bgfx::VertexDecl& decl);
+
+	struct Line
+	{
+		uint32_t firstVertex;
+		uint32_t vertexCount;
+		float top;
+		float height;
+	};
+
+	/// lines kept, from the oldest to the newest
+	uint32_t getLineCount() const { return m_lineCount; }
+	const Line& getLine(uint32_t index) const { return m_lines[(m_firstLine + index) % m_maxLineCount]; }
+
+	/// index of the first line ending below y, getLineCount() if there is none
+	uint32_t findLine(float y) const;
+
+	bgfx::DynamicVertexBufferHandle getPage(uint32_t page) const { return m_pages[page]; }
+
+	void setScroll(float scrollY, float viewTop, float viewHeight) { m_scrollY = scrollY; m_viewTop = viewTop; m_viewHeight = viewHeight; }
+	float getScrollY() const { return m_scrollY; }
+	float getViewTop() const { return m_viewTop; }
+	float getViewHeight() const { return m_viewHeight; }
+
+	/// position of the lines in the text, their coordinates are relative to it to keep the precision of the floats
+	double getBaseY() const { return m_baseY; }
+
+private:
+	void markPagesDirty(uint32_t firstVertex, uint32_t endVertex);
+
+	Line* m_lines;
+	uint32_t m_maxLineCount;
+	uint32_t m_firstLine;
+	uint32_t m_lineCount;
+
+	uint8_t* m_vertices;
+	uint32_t m_vertexSize;
+	uint32_t m_vertexCapacity;
+	//where the next line is written
+	uint32_t m_head;
+
+	bgfx::DynamicVertexBufferHandle* m_pages;
+	//end of the vertices written in each page since the last update, relative to the page
+	uint32_t* m_pageDirtyEnd;
+	uint32_t m_pageCount;
+
+	float m_scrollY;
+	float m_viewTop;
+	float m_viewHeight;
+	double m_baseY;
+};
+
+TextConsole::TextConsole(uint32_t maxLineCount, uint32_t maxQuadCount, uint32_t vertexSize): m_maxLineCount(maxLineCount), m_vertexSize(vertexSize)
+{
+	assert(maxLineCount > 0 && maxQuadCount > 0 && "A console buffer must keep at least one line and one quad");
+	m_lines = new Line[maxLineCount];
+	m_pageCount = (maxQuadCount * 4 + CONSOLE_PAGE_VERTICES - 1) / CONSOLE_PAGE_VERTICES;
+	m_vertexCapacity = m_pageCount * CONSOLE_PAGE_VERTICES;
+	m_vertices = new uint8_t[m_vertexCapacity * vertexSize];
+	memset(m_vertices, 0, m_vertexCapacity * vertexSize);
+	m_pages = new bgfx::DynamicVertexBufferHandle[m_pageCount];
+	m_pageDirtyEnd = new uint32_t[m_pageCount];
+	for(uint32_t i = 0; i < m_pageCount; ++i)
+	{
+		m_pages[i].idx = bgfx::invalidHandle;
+		m_pageDirtyEnd[i] = 0;
+	}
+	m_scrollY = 0.0f;
+	m_viewTop = 0.0f;
+	m_viewHeight = 0.0f;
+	m_baseY = 0.0;
+	clear();
+}
+
+TextConsole::~TextConsole()
+{
+	for(uint32_t i = 0; i < m_pageCount; ++i)
+	{
+		if(m_pages[i].idx != bgfx::invalidHandle)
+		{
+			bgfx::destroyDynamicVertexBuffer(m_pages[i]);
+		}
+	}
+	delete [] m_lines;
+	delete [] m_vertices;
+	delete [] m_pages;
+	delete [] m_pageDirtyEnd;
+}
+
+void TextConsole::clear()
+{
+	m_firstLine = 0;
+	m_lineCount = 0;
+	m_head = 0;
+}
+
+void TextConsole::appendLine(const uint8_t* vertices, uint32_t vertexCount, float top, float height)
+{
+	if(vertexCount > m_vertexCapacity)
+	{
+		//the end of a line longer than the whole ring is lost
+		vertexCount = m_vertexCapacity;
+	}
+
+	if(m_head + vertexCount > m_vertexCapacity)
+	{
+		//the lines between the head and the end of the ring are the oldest ones, the space is skipped
+		while(m_lineCount > 0 && getLine(0).firstVertex >= m_head)
+		{
+			m_firstLine = (m_firstLine + 1) % m_maxLineCount;
+			--m_lineCount;
+		}
+		m_head = 0;
+	}
+	while(m_lineCount > 0 && (m_lineCount == m_maxLineCount || (getLine(0).firstVertex >= m_head && getLine(0).firstVertex < m_head + vertexCount)))
+	{
+		m_firstLine = (m_firstLine + 1) % m_maxLineCount;
+		--m_lineCount;
+	}
+
+	Line& line = m_lines[(m_firstLine + m_lineCount) % m_maxLineCount];
+	++m_lineCount;
+	line.firstVertex = m_head;
+	line.vertexCount = vertexCount;
+	line.top = top;
+	line.height = height;
+	if(vertexCount == 0)
+	{
+		return;
+	}
 
-		setVertex(m_vertexCount+0, font.scale, x0, y0, m_overlineColor,STYLE_OVERLINE);
-		setVertex(m_vertexCount+1, font.scale, x0, y1, m_overlineColor,STYLE_OVERLINE);
-		setVertex(m_vertexCount+2, font.scale, x1, y1, m_overlineColor,STYLE_OVERLINE);
-		setVertex(m_vertexCount+3, font.scale, x1, y0, m_overlineColor,STYLE_OVERLINE);
+	memcpy(m_vertices + m_head * m_vertexSize, vertices, vertexCount * m_vertexSize);
+	markPagesDirty(m_head, m_head + vertexCount);
+	m_head += vertexCount;
+}
 
-		m_indexBuffer[m_indexCount + 0] = m_vertexCount+0;
-		m_indexBuffer[m_indexCount + 1] = m_vertexCount+1;
-		m_indexBuffer[m_indexCount + 2] = m_vertexCount+2;
-		m_indexBuffer[m_indexCount + 3] = m_vertexCount+0;
-		m_indexBuffer[m_indexCount + 4] = m_vertexCount+2;
-		m_indexBuffer[m_indexCount + 5] = m_vertexCount+3;
-		m_vertexCount += 4;
-		m_indexCount += 6;
+void TextConsole::offsetLines(float offsetY)
+{
+	for(uint32_t i = 0; i < m_lineCount; ++i)
+	{
+		Line& line = m_lines[(m_firstLine + i) % m_maxLineCount];
+		line.top += offsetY;
+		//the position comes first in the vertices (see TextBuffer::TextVertex)
+		uint8_t* vertex = m_vertices + line.firstVertex * m_vertexSize;
+		for(uint32_t j = 0; j < line.vertexCount; ++j, vertex += m_vertexSize)
+		{
+			((float*)vertex)[1] += offsetY;
+		}
+		markPagesDirty(line.firstVertex, line.firstVertex + line.vertexCount);
 	}
-	
-		
-	if( m_styleFlags & STYLE_STRIKE_THROUGH && m_strikeThroughColor & 0xFF000000)
+	m_baseY -= offsetY;
+}
+
+void TextConsole::markPagesDirty(uint32_t firstVertex, uint32_t endVertex)
+{
+	for(uint32_t page = firstVertex / CONSOLE_PAGE_VERTICES; page * CONSOLE_PAGE_VERTICES < endVertex; ++page)
 	{
- 		float x0 = ( m_penX - kerning );
-		float y0 = (m_penY - font.ascender/3 );
-		float x1 = ( (float)x0 + (glyphInfo.advance_x) );
-		float y1 = y0+font.underline_thickness;
-		
-		m_fontManager->getAtlas()->packUV(blackGlyph.regionIndex, (uint8_t*)m_vertexBuffer,sizeof(TextVertex) *m_vertexCount + offsetof(TextVertex, u), sizeof(TextVertex));
-
-		setVertex(m_vertexCount+0, font.scale, x0, y0, m_strikeThroughColor,STYLE_STRIKE_THROUGH);
-		setVertex(m_vertexCount+1, font.scale, x0, y1, m_strikeThroughColor,STYLE_STRIKE_THROUGH);
-		setVertex(m_vertexCount+2, font.scale, x1, y1, m_strikeThroughColor,STYLE_STRIKE_THROUGH);
-		setVertex(m_vertexCount+3, font.scale, x1, y0, m_strikeThroughColor,STYLE_STRIKE_THROUGH);
-
-		m_indexBuffer[m_indexCount + 0] = m_vertexCount+0;
-		m_indexBuffer[m_indexCount + 1] = m_vertexCount+1;
-		m_indexBuffer[m_indexCount + 2] = m_vertexCount+2;
-		m_indexBuffer[m_indexCount + 3] = m_vertexCount+0;
-		m_indexBuffer[m_indexCount + 4] = m_vertexCount+2;
-		m_indexBuffer[m_indexCount + 5] = m_vertexCount+3;
-		m_vertexCount += 4;
-		m_indexCount += 6;
+		uint32_t pageEnd = endVertex - page * CONSOLE_PAGE_VERTICES;
+		pageEnd = (pageEnd < CONSOLE_PAGE_VERTICES) ? pageEnd : CONSOLE_PAGE_VERTICES;
+		m_pageDirtyEnd[page] = (pageEnd > m_pageDirtyEnd[page]) ? pageEnd : m_pageDirtyEnd[page];
 	}
-	
+}
 
-	//handle glyph
-	float x0_precise = m_penX + (glyphInfo.offset_x);
-	float x0 = ( x0_precise);
-	float y0 = ( m_penY + (glyphInfo.offset_y));
-	float x1 = ( x0 + glyphInfo.width );
-	float y1 = ( y0 + glyphInfo.height );
+void TextConsole::update(const bgfx::VertexDecl& decl)
+{
+	for(uint32_t page = 0; page < m_pageCount; ++page)
+	{
+		if(m_pageDirtyEnd[page] == 0)
+		{
+			continue;
+		}
 
-	float shift = x0_precise - x0;
-	
-	m_fontManager->getAtlas()->packUV(glyphInfo.regionIndex, (uint8_t*)m_vertexBuffer, sizeof(TextVertex) *m_vertexCount + offsetof(TextVertex, u), sizeof(TextVertex));
-
-	setVertex(m_vertexCount+0, font.scale, x0, y0, m_textColor);
-	setVertex(m_vertexCount+1, font.scale, x0, y1, m_textColor);
-	setVertex(m_vertexCount+2, font.scale, x1, y1, m_textColor);
-	setVertex(m_vertexCount+3, font.scale, x1, y0, m_textColor);
-
-	m_indexBuffer[m_indexCount + 0] = m_vertexCount+0;
-	m_indexBuffer[m_indexCount + 1] = m_vertexCount+1;
-	m_indexBuffer[m_indexCount + 2] = m_vertexCount+2;
-	m_indexBuffer[m_indexCount + 3] = m_vertexCount+0;
-	m_indexBuffer[m_indexCount + 4] = m_vertexCount+2;
-	m_indexBuffer[m_indexCount + 5] = m_vertexCount+3;
-	m_vertexCount += 4;
-	m_indexCount += 6;
-	
-	//TODO see what to do when doing subpixel rendering
-	m_penX += glyphInfo.advance_x;
+		const uint8_t* vertices = m_vertices + page * CONSOLE_PAGE_VERTICES * m_vertexSize;
+		if(m_pages[page].idx == bgfx::invalidHandle)
+		{
+			const bgfx::Memory* mem = bgfx::alloc(CONSOLE_PAGE_VERTICES * m_vertexSize);
+			memcpy(mem->data, vertices, mem->size);
+			m_pages[page] = bgfx::createDynamicVertexBuffer(mem, decl);
+		}else
+		{
+			//the buffer can only be updated from its first vertex
+			const bgfx::Memory* mem = bgfx::alloc(m_pageDirtyEnd[page] * m_vertexSize);
+			memcpy(mem->data, vertices, mem->size);
+			bgfx::updateDynamicVertexBuffer(m_pages[page], mem);
+		}
+		m_pageDirtyEnd[page] = 0;
+	}
 }
 
-void TextBuffer::verticalCenterLastLine(float dy, float top, float bottom)
-{		
-	for( size_t i=m_lineStartIndex; i < m_vertexCount; i+=4 )
-    {	
-		if( m_styleBuffer[i] == STYLE_BACKGROUND)
+uint32_t TextConsole::findLine(float y) const
+{
+	//the lines are laid out from top to bottom
+	uint32_t first = 0;
+	uint32_t count = m_lineCount;
+	while(count > 0)
+	{
+		uint32_t step = count / 2;
+		const Line& line = getLine(first + step);
+		if(line.top + line.height <= y)
+		{
+			first += step + 1;
+			count -= step + 1;
+		}else
 		{
-			m_vertexBuffer[i+0].y = top;
-			m_vertexBuffer[i+1].y = bottom;
-			m_vertexBuffer[i+2].y = bottom;
-			m_vertexBuffer[i+3].y = top;
-		}else{
-			m_vertexBuffer[i+0].y += dy;
-			m_vertexBuffer[i+1].y += dy;
-			m_vertexBuffer[i+2].y += dy;
-			m_vertexBuffer[i+3].y += dy;
+			count = step;
 		}
-    }
+	}
+	return first;
 }
 
-// ****************************************************************
-
-TextBufferManager::TextBufferManager(FontManager* fontManager):m_fontManager(fontManager), m_textBufferHandles(MAX_TEXT_BUFFER_COUNT)
+TextBufferManager::TextBufferManager(FontManager* fontManager, uint16_t maxTextBufferCount):m_fontManager(fontManager), m_textBufferHandles(maxTextBufferCount)
 {
-	m_textBuffers = new BufferCache[MAX_TEXT_BUFFER_COUNT];
+	m_textBuffers = new BufferCache[maxTextBufferCount];
+	//the text buffers are constructed in place when their handle is allocated
+	m_textBufferStorage = new uint8_t[maxTextBufferCount * sizeof(TextBuffer)];
+	m_storagePool = new BlockPool(TextBuffer::getStorageSize());
+	m_recordPool = new BlockPool(RECORD_BLOCK_SIZE);
+	m_brokenTextCache = new BrokenTextCache(m_fontManager, MAX_BROKEN_TEXTS);
+	m_layoutCache = new LayoutCache(m_fontManager, MAX_CACHED_LAYOUTS);
+	m_decoder = new TextDecoder;
 }
 
 TextBufferManager::~TextBufferManager()
 {
 	assert(m_textBufferHandles.getNumHandles() == 0 && "All the text buffers must be destroyed before destroying the manager");
 	delete[] m_textBuffers;
+	delete[] m_textBufferStorage;
+	delete m_storagePool;
+	delete m_recordPool;
+	delete m_brokenTextCache;
+	delete m_layoutCache;
+	delete m_decoder;
 
 	bgfx::destroyUniform(m_u_texColor);
 	bgfx::destroyUniform(m_u_inverse_gamma);
 
+	bgfx::destroyUniform(m_u_inverse_atlas_size);
+
+	bgfx::destroyIndexBuffer(m_quadIndexBuffer);
+	bgfx::destroyVertexBuffer(m_quadCornerBuffer);
+
 	bgfx::destroyProgram(m_basicProgram);	
 	bgfx::destroyProgram(m_distanceProgram);	
 	bgfx::destroyProgram(m_distanceSubpixelProgram);	
+	bgfx::destroyProgram(m_basicInstancedProgram);
+	bgfx::destroyProgram(m_distanceInstancedProgram);
+	bgfx::destroyProgram(m_distanceSubpixelInstancedProgram);
 }
 
 void TextBufferManager::init(const char* shaderPath)
@@ -543,15 +2725,48 @@ void TextBufferManager::init(const char* shaderPath)
 	m_vertexDecl.add(bgfx::Attrib::Color0, 4, bgfx::AttribType::Uint8, true);
 	m_vertexDecl.end();
 
+	//the quads of every text buffer share the same indices, they are generated once for the biggest draw
+	const bgfx::Memory* indices = bgfx::alloc(MAX_QUADS_PER_DRAW * 6 * sizeof(uint16_t));
+	uint16_t* index = (uint16_t*)indices->data;
+	for(uint32_t i = 0; i < MAX_QUADS_PER_DRAW; ++i)
+	{
+		uint16_t vertex = (uint16_t)(i * 4);
+		index[0] = vertex + 0;
+		index[1] = vertex + 1;
+		index[2] = vertex + 2;
+		index[3] = vertex + 0;
+		index[4] = vertex + 2;
+		index[5] = vertex + 3;
+		index += 6;
+	}
+	m_quadIndexBuffer = bgfx::createIndexBuffer(indices);
+
+	//the instances are expanded from the corners of a unit quad, in the order of the quad vertices
+	m_cornerDecl.begin();
+	m_cornerDecl.add(bgfx::Attrib::Position, 2, bgfx::AttribType::Float);
+	m_cornerDecl.end();
+	static const float corners[8] = { 0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f, 1.0f, 0.0f };
+	const bgfx::Memory* mem = bgfx::alloc(sizeof(corners));
+	memcpy(mem->data, corners, sizeof(corners));
+	m_quadCornerBuffer = bgfx::createVertexBuffer(mem, m_cornerDecl);
+
+	//the instance records pack the atlas coordinates in base INSTANCE_REGION_PACKING, any bigger atlas would alias the regions
+	assert(m_fontManager->getAtlas()->getTextureSize() <= INSTANCE_REGION_PACKING && "The atlas is too big for the instance records");
+
 	m_u_texColor = bgfx::createUniform("u_texColor", bgfx::UniformType::Uniform1iv);
 	m_u_inverse_gamma = bgfx::createUniform("u_inverse_gamma", bgfx::UniformType::Uniform1f);
+	m_u_inverse_atlas_size = bgfx::createUniform("u_inverse_atlas_size", bgfx::UniformType::Uniform1f);
+
+	//every fragment shader is also paired with the vertex shader of the instanced buffers
+	mem = loadShader(shaderPath, "vs_font_instanced");
+	bgfx::VertexShaderHandle instancedVsh = bgfx::createVertexShader(mem);
 
-	const bgfx::Memory* mem;
 	mem = loadShader(shaderPath, "vs_font_basic");
 	bgfx::VertexShaderHandle vsh = bgfx::createVertexShader(mem);
 	mem = loadShader(shaderPath, "fs_font_basic");
 	bgfx::FragmentShaderHandle fsh = bgfx::createFragmentShader(mem);
 	m_basicProgram = bgfx::createProgram(vsh, fsh);
+	m_basicInstancedProgram = bgfx::createProgram(instancedVsh, fsh);
 	bgfx::destroyVertexShader(vsh);
 	bgfx::destroyFragmentShader(fsh);	
 
@@ -560,6 +2775,7 @@ void TextBufferManager::init(const char* shaderPath)
 	mem = loadShader(shaderPath, "fs_font_distance_field");
 	fsh = bgfx::createFragmentShader(mem);
 	m_distanceProgram = bgfx::createProgram(vsh, fsh);
+	m_distanceInstancedProgram = bgfx::createProgram(instancedVsh, fsh);
 	bgfx::destroyVertexShader(vsh);
 	bgfx::destroyFragmentShader(fsh);
 	
@@ -568,20 +2784,46 @@ void TextBufferManager::init(const char* shaderPath)
 	mem = loadShader(shaderPath, "fs_font_distance_field_subpixel");
 	fsh = bgfx::createFragmentShader(mem);
 	m_distanceSubpixelProgram = bgfx::createProgram(vsh, fsh);
+	m_distanceSubpixelInstancedProgram = bgfx::createProgram(instancedVsh, fsh);
 	bgfx::destroyVertexShader(vsh);
 	bgfx::destroyFragmentShader(fsh);	
+
+	bgfx::destroyVertexShader(instancedVsh);
 }
 
 TextBufferHandle TextBufferManager::createTextBuffer(FontType _type, BufferType bufferType)
 {	
+	if(bufferType == CONSOLE)
+	{
+		return createConsoleBuffer(_type);
+	}
 	uint16_t textIdx = m_textBufferHandles.alloc();
 	BufferCache& bc = m_textBuffers[textIdx];
 	
-	bc.textBuffer = new TextBuffer(m_fontManager);	
+	bc.textBuffer = new (m_textBufferStorage + textIdx * sizeof(TextBuffer)) TextBuffer(m_fontManager, m_storagePool, m_recordPool, bufferType == INSTANCED);	
 	bc.fontType = _type;
 	bc.bufferType = bufferType;	
-	bc.indexBufferHandle = bgfx::invalidHandle;
 	bc.vertexBufferHandle = bgfx::invalidHandle;
+	bc.vertexCapacity = 0;
+	bc.console = NULL;
+	bc.layoutCaching = false;
+
+	TextBufferHandle ret = {textIdx};
+	return  ret;
+}
+
+TextBufferHandle TextBufferManager::createConsoleBuffer(FontType _type, uint32_t maxLineCount, uint32_t maxQuadCount)
+{
+	uint16_t textIdx = m_textBufferHandles.alloc();
+	BufferCache& bc = m_textBuffers[textIdx];
+
+	bc.textBuffer = new (m_textBufferStorage + textIdx * sizeof(TextBuffer)) TextBuffer(m_fontManager, m_storagePool, m_recordPool);
+	bc.fontType = _type;
+	bc.bufferType = CONSOLE;
+	bc.vertexBufferHandle = bgfx::invalidHandle;
+	bc.vertexCapacity = 0;
+	bc.layoutCaching = false;
+	bc.console = new TextConsole(maxLineCount, maxQuadCount, bc.textBuffer->getVertexSize());
 
 	TextBufferHandle ret = {textIdx};
 	return  ret;
@@ -593,8 +2835,10 @@ void TextBufferManager::destroyTextBuffer(TextBufferHandle handle)
 	
 	BufferCache& bc = m_textBuffers[handle.idx];
 	m_textBufferHandles.free(handle.idx);
-	delete bc.textBuffer;
+	bc.textBuffer->~TextBuffer();
 	bc.textBuffer = NULL;
+	delete bc.console;
+	bc.console = NULL;
 
 	if(bc.vertexBufferHandle == bgfx::invalidHandle ) return;
 	
@@ -602,25 +2846,23 @@ void TextBufferManager::destroyTextBuffer(TextBufferHandle handle)
 	{
 	case STATIC:
 		{
-		bgfx::IndexBufferHandle ibh;
 		bgfx::VertexBufferHandle vbh;
-		ibh.idx = bc.indexBufferHandle;
 		vbh.idx = bc.vertexBufferHandle;
-		bgfx::destroyIndexBuffer(ibh);
 		bgfx::destroyVertexBuffer(vbh);
 		}
 
 		break;
 	case DYNAMIC:
-		bgfx::DynamicIndexBufferHandle ibh;
+		{
 		bgfx::DynamicVertexBufferHandle vbh;
-		ibh.idx = bc.indexBufferHandle;
 		vbh.idx = bc.vertexBufferHandle;
-		bgfx::destroyDynamicIndexBuffer(ibh);
 		bgfx::destroyDynamicVertexBuffer(vbh);
+		}
 	
 		break;
 	case TRANSIENT: //naturally destroyed
+	case INSTANCED:
+	case CONSOLE: //the ring owns its vertex buffers
 		break;		
 	}	
 }
@@ -630,109 +2872,237 @@ void TextBufferManager::submitTextBuffer(TextBufferHandle _handle, uint8_t _id,
 	assert(bgfx::invalidHandle != _handle.idx);
 	BufferCache& bc = m_textBuffers[_handle.idx];
 	
-	size_t indexSize = bc.textBuffer->getIndexCount() * bc.textBuffer->getIndexSize();
-	size_t vertexSize = bc.textBuffer->getVertexCount() * bc.textBuffer->getVertexSize();
-	const bgfx::Memory* mem;
+	bc.textBuffer->flushLine();
 
-	bgfx::setTexture(0, m_u_texColor, m_fontManager->getAtlas()->getTextureHandle());
-	float inverse_gamme = 1.0f/2.2f;
-	bgfx::setUniform(m_u_inverse_gamma, &inverse_gamme);
-	
-	switch (bc.fontType)
+	//a console is scrolled by moving its lines in the model transform
+	float consoleTransform[16];
+	const float* transform = NULL;
+	if(bc.bufferType == CONSOLE)
 	{
-	case FONT_TYPE_ALPHA:
-		bgfx::setProgram(m_basicProgram);
-		bgfx::setState( BGFX_STATE_RGB_WRITE | BGFX_STATE_BLEND_FUNC(BGFX_STATE_BLEND_SRC_ALPHA, BGFX_STATE_BLEND_INV_SRC_ALPHA) );
-		break;
-	case FONT_TYPE_DISTANCE:
-		bgfx::setProgram(m_distanceProgram);
-		bgfx::setState( BGFX_STATE_RGB_WRITE | BGFX_STATE_BLEND_FUNC(BGFX_STATE_BLEND_SRC_ALPHA, BGFX_STATE_BLEND_INV_SRC_ALPHA) );
-		break;
-	case FONT_TYPE_DISTANCE_SUBPIXEL:
-		bgfx::setProgram(m_distanceSubpixelProgram);
-		bgfx::setState( BGFX_STATE_RGB_WRITE |BGFX_STATE_BLEND_FUNC(BGFX_STATE_BLEND_FACTOR, BGFX_STATE_BLEND_INV_SRC_COLOR) , bc.textBuffer->getTextColor());
-		break;	
-	}	
+		memset(consoleTransform, 0, sizeof(consoleTransform));
+		consoleTransform[0] = consoleTransform[5] = consoleTransform[10] = consoleTransform[15] = 1.0f;
+		consoleTransform[13] = (float)(bc.console->getBaseY() - bc.console->getScrollY() );
+		transform = consoleTransform;
+		submitConsoleLines(bc, _id, _depth, transform);
+	}
+
+	uint32_t vertexCount = bc.textBuffer->getVertexCount();
+	if(vertexCount == 0)
+	{
+		return;
+	}
+
+	//only the vertices are uploaded, the indices come from the shared quad index buffer
+	size_t vertexSize = vertexCount * bc.textBuffer->getVertexSize();
+	const bgfx::Memory* mem;
+
+	bgfx::VertexBufferHandle vbh;
+	bgfx::DynamicVertexBufferHandle dvbh;
+	bgfx::TransientVertexBuffer tvb;
 
 	switch(bc.bufferType)
 	{
 		case STATIC:
 		{
-			bgfx::IndexBufferHandle ibh;
-			bgfx::VertexBufferHandle vbh;
-
 			if(bc.vertexBufferHandle == bgfx::invalidHandle)
 			{
-				mem = bgfx::alloc(indexSize);
-				memcpy(mem->data, bc.textBuffer->getIndexBuffer(), indexSize);
-				ibh = bgfx::createIndexBuffer(mem);
-
 				mem = bgfx::alloc(vertexSize);
 				memcpy(mem->data, bc.textBuffer->getVertexBuffer(), vertexSize);
 				vbh = bgfx::createVertexBuffer(mem, m_vertexDecl);
 
-				bc.indexBufferHandle = ibh.idx ;
 				bc.vertexBufferHandle = vbh.idx;
 			}else
 			{
-				ibh.idx = bc.indexBufferHandle;
 				vbh.idx = bc.vertexBufferHandle;
 			}
-			bgfx::setVertexBuffer(vbh,  bc.textBuffer->getVertexCount());
-			bgfx::setIndexBuffer(ibh, bc.textBuffer->getIndexCount());
 		}break;
 		case DYNAMIC:
 		{
-			bgfx::DynamicIndexBufferHandle ibh;
-			bgfx::DynamicVertexBufferHandle vbh;
+			dvbh.idx = bc.vertexBufferHandle;
+			if(bc.vertexBufferHandle != bgfx::invalidHandle && vertexCount > bc.vertexCapacity)
+			{
+				//too small for the text, created again bigger
+				bgfx::destroyDynamicVertexBuffer(dvbh);
+				bc.vertexBufferHandle = bgfx::invalidHandle;
+			}
 
 			if(bc.vertexBufferHandle == bgfx::invalidHandle)
 			{
-				mem = bgfx::alloc(indexSize);
-				memcpy(mem->data, bc.textBuffer->getIndexBuffer(), indexSize);
-				ibh = bgfx::createDynamicIndexBuffer(mem);
-
-				mem = bgfx::alloc(vertexSize);
+				//leave room for the text to grow
+				bc.vertexCapacity = vertexCount + vertexCount / 2;
+				mem = bgfx::alloc(bc.vertexCapacity * bc.textBuffer->getVertexSize());
+				memset(mem->data, 0, mem->size);
 				memcpy(mem->data, bc.textBuffer->getVertexBuffer(), vertexSize);
-				vbh = bgfx::createDynamicVertexBuffer(mem, m_vertexDecl);
+				dvbh = bgfx::createDynamicVertexBuffer(mem, m_vertexDecl);
 
-				bc.indexBufferHandle = ibh.idx ;
-				bc.vertexBufferHandle = vbh.idx;
-			}else
+				bc.vertexBufferHandle = dvbh.idx;
+			}else if(bc.textBuffer->getDirtyFirst() < bc.textBuffer->getDirtyEnd())
 			{
-				ibh.idx = bc.indexBufferHandle;
-				vbh.idx = bc.vertexBufferHandle;
-
-				static int i=0;
-				//if(i++ < 5)
-				{				
-				mem = bgfx::alloc(indexSize);
-				memcpy(mem->data, bc.textBuffer->getIndexBuffer(), indexSize);
-				bgfx::updateDynamicIndexBuffer(ibh, mem);
-
-				mem = bgfx::alloc(vertexSize);
-				memcpy(mem->data, bc.textBuffer->getVertexBuffer(), vertexSize);
-				bgfx::updateDynamicVertexBuffer(vbh, mem);				
-				}
+				//the modified vertices are [getDirtyFirst, getDirtyEnd), but updateDynamicVertexBuffer has no offset:
+				//the buffer can only be updated from its first vertex, the upload stops at the end of the modified vertices
+				size_t dirtyEnd = (bc.textBuffer->getDirtyEnd() < vertexCount) ? bc.textBuffer->getDirtyEnd() : vertexCount;
+				size_t dirtySize = dirtyEnd * bc.textBuffer->getVertexSize();
+				mem = bgfx::alloc((uint32_t)dirtySize);
+				memcpy(mem->data, bc.textBuffer->getVertexBuffer(), dirtySize);
+				bgfx::updateDynamicVertexBuffer(dvbh, mem);
 			}
-			bgfx::setVertexBuffer(vbh,  bc.textBuffer->getVertexCount());
-			bgfx::setIndexBuffer(ibh, bc.textBuffer->getIndexCount());
-			
 		}break;
 		case TRANSIENT:
+		case CONSOLE: //the open line
 		{
-			bgfx::TransientIndexBuffer tib;
-			bgfx::TransientVertexBuffer tvb;
-			bgfx::allocTransientIndexBuffer(&tib, bc.textBuffer->getIndexCount());
-			bgfx::allocTransientVertexBuffer(&tvb, bc.textBuffer->getVertexCount(), m_vertexDecl);
-			memcpy(tib.data, bc.textBuffer->getIndexBuffer(), indexSize);
+			bgfx::allocTransientVertexBuffer(&tvb, vertexCount, m_vertexDecl);
 			memcpy(tvb.data, bc.textBuffer->getVertexBuffer(), vertexSize);
-			bgfx::setVertexBuffer(&tvb,  bc.textBuffer->getVertexCount());
-			bgfx::setIndexBuffer(&tib, bc.textBuffer->getIndexCount());
 		}break;	
+		case INSTANCED: //the records are uploaded draw by draw
+			break;
+	}
+	bc.textBuffer->clearDirtySpan();
+
+	//16 bits indices can only address MAX_VERTICES_PER_DRAW vertices, bigger buffers are drawn in several calls
+	for(uint32_t firstVertex = 0; firstVertex < vertexCount; firstVertex += MAX_VERTICES_PER_DRAW)
+	{
+		uint32_t drawVertexCount = vertexCount - firstVertex;
+		if(drawVertexCount > MAX_VERTICES_PER_DRAW)
+		{
+			drawVertexCount = MAX_VERTICES_PER_DRAW;
+		}
+		uint32_t drawIndexCount = drawVertexCount / 4 * 6;
+		setRenderState(bc, bc.bufferType == INSTANCED);
+		if(transform != NULL)
+		{
+			bgfx::setTransform(transform);
+		}
+
+		switch(bc.bufferType)
+		{
+			case STATIC:
+				bgfx::setVertexBuffer(vbh, firstVertex, drawVertexCount);
+				break;
+			case DYNAMIC:
+				bgfx::setVertexBuffer(dvbh, firstVertex, drawVertexCount);
+				break;
+			case TRANSIENT:
+			case CONSOLE:
+				bgfx::setVertexBuffer(&tvb, firstVertex, drawVertexCount);
+				break;
+			case INSTANCED:
+			{
+				//each record is an instance of the unit quad
+				uint32_t instanceCount = drawVertexCount / 4;
+				uint32_t instanceSize = bc.textBuffer->getInstanceSize();
+				const bgfx::InstanceDataBuffer* idb = bgfx::allocInstanceDataBuffer(instanceCount, (uint16_t)instanceSize);
+				memcpy(idb->data, bc.textBuffer->getInstanceBuffer() + firstVertex / 4 * instanceSize, instanceCount * instanceSize);
+				bgfx::setInstanceDataBuffer(idb);
+				bgfx::setVertexBuffer(m_quadCornerBuffer);
+				drawIndexCount = 6;
+
+				float inverseAtlasSize = 1.0f / m_fontManager->getAtlas()->getTextureSize();
+				bgfx::setUniform(m_u_inverse_atlas_size, &inverseAtlasSize);
+			}break;
+		}
+		bgfx::setIndexBuffer(m_quadIndexBuffer, 0, drawIndexCount);
+
+		bgfx::submit(_id, _depth);
+	}
+}
+
+void TextBufferManager::setRenderState(const BufferCache& bc, bool instanced)
+{
+	bgfx::setTexture(0, m_u_texColor, m_fontManager->getAtlas()->getTextureHandle());
+	float inverse_gamme = 1.0f/2.2f;
+	bgfx::setUniform(m_u_inverse_gamma, &inverse_gamme);
+	
+	switch (bc.fontType)
+	{
+	case FONT_TYPE_ALPHA:
+		bgfx::setProgram(instanced ? m_basicInstancedProgram : m_basicProgram);
+		bgfx::setState( BGFX_STATE_RGB_WRITE | BGFX_STATE_BLEND_FUNC(BGFX_STATE_BLEND_SRC_ALPHA, BGFX_STATE_BLEND_INV_SRC_ALPHA) );
+		break;
+	case FONT_TYPE_DISTANCE:
+		bgfx::setProgram(instanced ? m_distanceInstancedProgram : m_distanceProgram);
+		bgfx::setState( BGFX_STATE_RGB_WRITE | BGFX_STATE_BLEND_FUNC(BGFX_STATE_BLEND_SRC_ALPHA, BGFX_STATE_BLEND_INV_SRC_ALPHA) );
+		break;
+	case FONT_TYPE_DISTANCE_SUBPIXEL:
+		bgfx::setProgram(instanced ? m_distanceSubpixelInstancedProgram : m_distanceSubpixelProgram);
+		bgfx::setState( BGFX_STATE_RGB_WRITE |BGFX_STATE_BLEND_FUNC(BGFX_STATE_BLEND_FACTOR, BGFX_STATE_BLEND_INV_SRC_COLOR) , bc.textBuffer->getTextColor());
+		break;	
+	}	
+}
+
+void TextBufferManager::moveConsoleLines(BufferCache& bc)
+{
+	TextBuffer& textBuffer = *bc.textBuffer;
+	uint32_t lineCount = textBuffer.getLineCount();
+	if(lineCount < 2)
+	{
+		return;
 	}
 
-	bgfx::submit(_id, _depth);
+	const uint8_t* vertices = textBuffer.getVertexBuffer();
+	uint32_t vertexSize = textBuffer.getVertexSize();
+	for(uint32_t i = 0; i + 1 < lineCount; ++i)
+	{
+		const TextBuffer::LineRecord& line = textBuffer.getLine(i);
+		bc.console->appendLine(vertices + line.firstVertex * vertexSize, (uint32_t)line.vertexCount, line.top, line.height);
+	}
+	textBuffer.discardClosedLines();
+
+	//the lines are moved back to the origin once the oldest one is farther from it than the lines kept span,
+	//so that the vertices of the ring are rewritten once in a while and not at each eviction
+	float top = (bc.console->getLineCount() > 0) ? bc.console->getLine(0).top : 0.0f;
+	float bottom = textBuffer.getLine(0).top;
+	if(top >= CONSOLE_REBASE_DISTANCE && top >= bottom - top)
+	{
+		bc.console->offsetLines(-top);
+		textBuffer.offsetText(-top);
+	}
+}
+
+void TextBufferManager::submitConsoleLines(BufferCache& bc, uint8_t _id, int32_t _depth, const float* transform)
+{
+	TextConsole& console = *bc.console;
+	console.update(m_vertexDecl);
+
+	uint32_t lineCount = console.getLineCount();
+	//the view in the coordinates of the lines
+	float viewTop = (float)(console.getViewTop() + console.getScrollY() - console.getBaseY() );
+	float viewBottom = viewTop + console.getViewHeight();
+	bool clip = console.getViewHeight() > 0.0f;
+
+	//the visible lines are drawn in spans of consecutive vertices, cut at the end of the ring and at the pages boundaries
+	uint32_t spanFirst = 0;
+	uint32_t spanEnd = 0;
+	for(uint32_t i = clip ? console.findLine(viewTop) : 0; ; ++i)
+	{
+		bool visible = i < lineCount && (!clip || console.getLine(i).top < viewBottom);
+		if(visible && console.getLine(i).firstVertex == spanEnd)
+		{
+			spanEnd += console.getLine(i).vertexCount;
+			continue;
+		}
+
+		while(spanFirst < spanEnd)
+		{
+			uint32_t page = spanFirst / CONSOLE_PAGE_VERTICES;
+			uint32_t drawEnd = (page + 1) * CONSOLE_PAGE_VERTICES;
+			drawEnd = (spanEnd < drawEnd) ? spanEnd : drawEnd;
+			uint32_t drawVertexCount = drawEnd - spanFirst;
+
+			setRenderState(bc, false);
+			bgfx::setTransform(transform);
+			bgfx::setVertexBuffer(console.getPage(page), spanFirst - page * CONSOLE_PAGE_VERTICES, drawVertexCount);
+			bgfx::setIndexBuffer(m_quadIndexBuffer, 0, drawVertexCount / 4 * 6);
+			bgfx::submit(_id, _depth);
+			spanFirst = drawEnd;
+		}
+
+		if(!visible)
+		{
+			break;
+		}
+		spanFirst = console.getLine(i).firstVertex;
+		spanEnd = spanFirst + console.getLine(i).vertexCount;
+	}
 }
 
 void TextBufferManager::submitTextBufferMask(TextBufferHandle _handle, uint32_t _viewMask, int32_t _depth)
@@ -788,18 +3158,198 @@ void TextBufferManager::setPenPosition(TextBufferHandle _handle, float x, float
 	 bc.textBuffer->setPenPosition(x,y); 
 }
 
-void TextBufferManager::appendText(TextBufferHandle _handle, FontHandle fontHandle, const char * _string)
+void TextBufferManager::setWrapping(TextBufferHandle _handle, TextWrapMode mode, float width)
 {
 	assert( _handle.idx != bgfx::invalidHandle);
 	BufferCache& bc = m_textBuffers[_handle.idx];
-	bc.textBuffer->appendText(fontHandle, _string);
+	bc.textBuffer->setWrapping(mode, width);
+}
+
+void TextBufferManager::appendText(TextBufferHandle _handle, FontHandle fontHandle, const char * _string)
+{
+	appendText(_handle, fontHandle, _string, (uint32_t)strlen(_string));
+}
+
+void TextBufferManager::appendText(TextBufferHandle _handle, FontHandle fontHandle, const char * _string, uint32_t length)
+{
+	assert( _handle.idx != bgfx::invalidHandle);
+	m_decoder->decodeUtf8(_string, length);
+	appendCodePoints(m_textBuffers[_handle.idx], fontHandle);
 }
 
 void TextBufferManager::appendText(TextBufferHandle _handle, FontHandle fontHandle, const wchar_t * _string)
+{
+	appendText(_handle, fontHandle, _string, (uint32_t)wcslen(_string));
+}
+
+void TextBufferManager::appendText(TextBufferHandle _handle, FontHandle fontHandle, const wchar_t * _string, uint32_t length)
+{
+	assert( _handle.idx != bgfx::invalidHandle);
+	m_decoder->decode(_string, length);
+	appendCodePoints(m_textBuffers[_handle.idx], fontHandle);
+}
+
+void TextBufferManager::appendText(TextBufferHandle _handle, FontHandle fontHandle, const uint16_t * _string, uint32_t length)
+{
+	assert( _handle.idx != bgfx::invalidHandle);
+	m_decoder->decodeUtf16(_string, length);
+	appendCodePoints(m_textBuffers[_handle.idx], fontHandle);
+}
+
+void TextBufferManager::appendText(TextBufferHandle _handle, FontHandle fontHandle, const uint32_t * _string, uint32_t length)
+{
+	assert( _handle.idx != bgfx::invalidHandle);
+	m_decoder->decodeUtf32(_string, length);
+	appendCodePoints(m_textBuffers[_handle.idx], fontHandle);
+}
+
+void TextBufferManager::appendCodePoints(BufferCache& bc, FontHandle fontHandle)
+{
+	const CodePoint_t* codePoints = m_decoder->getCodePoints();
+	uint32_t count = m_decoder->getCount();
+	if(bc.textBuffer->getWrapMode() != WRAP_NONE)
+	{
+		bc.textBuffer->appendText(fontHandle, m_brokenTextCache->get(fontHandle, codePoints, count));
+	}else if(bc.layoutCaching && m_layoutCache->setKey(*bc.textBuffer, fontHandle, codePoints, count))
+	{
+		const CachedLayout* layout = m_layoutCache->find();
+		if(layout != NULL)
+		{
+			bc.textBuffer->appendLayout(fontHandle, *layout);
+		}else
+		{
+			bc.textBuffer->beginLayoutCapture(fontHandle);
+			bc.textBuffer->appendText(fontHandle, codePoints, count);
+			bc.textBuffer->endLayoutCapture(m_layoutCache->insert());
+		}
+	}else
+	{
+		bc.textBuffer->appendText(fontHandle, codePoints, count);
+	}
+	if(bc.console != NULL)
+	{
+		moveConsoleLines(bc);
+	}
+}
+
+TextRectangle TextBufferManager::measureText(FontHandle fontHandle, const char * _string, TextLineMetrics* outLines, uint32_t maxLineCount, uint32_t* outLineCount)
+{
+	m_decoder->decodeUtf8(_string, (uint32_t)strlen(_string));
+	return measureCodePoints(fontHandle, outLines, maxLineCount, outLineCount);
+}
+
+TextRectangle TextBufferManager::measureText(FontHandle fontHandle, const wchar_t * _string, TextLineMetrics* outLines, uint32_t maxLineCount, uint32_t* outLineCount)
+{
+	m_decoder->decode(_string, (uint32_t)wcslen(_string));
+	return measureCodePoints(fontHandle, outLines, maxLineCount, outLineCount);
+}
+
+TextRectangle TextBufferManager::measureCodePoints(FontHandle fontHandle, TextLineMetrics* outLines, uint32_t maxLineCount, uint32_t* outLineCount)
+{
+	assert(fontHandle.idx != bgfx::invalidHandle);
+	TextMeasurer measurer(m_fontManager, outLines, maxLineCount);
+	const CodePoint_t* codePoints = m_decoder->getCodePoints();
+	for(uint32_t i = 0, count = m_decoder->getCount(); i < count; ++i)
+	{
+		measurer.pushCodePoint(fontHandle, codePoints[i]);
+	}
+	return measurer.finish(fontHandle, outLineCount);
+}
+
+void TextBufferManager::replaceRange(TextBufferHandle _handle, FontHandle fontHandle, uint32_t start, uint32_t end, const char * _string)
+{
+	assert( _handle.idx != bgfx::invalidHandle);
+	BufferCache& bc = m_textBuffers[_handle.idx];
+	m_decoder->decodeUtf8(_string, (uint32_t)strlen(_string));
+	bc.textBuffer->replaceRange(fontHandle, start, end, m_decoder->getCodePoints(), m_decoder->getCount());
+	if(bc.console != NULL)
+	{
+		moveConsoleLines(bc);
+	}
+}
+
+void TextBufferManager::replaceRange(TextBufferHandle _handle, FontHandle fontHandle, uint32_t start, uint32_t end, const wchar_t * _string)
+{
+	assert( _handle.idx != bgfx::invalidHandle);
+	BufferCache& bc = m_textBuffers[_handle.idx];
+	m_decoder->decode(_string, (uint32_t)wcslen(_string));
+	bc.textBuffer->replaceRange(fontHandle, start, end, m_decoder->getCodePoints(), m_decoder->getCount());
+	if(bc.console != NULL)
+	{
+		moveConsoleLines(bc);
+	}
+}
+
+uint32_t TextBufferManager::getTextLength(TextBufferHandle _handle)
+{
+	assert( _handle.idx != bgfx::invalidHandle);
+	BufferCache& bc = m_textBuffers[_handle.idx];
+	return bc.textBuffer->getTextLength();
+}
+
+uint32_t TextBufferManager::hitTest(TextBufferHandle _handle, float x, float y)
+{
+	assert( _handle.idx != bgfx::invalidHandle);
+	BufferCache& bc = m_textBuffers[_handle.idx];
+	if(bc.console != NULL)
+	{
+		y = (float)(y - bc.console->getBaseY() );
+	}
+	return bc.textBuffer->hitTest(x, y);
+}
+
+TextRectangle TextBufferManager::getCaretRectangle(TextBufferHandle _handle, uint32_t index)
+{
+	assert( _handle.idx != bgfx::invalidHandle);
+	BufferCache& bc = m_textBuffers[_handle.idx];
+	TextRectangle caret = bc.textBuffer->getCaretRectangle(index);
+	if(bc.console != NULL)
+	{
+		caret.y = (float)(caret.y + bc.console->getBaseY() );
+	}
+	return caret;
+}
+
+void TextBufferManager::setLayoutCaching(TextBufferHandle _handle, bool enabled)
+{
+	assert( _handle.idx != bgfx::invalidHandle);
+	BufferCache& bc = m_textBuffers[_handle.idx];
+	bc.layoutCaching = enabled;
+}
+
+uint32_t TextBufferManager::getLayoutCacheHitCount() const
+{
+	return m_layoutCache->getHitCount();
+}
+
+uint32_t TextBufferManager::getLayoutCacheMissCount() const
+{
+	return m_layoutCache->getMissCount();
+}
+
+void TextBufferManager::resetLayoutCacheCounters()
+{
+	m_layoutCache->resetCounters();
+}
+
+void TextBufferManager::setConsoleScroll(TextBufferHandle _handle, float scrollY, float viewTop, float viewHeight)
+{
+	assert( _handle.idx != bgfx::invalidHandle);
+	BufferCache& bc = m_textBuffers[_handle.idx];
+	assert(bc.console != NULL && "Not a console buffer");
+	bc.console->setScroll(scrollY, viewTop, viewHeight);
+}
+
+void TextBufferManager::getConsoleExtents(TextBufferHandle _handle, float& top, float& bottom)
 {
 	assert( _handle.idx != bgfx::invalidHandle);
 	BufferCache& bc = m_textBuffers[_handle.idx];
-	bc.textBuffer->appendText(fontHandle, _string);
+	assert(bc.console != NULL && "Not a console buffer");
+	bc.textBuffer->flushLine();
+	const TextBuffer::LineRecord& openLine = bc.textBuffer->getLine(bc.textBuffer->getLineCount() - 1);
+	double baseY = bc.console->getBaseY();
+	top = (float)(baseY + ((bc.console->getLineCount() > 0) ? bc.console->getLine(0).top : openLine.top) );
+	bottom = (float)(baseY + openLine.top + openLine.height);
 }
 
 void TextBufferManager::clearTextBuffer(TextBufferHandle _handle)
@@ -807,6 +3357,10 @@ void TextBufferManager::clearTextBuffer(TextBufferHandle _handle)
 	assert( _handle.idx != bgfx::invalidHandle);
 	BufferCache& bc = m_textBuffers[_handle.idx];
 	bc.textBuffer->clearTextBuffer();
+	if(bc.console != NULL)
+	{
+		bc.console->clear();
+	}
 }
 
 }
@@ -14,7 +14,13 @@ enum BufferType
 {
 	STATIC,
 	DYNAMIC ,
-	TRANSIENT
+	TRANSIENT,
+	/// one compact record per glyph quad expanded by the vertex shader, the records are uploaded at each submit like TRANSIENT
+	/// @remark require hardware instancing and an atlas of at most 4096*4096 texels per face
+	INSTANCED,
+	/// log console, the lines are moved to a ring of vertices once closed and the oldest ones are evicted (see createConsoleBuffer)
+	/// @remark only the vertices of the new lines are uploaded, the open line is uploaded at each submit like TRANSIENT
+	CONSOLE
 };
 
 /// special style effect (can be combined)
@@ -27,16 +33,59 @@ enum TextStyleFlags
 	STYLE_BACKGROUND       = 1<<3,
 };
 
+/// layout of the lines longer than the wrap width of a text buffer
+enum TextWrapMode
+{
+	/// lines only break at line feeds
+	WRAP_NONE,
+	/// lines also break at the break opportunities (spaces, dashes, around ideographs...) to stay within the width,
+	/// a word longer than the width is broken between two glyphs
+	WRAP_WORD,
+	/// lines only break at line feeds, the ones longer than the width are truncated and end with an ellipsis
+	WRAP_ELLIPSIS
+};
+
+/// extents of a measured text, in pixels
+struct TextRectangle
+{
+	float x,y;
+	float width,height;
+};
+
+/// layout of a line of a measured text, in pixels
+struct TextLineMetrics
+{
+	/// distance the pen moved along the line
+	float width;
+	/// position of the baseline from the top of the text
+	float baseline;
+	/// tallest ascender and lowest descender of the fonts of the line
+	float ascender;
+	float descender;
+};
+
 class TextBuffer;
+class BlockPool;
+class BrokenTextCache;
+class TextConsole;
+class LayoutCache;
+class TextDecoder;
 class TextBufferManager
 {
 public:
-	TextBufferManager(FontManager* fontManager = NULL);
+	/// @param maxTextBufferCount maximum number of text buffers alive at once
+	TextBufferManager(FontManager* fontManager = NULL, uint16_t maxTextBufferCount = 64);
 	~TextBufferManager();
 	
 	void init(const char* shaderPath);
 
 	TextBufferHandle createTextBuffer(FontType type, BufferType bufferType);
+
+	/// create a CONSOLE text buffer keeping at most maxLineCount lines and maxQuadCount quads, the oldest lines are evicted
+	/// @remark the text of the buffer (see replaceRange) is the one of its open line only
+	/// @remark the lines are moved back near the origin once in a while and the offset is applied in the model transform, so that the floats
+	/// of their vertices don't lose precision as the text grows, the scroll, the extents and the carets remain in the coordinates of the text
+	TextBufferHandle createConsoleBuffer(FontType type, uint32_t maxLineCount = 1024, uint32_t maxQuadCount = 65536);
 	void destroyTextBuffer(TextBufferHandle handle);
 	void submitTextBuffer(TextBufferHandle handle, uint8_t id, int32_t depth = 0);
 	void submitTextBufferMask(TextBufferHandle handle, uint32_t viewMask, int32_t depth = 0);
@@ -51,40 +100,142 @@ public:
 	
 	void setPenPosition(TextBufferHandle handle, float x, float y);
 
+	/// wrap or truncate the text appended from now on to lines of at most width pixels, measured from the origin of the buffer
+	/// @remark the break opportunities of the strings are cached, appending the same string again at another width only reassigns its lines
+	void setWrapping(TextBufferHandle handle, TextWrapMode mode, float width = 0.0f);
+
 	/// append an ASCII/utf-8 string to the buffer using current pen position and color
+	/// @remark code points missing from the font are taken from its fallback chain (see FontManager::setFallbackFont)
 	void appendText(TextBufferHandle _handle, FontHandle fontHandle, const char * _string);
 
+	/// append the first length bytes of an utf-8 string, e.g. a substring or a string not null terminated
+	/// @remark the runs of ASCII characters are decoded 16 bytes at once
+	void appendText(TextBufferHandle _handle, FontHandle fontHandle, const char * _string, uint32_t length);
+
 	/// append a wide char unicode string to the buffer using current pen position and color
+	/// @remark wide chars are decoded as utf-16 where they are 16 bits wide (surrogate pairs included), as utf-32 otherwise
 	void appendText(TextBufferHandle _handle, FontHandle fontHandle, const wchar_t * _string);	
 
+	/// append the first length wide chars of a string
+	void appendText(TextBufferHandle _handle, FontHandle fontHandle, const wchar_t * _string, uint32_t length);
+
+	/// append length code units of an utf-16 string, an unpaired surrogate is appended as U+FFFD
+	void appendText(TextBufferHandle _handle, FontHandle fontHandle, const uint16_t * _string, uint32_t length);
+
+	/// append length code points of an utf-32 string
+	void appendText(TextBufferHandle _handle, FontHandle fontHandle, const uint32_t * _string, uint32_t length);
+
+	/// replace the code points [start, end) of the text of the buffer by an ASCII/utf-8 string, using the current color and style
+	/// @remark only the lines spanned by the range are laid out again, the following lines are moved when the range changes in height
+	/// or in number of glyphs
+	/// @remark DYNAMIC buffers then upload the vertices [0, dirtyEnd), dirtyEnd being the end of the last vertex modified: bgfx updates
+	/// a dynamic vertex buffer from its first vertex only. The first vertex modified is tracked as well
+	/// so that the upload can start there once the update takes an offset
+	/// @remark wrapped buffers (see setWrapping) are rejected: the call asserts, and leaves the buffer untouched in release builds
+	void replaceRange(TextBufferHandle _handle, FontHandle fontHandle, uint32_t start, uint32_t end, const char * _string);
+
+	/// replace the code points [start, end) of the text of the buffer by a wide char unicode string, using the current color and style
+	void replaceRange(TextBufferHandle _handle, FontHandle fontHandle, uint32_t start, uint32_t end, const wchar_t * _string);
+
+	/// keep the layout of the strings without line feed appended to the buffer: appending one again with the same font, style and
+	/// subpixel pen offset copies its quads instead of laying it out (e.g. the labels of an UI appended to a TRANSIENT buffer each frame)
+	/// @remark the layouts are shared by every buffer, the least recently used ones are evicted
+	void setLayoutCaching(TextBufferHandle _handle, bool enabled);
+
+	/// number of appends that found, or missed, their layout in the cache since the last reset
+	uint32_t getLayoutCacheHitCount() const;
+	uint32_t getLayoutCacheMissCount() const;
+	void resetLayoutCacheCounters();
+
+	/// number of code points appended to the buffer, line feeds included
+	uint32_t getTextLength(TextBufferHandle _handle);
+
+	/// index of the code point of the text of the buffer whose caret is the closest to the point (x, y), e.g. to place the caret where the user clicked
+	/// @remark the line is found by its top and the code point by its caret in logarithmic time, the text is not laid out again
+	/// and the vertices of the open line are not flushed (a DYNAMIC buffer is not updated by a query)
+	/// @remark a point right of a line gives the index of its line feed, or of the last code point of a wrapped line
+	uint32_t hitTest(TextBufferHandle _handle, float x, float y);
+
+	/// caret before the code point index of the text of the buffer (after the text if index is its length), as a zero width rectangle as high as its line
+	/// @remark the code points without a glyph of their own (line feeds, inside of a ligature, spaces at a wrap, code points replaced by an ellipsis)
+	/// share the caret of the next code point of their line, or the end of the line
+	TextRectangle getCaretRectangle(TextBufferHandle _handle, uint32_t index);
+
+	/// scroll a console buffer: its lines are drawn moved up by scrollY pixels (through the model transform, they are not laid out again)
+	/// and only the ones crossing the view [viewTop, viewTop + viewHeight] once moved are submitted, all of them if viewHeight is 0
+	void setConsoleScroll(TextBufferHandle _handle, float scrollY, float viewTop = 0.0f, float viewHeight = 0.0f);
+
+	/// vertical extent of the lines of a console buffer, from the top of the oldest line kept to the bottom of the open one
+	void getConsoleExtents(TextBufferHandle _handle, float& top, float& bottom);
+
 	/// Clear the text buffer and reset its state (pen/color)
 	void clearTextBuffer(TextBufferHandle _handle);
 		
-	/// return the size of the text 
-	//Rectangle measureText(FontHandle fontHandle, const char * _string);
-	//Rectangle measureText(FontHandle fontHandle, const wchar_t * _string);
+	/// return the size of an ASCII/utf-8 string laid out like appendText does, from the pen position of its first line
+	/// @remark only the glyph metrics are read, no glyph is baked in the atlas
+	/// @param outLines optional array receiving the metrics of the first maxLineCount lines
+	/// @param outLineCount optional, receive the number of lines of the text (maxLineCount may be smaller)
+	TextRectangle measureText(FontHandle fontHandle, const char * _string, TextLineMetrics* outLines = NULL, uint32_t maxLineCount = 0, uint32_t* outLineCount = NULL);
+
+	/// return the size of a wide char unicode string laid out like appendText does
+	TextRectangle measureText(FontHandle fontHandle, const wchar_t * _string, TextLineMetrics* outLines = NULL, uint32_t maxLineCount = 0, uint32_t* outLineCount = NULL);
 
 private:
 	
 	struct BufferCache
 	{
-		uint16_t indexBufferHandle;
 		uint16_t vertexBufferHandle;
+		// number of vertices of the DYNAMIC vertex buffer
+		uint32_t vertexCapacity;
 		TextBuffer* textBuffer;
+		// ring of the closed lines of a CONSOLE buffer, NULL for the other types
+		TextConsole* console;
+		// the layouts of the strings appended are cached
+		bool layoutCaching;
 		BufferType bufferType;
 		FontType fontType;		
 	};
 
+	void setRenderState(const BufferCache& bc, bool instanced);
+	/// append the code points of the decoder to the buffer
+	void appendCodePoints(BufferCache& bc, FontHandle fontHandle);
+	/// measure the code points of the decoder
+	TextRectangle measureCodePoints(FontHandle fontHandle, TextLineMetrics* outLines, uint32_t maxLineCount, uint32_t* outLineCount);
+	/// move the closed lines of a console buffer to its ring
+	void moveConsoleLines(BufferCache& bc);
+	void submitConsoleLines(BufferCache& bc, uint8_t id, int32_t depth, const float* transform);
+
 	BufferCache* m_textBuffers;
 	bx::HandleAlloc m_textBufferHandles;
+	//storage of the text buffer objects, one slot per handle
+	uint8_t* m_textBufferStorage;
+	//vertex storage of the text buffers
+	BlockPool* m_storagePool;
+	//text, caret, style and line records of the text buffers
+	BlockPool* m_recordPool;
 	FontManager* m_fontManager;
+	//strings appended with wrapping, cut at their break opportunities
+	BrokenTextCache* m_brokenTextCache;
+	//layouts of the strings appended to the buffers with layout caching
+	LayoutCache* m_layoutCache;
+	//code points of the last string received, decoded once for the layout, the caches and the measures
+	TextDecoder* m_decoder;
 	bgfx::VertexDecl m_vertexDecl;
+	//quad indices shared by every text buffer, see MAX_QUADS_PER_DRAW
+	bgfx::IndexBufferHandle m_quadIndexBuffer;
+	//corners of the unit quad instanced by the INSTANCED buffers
+	bgfx::VertexDecl m_cornerDecl;
+	bgfx::VertexBufferHandle m_quadCornerBuffer;
 	bgfx::UniformHandle m_u_texColor;
 	bgfx::UniformHandle m_u_inverse_gamma;
+	bgfx::UniformHandle m_u_inverse_atlas_size;
 	//shaders program
 	bgfx::ProgramHandle m_basicProgram;
 	bgfx::ProgramHandle m_distanceProgram;
 	bgfx::ProgramHandle m_distanceSubpixelProgram;
+	bgfx::ProgramHandle m_basicInstancedProgram;
+	bgfx::ProgramHandle m_distanceInstancedProgram;
+	bgfx::ProgramHandle m_distanceSubpixelInstancedProgram;
 };
 
 }
@@ -0,0 +1,254 @@
+/* Copyright 2013 Jeremie Roy. All rights reserved.
+ * License: http://www.opensource.org/licenses/BSD-2-Clause
+*/
+//64 bits off_t for fseeko/ftello on 32 bits platforms, it must be defined before stdio.h is included
+#if !defined(_MSC_VER) && !defined(_FILE_OFFSET_BITS)
+#define _FILE_OFFSET_BITS 64
+#endif
+#include "text_document.h"
+
+#include <assert.h>
+#include <string.h>
+
+namespace bgfx_font
+{
+
+/// bytes read from the file at once
+const uint32_t DOCUMENT_READ_SIZE = 64 * 1024;
+/// bytes of a line laid out, the end of the longer lines is not shown
+const uint32_t DOCUMENT_MAX_LINE_LENGTH = 4096;
+
+/// fseek and ftell with 64 bits offsets, the documents may be bigger than 4GB
+static int seekFile(FILE* file, uint64_t offset, int origin)
+{
+#if defined(_MSC_VER)
+	return _fseeki64(file, (__int64)offset, origin);
+#else
+	return fseeko(file, (off_t)offset, origin);
+#endif
+}
+
+static int64_t tellFile(FILE* file)
+{
+#if defined(_MSC_VER)
+	return _ftelli64(file);
+#else
+	return (int64_t)ftello(file);
+#endif
+}
+
+TextDocumentView::TextDocumentView(TextBufferManager* textBufferManager, TextBufferHandle textBuffer, FontHandle fontHandle, uint32_t linesPerEntry, uint32_t marginLineCount):
+	m_textBufferManager(textBufferManager), m_textBuffer(textBuffer), m_fontHandle(fontHandle), m_linesPerEntry(linesPerEntry), m_marginLineCount(marginLineCount)
+{
+	assert(textBufferManager != NULL && "A TextDocumentView needs a TextBufferManager");
+	assert(linesPerEntry > 0 && "There must be at least one line per index entry");
+	//the blank lines are laid out as a space to keep their height
+	m_lineHeight = m_textBufferManager->measureText(fontHandle, " ").height;
+
+	m_file = NULL;
+	m_fileSize = 0;
+	m_lineIndexCapacity = 1024;
+	m_lineIndex = new uint64_t[m_lineIndexCapacity];
+	m_lineIndexCount = 0;
+	m_indexedBytes = 0;
+	m_lineCount = 0;
+	m_windowFirstLine = 0;
+	m_windowLineCount = 0;
+	m_readBuffer = new uint8_t[DOCUMENT_READ_SIZE];
+	m_line = new char[DOCUMENT_MAX_LINE_LENGTH];
+	m_lineLength = 0;
+}
+
+TextDocumentView::~TextDocumentView()
+{
+	//the text buffer may already be destroyed
+	if(m_file != NULL)
+	{
+		fclose(m_file);
+	}
+	delete [] m_lineIndex;
+	delete [] m_readBuffer;
+	delete [] m_line;
+}
+
+bool TextDocumentView::open(const char* filePath)
+{
+	close();
+	m_file = fopen(filePath, "rb");
+	if(m_file == NULL)
+	{
+		return false;
+	}
+
+	int64_t fileSize = -1;
+	if(seekFile(m_file, 0, SEEK_END) == 0)
+	{
+		fileSize = tellFile(m_file);
+	}
+	if(fileSize < 0)
+	{
+		close();
+		return false;
+	}
+
+	m_fileSize = (uint64_t)fileSize;
+	m_lineIndex[0] = 0;
+	m_lineIndexCount = 1;
+	return true;
+}
+
+void TextDocumentView::close()
+{
+	if(m_file != NULL)
+	{
+		fclose(m_file);
+		m_file = NULL;
+	}
+	m_fileSize = 0;
+	m_lineIndexCount = 0;
+	m_indexedBytes = 0;
+	m_lineCount = 0;
+	m_windowFirstLine = 0;
+	m_windowLineCount = 0;
+	m_textBufferManager->clearTextBuffer(m_textBuffer);
+}
+
+bool TextDocumentView::indexStep(uint32_t maxBytes)
+{
+	if(m_file == NULL || isIndexed())
+	{
+		return true;
+	}
+
+	seekFile(m_file, m_indexedBytes, SEEK_SET);
+	uint64_t remaining = m_fileSize - m_indexedBytes;
+	remaining = (maxBytes < remaining) ? maxBytes : remaining;
+	while(remaining > 0)
+	{
+		uint32_t readSize = (remaining < DOCUMENT_READ_SIZE) ? (uint32_t)remaining : DOCUMENT_READ_SIZE;
+		uint32_t count = (uint32_t)fread(m_readBuffer, 1, readSize, m_file);
+		if(count == 0)
+		{
+			//the file was truncated since it was opened
+			m_fileSize = m_indexedBytes;
+			break;
+		}
+
+		for(uint32_t i = 0; i < count; ++i)
+		{
+			if(m_readBuffer[i] != '\n')
+			{
+				continue;
+			}
+			++m_lineCount;
+			if(m_lineCount % m_linesPerEntry == 0)
+			{
+				if(m_lineIndexCount == m_lineIndexCapacity)
+				{
+					uint64_t* lineIndex = new uint64_t[m_lineIndexCapacity * 2];
+					memcpy(lineIndex, m_lineIndex, m_lineIndexCount * sizeof(uint64_t));
+					delete [] m_lineIndex;
+					m_lineIndex = lineIndex;
+					m_lineIndexCapacity *= 2;
+				}
+				m_lineIndex[m_lineIndexCount++] = m_indexedBytes + i + 1;
+			}
+		}
+		m_indexedBytes += count;
+		remaining -= count;
+
+		//the last line may not end with a line feed
+		if(isIndexed() && m_readBuffer[count - 1] != '\n')
+		{
+			++m_lineCount;
+		}
+	}
+	return isIndexed();
+}
+
+bool TextDocumentView::scrollTo(uint32_t firstLine, uint32_t lineCount)
+{
+	if(m_file == NULL)
+	{
+		return false;
+	}
+
+	firstLine = (firstLine < m_lineCount) ? firstLine : m_lineCount;
+	uint32_t endLine = (lineCount < m_lineCount - firstLine) ? firstLine + lineCount : m_lineCount;
+	firstLine = (firstLine < endLine) ? firstLine : endLine;
+	if(firstLine >= m_windowFirstLine && endLine <= m_windowFirstLine + m_windowLineCount)
+	{
+		return false;
+	}
+
+	uint32_t windowFirstLine = (firstLine > m_marginLineCount) ? firstLine - m_marginLineCount : 0;
+	uint32_t windowEndLine = (m_marginLineCount < m_lineCount - endLine) ? endLine + m_marginLineCount : m_lineCount;
+	layoutWindow(windowFirstLine, windowEndLine - windowFirstLine);
+	return true;
+}
+
+void TextDocumentView::layoutWindow(uint32_t firstLine, uint32_t lineCount)
+{
+	m_textBufferManager->clearTextBuffer(m_textBuffer);
+	m_windowFirstLine = firstLine;
+	m_windowLineCount = lineCount;
+	if(lineCount == 0)
+	{
+		return;
+	}
+
+	//the lines between the closest entry of the index and the window are read and skipped
+	uint32_t line = firstLine / m_linesPerEntry * m_linesPerEntry;
+	uint32_t endLine = firstLine + lineCount;
+	seekFile(m_file, m_lineIndex[firstLine / m_linesPerEntry], SEEK_SET);
+	m_lineLength = 0;
+	while(line < endLine)
+	{
+		uint32_t count = (uint32_t)fread(m_readBuffer, 1, DOCUMENT_READ_SIZE, m_file);
+		if(count == 0)
+		{
+			//last line of the file, without line feed
+			if(line >= firstLine)
+			{
+				appendLine();
+			}
+			break;
+		}
+
+		for(uint32_t i = 0; i < count && line < endLine; ++i)
+		{
+			char c = (char)m_readBuffer[i];
+			if(c == '\n')
+			{
+				if(line >= firstLine)
+				{
+					appendLine();
+				}
+				++line;
+			}else if(line >= firstLine && m_lineLength < DOCUMENT_MAX_LINE_LENGTH)
+			{
+				m_line[m_lineLength++] = c;
+			}
+		}
+	}
+}
+
+void TextDocumentView::appendLine()
+{
+	if(m_lineLength > 0 && m_line[m_lineLength - 1] == '\r')
+	{
+		--m_lineLength;
+	}
+	if(m_lineLength == 0)
+	{
+		m_line[m_lineLength++] = ' ';
+	}
+	uint32_t length = m_lineLength;
+	m_lineLength = 0;
+
+	//the line feed is appended on its own, a multi-bytes sequence cut at the end of a long line is dropped without it
+	m_textBufferManager->appendText(m_textBuffer, m_fontHandle, m_line, length);
+	m_textBufferManager->appendText(m_textBuffer, m_fontHandle, "\n", 1);
+}
+
+}
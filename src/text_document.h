@@ -0,0 +1,97 @@
+/* Copyright 2013 Jeremie Roy. All rights reserved.
+ * License: http://www.opensource.org/licenses/BSD-2-Clause
+*/
+#pragma once
+#include "text_buffer_manager.h"
+#include <stdio.h>
+
+namespace bgfx_font
+{
+
+/// View of a utf-8 text file too big to be laid out at once (e.g. a log of hundreds of megabytes).
+/// The file is streamed, never loaded: a sparse index of the byte offset of one line every linesPerEntry lines
+/// is built in steps, and only the window of lines around the visible ones is laid out in a text buffer.
+/// Scrolling reads at most linesPerEntry lines before the window and the lines of the window, whatever the size of the file.
+/// e.g:
+///		document.open("big.log");
+///		//each frame
+///		document.indexStep();
+///		document.scrollTo(firstVisibleLine, visibleLineCount);
+///		//draw the text buffer moved by document.getWindowTop() - scroll position
+class TextDocumentView
+{
+public:
+	/// @param textBuffer buffer receiving the lines of the window, it is cleared each time the window moves (DYNAMIC fits best)
+	/// @param fontHandle font of the text, its line height places the window in the document
+	/// @param linesPerEntry number of lines between two entries of the line index
+	/// @param marginLineCount lines laid out above and below the visible ones, so that small scrolls don't lay the window out again
+	TextDocumentView(TextBufferManager* textBufferManager, TextBufferHandle textBuffer, FontHandle fontHandle, uint32_t linesPerEntry = 256, uint32_t marginLineCount = 64);
+	~TextDocumentView();
+
+	/// start viewing a file, the previous one is closed
+	/// @remark the offsets are 64 bits, the file may be bigger than 4GB
+	/// @return false if the file can't be opened
+	bool open(const char* filePath);
+	void close();
+
+	/// index the next maxBytes bytes of the file, call it once per frame until the whole file is indexed
+	/// @remark the budget is in bytes only, there is no time budget: the call reads up to maxBytes synchronously on the calling thread
+	/// (usually the render thread), the caller drives the indexing and picks maxBytes to fit its frame
+	/// @return true once the whole file is indexed
+	bool indexStep(uint32_t maxBytes = 1 << 20);
+	bool isIndexed() const { return m_indexedBytes == m_fileSize; }
+	/// fraction of the file indexed, from 0 to 1
+	float getIndexProgress() const { return (m_fileSize > 0) ? (float)((double)m_indexedBytes / m_fileSize) : 1.0f; }
+
+	/// number of lines found so far, they can all be scrolled to
+	uint32_t getLineCount() const { return m_lineCount; }
+
+	/// make the lines [firstLine, firstLine + lineCount) visible, the window is laid out again with its margins when they are not in it
+	/// @remark the lines not indexed yet are left out of the window: firstLine and the end of the range are clamped to getLineCount,
+	/// a range past it gives a shorter (or empty) window. Calling scrollTo again once more lines are indexed lays the window out again
+	/// @return true if the text buffer was laid out again
+	bool scrollTo(uint32_t firstLine, uint32_t lineCount);
+
+	/// first line laid out in the text buffer and number of lines laid out
+	uint32_t getWindowFirstLine() const { return m_windowFirstLine; }
+	uint32_t getWindowLineCount() const { return m_windowLineCount; }
+
+	/// distance between two lines of the document, in pixels
+	float getLineHeight() const { return m_lineHeight; }
+	/// position of the first line of the window in the document (the text buffer is laid out from its pen position, whatever the window)
+	float getWindowTop() const { return m_windowFirstLine * m_lineHeight; }
+
+private:
+	/// lay out the lines [firstLine, firstLine + lineCount) in the text buffer
+	void layoutWindow(uint32_t firstLine, uint32_t lineCount);
+	void appendLine();
+
+	TextBufferManager* m_textBufferManager;
+	TextBufferHandle m_textBuffer;
+	FontHandle m_fontHandle;
+	uint32_t m_linesPerEntry;
+	uint32_t m_marginLineCount;
+	float m_lineHeight;
+
+	FILE* m_file;
+	uint64_t m_fileSize;
+
+	//byte offset of the lines 0, linesPerEntry, 2*linesPerEntry...
+	uint64_t* m_lineIndex;
+	uint32_t m_lineIndexCount;
+	uint32_t m_lineIndexCapacity;
+	uint64_t m_indexedBytes;
+	//complete lines found so far, plus the last one once the file is indexed
+	uint32_t m_lineCount;
+
+	uint32_t m_windowFirstLine;
+	uint32_t m_windowLineCount;
+
+	//chunk of the file being read
+	uint8_t* m_readBuffer;
+	//line being appended, lines longer than the buffer are cut
+	char* m_line;
+	uint32_t m_lineLength;
+};
+
+}
@@ -0,0 +1,217 @@
+/* Copyright 2013 Jeremie Roy. All rights reserved.
+ * License: http://www.opensource.org/licenses/BSD-2-Clause
+*/
+#include "text_shaper.h"
+
+#include <assert.h>
+#include <string.h>
+
+#if BGFX_CONFIG_USE_TINYSTL
+#	include <TINYSTL/unordered_map.h>
+namespace stl = tinystl;
+#else
+#	include <unordered_map>
+namespace std { namespace tr1 {} }
+namespace stl {
+	using namespace std;
+	using namespace std::tr1;
+}
+#endif // BGFX_CONFIG_USE_TINYSTL
+
+namespace bgfx_font
+{
+
+uint32_t SimpleTextShaper::shape(FontManager* fontManager, FontHandle fontHandle, uint32_t /*script*/, const CodePoint_t* codePoints, uint32_t count, ShapedGlyph* outGlyphs, uint32_t maxGlyphs)
+{
+	uint32_t glyphCount = 0;
+	for(uint32_t i = 0; i < count && glyphCount < maxGlyphs; ++i)
+	{
+		FontHandle font = fontManager->resolveFallbackFont(fontHandle, codePoints[i]);
+		int32_t glyphIndex = fontManager->getGlyphIndex(font, codePoints[i]);
+		//only the advance is needed, measuring doesn't bake the glyph
+		const GlyphInfo* glyph = fontManager->getGlyphMetrics(font, glyphIndex);
+
+		ShapedGlyph& shaped = outGlyphs[glyphCount];
+		shaped.glyphIndex = glyphIndex;
+		shaped.cluster = i;
+		shaped.fontHandle = font;
+		shaped.padding = 0;
+		shaped.offset_x = 0.0f;
+		shaped.offset_y = 0.0f;
+		shaped.advance_x = (glyph != NULL) ? glyph->advance_x : 0.0f;
+
+		//kerning only applies between glyphs of the same font, it moves the pen after the left glyph
+		if(glyphCount > 0 && outGlyphs[glyphCount-1].fontHandle.idx == font.idx)
+		{
+			outGlyphs[glyphCount-1].advance_x += fontManager->getKerning(font, outGlyphs[glyphCount-1].glyphIndex, glyphIndex);
+		}
+		++glyphCount;
+	}
+	return glyphCount;
+}
+
+// ****************************************************************************
+
+static const uint16_t INVALID_ENTRY = 0xffff;
+
+struct ShapedRunCache::HashTable
+{
+	// run hash to entry, runs colliding on the hash replace each other
+	stl::unordered_map<uint32_t, uint16_t> entries;
+};
+
+ShapedRunCache::ShapedRunCache(uint16_t capacity)
+{
+	assert(capacity > 0 && capacity < INVALID_ENTRY);
+	m_capacity = capacity;
+	m_entries = new Entry[capacity];
+	memset(m_entries, 0, capacity * sizeof(Entry));
+	m_table = new HashTable;
+	m_runCount = 0;
+	m_head = INVALID_ENTRY;
+	m_tail = INVALID_ENTRY;
+	m_hitCount = 0;
+	m_missCount = 0;
+	m_generation = 0;
+}
+
+ShapedRunCache::~ShapedRunCache()
+{
+	clear();
+	delete m_table;
+	delete [] m_entries;
+}
+
+uint32_t ShapedRunCache::hashRun(FontHandle fontHandle, uint32_t script, const CodePoint_t* codePoints, uint32_t count)
+{
+	//FNV-1a
+	uint32_t hash = 2166136261u;
+	hash = (hash ^ fontHandle.idx) * 16777619u;
+	hash = (hash ^ script) * 16777619u;
+	for(uint32_t i = 0; i < count; ++i)
+	{
+		hash = (hash ^ (uint32_t)codePoints[i]) * 16777619u;
+	}
+	return hash;
+}
+
+const ShapedGlyph* ShapedRunCache::find(FontHandle fontHandle, uint32_t script, const CodePoint_t* codePoints, uint32_t count, uint32_t& outGlyphCount)
+{
+	uint32_t hash = hashRun(fontHandle, script, codePoints, count);
+	stl::unordered_map<uint32_t, uint16_t>::iterator iter = m_table->entries.find(hash);
+	if(iter != m_table->entries.end())
+	{
+		Entry& entry = m_entries[iter->second];
+		if(entry.fontHandle.idx == fontHandle.idx
+			&& entry.script == script
+			&& entry.codePointCount == count
+			&& memcmp(entry.codePoints, codePoints, count * sizeof(CodePoint_t)) == 0)
+		{
+			unlink(iter->second);
+			pushFront(iter->second);
+			++m_hitCount;
+			outGlyphCount = entry.glyphCount;
+			return entry.glyphs;
+		}
+	}
+	++m_missCount;
+	outGlyphCount = 0;
+	return NULL;
+}
+
+const ShapedGlyph* ShapedRunCache::insert(FontHandle fontHandle, uint32_t script, const CodePoint_t* codePoints, uint32_t count, const ShapedGlyph* glyphs, uint32_t glyphCount)
+{
+	//recycle the least recently used entry when the cache is full
+	uint16_t entryIdx;
+	if(m_runCount < m_capacity)
+	{
+		entryIdx = m_runCount++;
+	}else
+	{
+		entryIdx = m_tail;
+		unlink(entryIdx);
+		release(entryIdx);
+	}
+
+	Entry& entry = m_entries[entryIdx];
+	entry.hash = hashRun(fontHandle, script, codePoints, count);
+	entry.script = script;
+	entry.fontHandle = fontHandle;
+	entry.codePointCount = count;
+	entry.codePoints = new CodePoint_t[count > 0 ? count : 1];
+	memcpy(entry.codePoints, codePoints, count * sizeof(CodePoint_t));
+	entry.glyphCount = glyphCount;
+	entry.glyphs = new ShapedGlyph[glyphCount > 0 ? glyphCount : 1];
+	memcpy(entry.glyphs, glyphs, glyphCount * sizeof(ShapedGlyph));
+	pushFront(entryIdx);
+	m_table->entries[entry.hash] = entryIdx;
+	return entry.glyphs;
+}
+
+void ShapedRunCache::clear()
+{
+	for(uint16_t i = 0; i < m_runCount; ++i)
+	{
+		delete [] m_entries[i].codePoints;
+		delete [] m_entries[i].glyphs;
+		m_entries[i].codePoints = NULL;
+		m_entries[i].glyphs = NULL;
+	}
+	m_table->entries.clear();
+	m_runCount = 0;
+	m_head = INVALID_ENTRY;
+	m_tail = INVALID_ENTRY;
+	++m_generation;
+}
+
+void ShapedRunCache::unlink(uint16_t entryIdx)
+{
+	Entry& entry = m_entries[entryIdx];
+	if(entry.previous != INVALID_ENTRY)
+	{
+		m_entries[entry.previous].next = entry.next;
+	}else
+	{
+		m_head = entry.next;
+	}
+	if(entry.next != INVALID_ENTRY)
+	{
+		m_entries[entry.next].previous = entry.previous;
+	}else
+	{
+		m_tail = entry.previous;
+	}
+}
+
+void ShapedRunCache::pushFront(uint16_t entryIdx)
+{
+	Entry& entry = m_entries[entryIdx];
+	entry.previous = INVALID_ENTRY;
+	entry.next = m_head;
+	if(m_head != INVALID_ENTRY)
+	{
+		m_entries[m_head].previous = entryIdx;
+	}
+	m_head = entryIdx;
+	if(m_tail == INVALID_ENTRY)
+	{
+		m_tail = entryIdx;
+	}
+}
+
+void ShapedRunCache::release(uint16_t entryIdx)
+{
+	Entry& entry = m_entries[entryIdx];
+	//a colliding run may have replaced the entry in the table
+	stl::unordered_map<uint32_t, uint16_t>::iterator iter = m_table->entries.find(entry.hash);
+	if(iter != m_table->entries.end() && iter->second == entryIdx)
+	{
+		m_table->entries.erase(iter);
+	}
+	delete [] entry.codePoints;
+	delete [] entry.glyphs;
+	entry.codePoints = NULL;
+	entry.glyphs = NULL;
+}
+
+}
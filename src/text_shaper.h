@@ -0,0 +1,116 @@
+/* Copyright 2013 Jeremie Roy. All rights reserved.
+ * License: http://www.opensource.org/licenses/BSD-2-Clause
+*/
+#pragma once
+#include "font_manager.h"
+
+namespace bgfx_font
+{
+
+/// A glyph positioned by the shaping stage
+/// @remark the metrics are unscaled, use the FontInfo::scale of fontHandle to size them
+struct ShapedGlyph
+{
+	/// glyph to render, in the glyph space of fontHandle (see FontManager::getGlyphInfoByIndex)
+	int32_t glyphIndex;
+	/// index in the run of the first code point this glyph was shaped from
+	/// a ligature covers several code points, a decomposed character produces several glyphs of the same cluster
+	uint32_t cluster;
+	/// font of the fallback chain providing the glyph
+	FontHandle fontHandle;
+	///32 bits alignment
+	int16_t padding;
+	/// offset of the glyph from the pen position (e.g. mark positioning), upwards y coordinates being positive
+	float offset_x;
+	float offset_y;
+	/// distance to increment the pen position by after the glyph, kerning included
+	float advance_x;
+};
+
+/// Convert a run of code points to positioned glyphs, in front of the layout.
+/// Implement it to plug a complex script shaper (ligatures, Arabic or Indic scripts, mark positioning)
+/// and install it with FontManager::setTextShaper.
+class TextShaper
+{
+public:
+	virtual ~TextShaper() {}
+
+	/// shape a run of code points that doesn't contain any line break
+	/// @param script ISO 15924 tag of the script of the run (e.g. 'Latn', 'Arab'), 0 if unknown
+	/// @param outGlyphs receive the glyphs in visual order
+	/// @return the number of glyphs written, at most maxGlyphs
+	virtual uint32_t shape(FontManager* fontManager, FontHandle fontHandle, uint32_t script, const CodePoint_t* codePoints, uint32_t count, ShapedGlyph* outGlyphs, uint32_t maxGlyphs) = 0;
+};
+
+/// Default shaper: one glyph per code point, taken from the cmap of the fallback chain, and pair kerning
+class SimpleTextShaper : public TextShaper
+{
+public:
+	virtual uint32_t shape(FontManager* fontManager, FontHandle fontHandle, uint32_t script, const CodePoint_t* codePoints, uint32_t count, ShapedGlyph* outGlyphs, uint32_t maxGlyphs);
+};
+
+/// LRU cache of shaped runs keyed by (font, script, text), so that repeated strings are shaped once
+class ShapedRunCache
+{
+public:
+	/// @param capacity maximum number of runs kept in the cache
+	ShapedRunCache(uint16_t capacity);
+	~ShapedRunCache();
+
+	/// look for a shaped run and mark it as the most recently used
+	/// @return the glyphs of the run or NULL if it is not in the cache, they stay valid until the next insertion
+	const ShapedGlyph* find(FontHandle fontHandle, uint32_t script, const CodePoint_t* codePoints, uint32_t count, uint32_t& outGlyphCount);
+
+	/// copy a shaped run in the cache, evicting the least recently used run when the cache is full
+	/// @return the cached copy of the glyphs
+	const ShapedGlyph* insert(FontHandle fontHandle, uint32_t script, const CodePoint_t* codePoints, uint32_t count, const ShapedGlyph* glyphs, uint32_t glyphCount);
+
+	/// forget every run (e.g. when a font or the shaper changes)
+	void clear();
+
+	/// number of runs in the cache
+	uint32_t getRunCount() const { return m_runCount; }
+	/// incremented each time the cache is cleared, data derived from shaped runs is stale once it changes
+	uint32_t getGeneration() const { return m_generation; }
+	/// number of lookups that found their run since the last reset
+	uint32_t getHitCount() const { return m_hitCount; }
+	/// number of lookups that missed their run since the last reset
+	uint32_t getMissCount() const { return m_missCount; }
+	void resetCounters() { m_hitCount = 0; m_missCount = 0; }
+
+private:
+	struct Entry
+	{
+		uint32_t hash;
+		uint32_t script;
+		FontHandle fontHandle;
+		// neighbours in the recently used list
+		uint16_t previous;
+		uint16_t next;
+		uint32_t codePointCount;
+		CodePoint_t* codePoints;
+		uint32_t glyphCount;
+		ShapedGlyph* glyphs;
+	};
+
+	static uint32_t hashRun(FontHandle fontHandle, uint32_t script, const CodePoint_t* codePoints, uint32_t count);
+	void unlink(uint16_t entry);
+	void pushFront(uint16_t entry);
+	void release(uint16_t entry);
+
+	Entry* m_entries;
+	uint16_t m_capacity;
+	uint16_t m_runCount;
+	// most and least recently used entries
+	uint16_t m_head;
+	uint16_t m_tail;
+
+	struct HashTable;
+	HashTable* m_table;
+
+	uint32_t m_hitCount;
+	uint32_t m_missCount;
+	uint32_t m_generation;
+};
+
+}
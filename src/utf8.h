@@ -0,0 +1,140 @@
+/* Copyright 2013 Jeremie Roy. All rights reserved.
+ * License: http://www.opensource.org/licenses/BSD-2-Clause
+*/
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#	define UTF8_SSE2 1
+#	include <emmintrin.h>
+#else
+#	define UTF8_SSE2 0
+#endif
+
+namespace bgfx_font
+{
+
+// Table from Flexible and Economical UTF-8 Decoder
+// Copyright (c) 2008-2009 Bjoern Hoehrmann <bjoern@hoehrmann.de>
+// See http://bjoern.hoehrmann.de/utf-8/decoder/dfa/ for details.
+
+static const uint8_t utf8d[] = {
+  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0, // 00..1f
+  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0, // 20..3f
+  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0, // 40..5f
+  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0, // 60..7f
+  1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9, // 80..9f
+  7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7, // a0..bf
+  8,8,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2, // c0..df
+  0xa,0x3,0x3,0x3,0x3,0x3,0x3,0x3,0x3,0x3,0x3,0x3,0x3,0x4,0x3,0x3, // e0..ef
+  0xb,0x6,0x6,0x6,0x5,0x8,0x8,0x8,0x8,0x8,0x8,0x8,0x8,0x8,0x8,0x8, // f0..ff
+  0x0,0x1,0x2,0x3,0x5,0x8,0x7,0x1,0x1,0x1,0x4,0x6,0x1,0x1,0x1,0x1, // s0..s0
+  1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,0,1,1,1,1,1,0,1,0,1,1,1,1,1,1, // s1..s2
+  1,2,1,1,1,1,1,2,1,2,1,1,1,1,1,1,1,1,1,1,1,1,1,2,1,1,1,1,1,1,1,1, // s3..s4
+  1,2,1,1,1,1,1,1,1,2,1,1,1,1,1,1,1,1,1,1,1,1,1,3,1,3,1,1,1,1,1,1, // s5..s6
+  1,3,1,1,1,1,1,3,1,3,1,1,1,1,1,1,1,3,1,1,1,1,1,1,1,1,1,1,1,1,1,1, // s7..s8
+};
+
+#define UTF8_ACCEPT 0
+#define UTF8_REJECT 1
+
+inline uint32_t utf8_decode(uint32_t* state, uint32_t* codep, uint32_t byte) {
+  uint32_t type = utf8d[byte];
+
+  *codep = (*state != UTF8_ACCEPT) ?
+    (byte & 0x3fu) | (*codep << 6) :
+    (0xff >> type) & (byte);
+
+  *state = utf8d[256 + *state*16 + type];
+  return *state;
+}
+
+inline int utf8_strlen(uint8_t* s, size_t* count) {
+  uint32_t codepoint;
+  uint32_t state = 0;
+
+  for (*count = 0; *s; ++s)
+    if (!utf8_decode(&state, &codepoint, *s))
+      *count += 1;
+
+  return state != UTF8_ACCEPT;
+}
+
+/// return true if the 16 bytes are all ASCII (below 0x80)
+inline bool utf8_is_ascii16(const uint8_t* s) {
+#if UTF8_SSE2
+  return _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)s)) == 0;
+#else
+  uint64_t words[2];
+  memcpy(words, s, 16);
+  return ((words[0] | words[1]) & 0x8080808080808080ULL) == 0;
+#endif
+}
+
+/// widen 16 ASCII bytes to 16 code points
+inline void utf8_widen16(const uint8_t* s, uint32_t* out) {
+#if UTF8_SSE2
+  __m128i zero = _mm_setzero_si128();
+  __m128i bytes = _mm_loadu_si128((const __m128i*)s);
+  __m128i low = _mm_unpacklo_epi8(bytes, zero);
+  __m128i high = _mm_unpackhi_epi8(bytes, zero);
+  _mm_storeu_si128((__m128i*)(out), _mm_unpacklo_epi16(low, zero));
+  _mm_storeu_si128((__m128i*)(out + 4), _mm_unpackhi_epi16(low, zero));
+  _mm_storeu_si128((__m128i*)(out + 8), _mm_unpacklo_epi16(high, zero));
+  _mm_storeu_si128((__m128i*)(out + 12), _mm_unpackhi_epi16(high, zero));
+#else
+  for (int i = 0; i < 16; ++i)
+    out[i] = s[i];
+#endif
+}
+
+/// decode length bytes of utf-8 to out, which must have room for length code points
+/// the runs of 16 ASCII bytes are widened at once, the other bytes go through the DFA
+/// like utf8_decode, decoding stops at the first malformed sequence and a truncated last sequence is dropped
+/// @return the number of code points written
+inline uint32_t utf8_decode_string(const uint8_t* s, uint32_t length, uint32_t* out) {
+  uint32_t codepoint = 0;
+  uint32_t state = UTF8_ACCEPT;
+  uint32_t count = 0;
+  uint32_t i = 0;
+  while (i < length) {
+    for (; i + 16 <= length && utf8_is_ascii16(s + i); i += 16, count += 16)
+      utf8_widen16(s + i, out + count);
+
+    // the DFA decodes up to the end of the next multi-bytes sequence, then the ASCII runs are looked for again
+    while (i < length) {
+      uint8_t byte = s[i++];
+      if (!utf8_decode(&state, &codepoint, byte)) {
+        out[count++] = codepoint;
+        if (byte >= 0x80)
+          break;
+      } else if (state == UTF8_REJECT) {
+        return count;
+      }
+    }
+  }
+  return count;
+}
+
+/// decode length units of utf-16 to out, which must have room for length code points
+/// an unpaired surrogate is decoded as U+FFFD
+/// @return the number of code points written
+inline uint32_t utf16_decode_string(const uint16_t* s, uint32_t length, uint32_t* out) {
+  uint32_t count = 0;
+  for (uint32_t i = 0; i < length; ++i) {
+    uint32_t unit = s[i];
+    if (unit - 0xd800u >= 0x800u) {
+      out[count++] = unit;
+    } else if (unit < 0xdc00u && i + 1 < length && (uint32_t)s[i + 1] - 0xdc00u < 0x400u) {
+      out[count++] = 0x10000u + ((unit - 0xd800u) << 10) + (s[i + 1] - 0xdc00u);
+      ++i;
+    } else {
+      out[count++] = 0xfffdu;
+    }
+  }
+  return count;
+}
+
+}